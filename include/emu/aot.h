@@ -0,0 +1,122 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*==============================================================================
+ *   File: include/emu/aot.h
+ * Author: Wes Hampson
+ *   Desc: Ahead-of-time translated code for the LC-3c.
+ *         lc3aot compiles the basic blocks of an object image into a host
+ *         shared object; the emulator loads it and runs those blocks natively,
+ *         leaving everything else to the interpreter.
+ *============================================================================*/
+
+#ifndef __AOT_H
+#define __AOT_H
+
+#include <emu/lc3.h>
+
+/*
+ * Module interface version. Bump whenever struct aot_module, the block entry
+ * point, or the meaning of either changes.
+ */
+#define AOT_ABI_VERSION 3
+
+/*
+ * Name of the module descriptor exported by a translated shared object.
+ */
+#define AOT_MODULE_SYMBOL   "lc3aot_module"
+
+/*
+ * Store helper passed to translated code. Performs a memory write exactly as
+ * mem_write_nodelay() would.
+ */
+typedef void (*aot_store_fn)(void *m, unsigned int addr, unsigned int data,
+                             unsigned int wmask);
+
+/*
+ * Translated code entry point. Runs the basic block starting at the CPU's PC
+ * and leaves the CPU at the start of the next instruction, exactly as the
+ * interpreter would after running the same instructions.
+ *
+ * @param cpu   the CPU state (struct lc3cpu)
+ * @param pages the memory page table (see mem_pages())
+ * @param store the store helper
+ * @param m     the machine, passed back to the store helper
+ * @return      the number of clock cycles spent
+ *              0 if nothing ran
+ */
+typedef int (*aot_run_fn)(void *cpu, lc3word **pages, aot_store_fn store,
+                          void *m);
+
+/*
+ * Module descriptor, as laid out by lc3aot-generated code.
+ */
+struct aot_module {
+    unsigned int abi;           /* AOT_ABI_VERSION */
+    unsigned int cpu_size;      /* sizeof(struct lc3cpu) it was built for */
+    lc3word origin;             /* image load address */
+    unsigned int size;          /* image size in words */
+    const lc3word *image;       /* image contents */
+    unsigned int num_blocks;    /* number of translated blocks */
+    const lc3word *blocks;      /* block start/end address pairs */
+    aot_run_fn run;             /* entry point */
+};
+
+/*
+ * Load a translated shared object. Errors are reported on stderr.
+ *
+ * @param path  the shared object file
+ * @return      0 on success
+ *              -1 on failure
+ */
+int aot_load(struct lc3machine *m, const char *path);
+
+/*
+ * Unload the module loaded into a machine, if any.
+ */
+void aot_unload(struct lc3machine *m);
+
+/*
+ * Get the object image a loaded module was translated from.
+ *
+ * @param origin    a pointer to store the load address
+ * @param size      a pointer to store the size in words
+ * @return          the image contents
+ *                  NULL if no module is loaded
+ */
+const lc3word * aot_image(struct lc3machine *m, lc3word *origin,
+                          unsigned int *size);
+
+/*
+ * Run the translated block starting at the current PC. The CPU must be at
+ * the start of an instruction with no interrupt pending.
+ *
+ * @param room  the most clock cycles the block may take; a block that could
+ *              take longer is left to the interpreter
+ * @return      the number of clock cycles spent
+ *              0 if no block was run; the interpreter should take over
+ */
+int aot_exec(struct lc3machine *m, uint64_t room);
+
+/*
+ * Re-check translated blocks covering a memory address. A block only runs
+ * while memory still holds the code it was translated from.
+ * Called on every memory write.
+ *
+ * @param addr  the address written
+ */
+void aot_invalidate(struct lc3machine *m, lc3word addr);
+
+#endif /* __AOT_H */
@@ -0,0 +1,93 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: include/emu/batch.h
+ * Author: Wes Hampson
+ *   Desc: Batch runner. Runs many independent jobs in one process, spread
+ *         over a work-stealing pool of worker threads, from a manifest or
+ *         as they arrive at a server socket.
+ *============================================================================*/
+
+#ifndef __BATCH_H
+#define __BATCH_H
+
+#include <emu/cpu.h>
+#include <emu/cache.h>
+
+/*
+ * Run every job in a manifest and write the results.
+ *
+ * Each manifest line names an object image, a file to feed to the keyboard
+ * ('-' for none) and a cycle budget, separated by whitespace. Blank lines and
+ * text after '#' are ignored. Each job starts from the same initial machine,
+ * either booted with the built-in OS or restored from 'snapshot', loads its
+ * image, and runs until the clock is disabled or the budget is spent. Its
+ * status, cycle count, display output and final registers are written to the
+ * results file in manifest order.
+ *
+ * @param manifest  the manifest file
+ * @param results   the results file ("-" for STDOUT)
+ * @param engine    the execution engine to use
+ * @param module    an lc3aot module to load into every machine, or NULL
+ * @param snapshot  a snapshot to start every machine from instead of booting
+ *                  the OS, or NULL
+ * @param memory    KiB of RAM each machine has (see mem_limit()), or 0 for
+ *                  all of it
+ * @param trap_cost cycles per natively serviced TRAP (see traps_enable()),
+ *                  or 0 to run the guest's trap routines
+ * @param cache     a cache to look jobs up in and store their results in
+ *                  (see cache_open()), or NULL
+ * @param workers   the number of worker threads (0 for one per core)
+ * @return          0 on success
+ *                  1 on a malformed manifest
+ *                  2 if the manifest, results or snapshot file cannot be
+ *                  opened
+ */
+int batch_run(const char *manifest, const char *results,
+              enum lc3engine engine, const char *module, const char *snapshot,
+              unsigned int memory, int trap_cost, struct lc3cache *cache,
+              int workers);
+
+/*
+ * Serve jobs over a Unix domain socket, until the socket fails.
+ *
+ * A client sends a request line naming an object image (opened by the
+ * server), the length of its keyboard input in bytes and a cycle budget,
+ * followed by exactly that many bytes of input. The job's results come back
+ * in the same format as batch_run() writes them, numbered from 1 on each
+ * connection. Any number of requests may be sent over one connection, and
+ * a malformed one gets an error line and the connection closed. Each worker
+ * thread serves one connection at a time from a machine set up once (booted,
+ * or restored from 'snapshot') and rewound between jobs; a socket left at
+ * 'path' by an earlier server is replaced.
+ *
+ * @param path      the socket path
+ * @param engine    the execution engine to use
+ * @param module    an lc3aot module to load into every machine, or NULL
+ * @param snapshot  a snapshot to start every machine from instead of booting
+ *                  the OS, or NULL
+ * @param memory    KiB of RAM each machine has, or 0 for all of it
+ * @param trap_cost cycles per natively serviced TRAP, or 0
+ * @param cache     a result cache, or NULL
+ * @param workers   the number of worker threads (0 for one per core)
+ * @return          2 if the socket cannot be set up or fails
+ */
+int batch_serve(const char *path, enum lc3engine engine, const char *module,
+                const char *snapshot, unsigned int memory, int trap_cost,
+                struct lc3cache *cache, int workers);
+
+#endif /* __BATCH_H */
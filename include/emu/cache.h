@@ -0,0 +1,112 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: include/emu/cache.h
+ * Author: Wes Hampson
+ *   Desc: On-disk result cache. Each entry holds the results of one run and
+ *         is named by a 128-bit hash of everything that determines them, so
+ *         an identical run can be answered without executing anything.
+ *
+ *         Entries are written to a temporary file and renamed into place, so
+ *         any number of processes may share a cache directory and never see
+ *         a partial entry. A hit touches its entry's modification time; when
+ *         the directory grows past its size limit, the least recently used
+ *         entries are deleted.
+ *============================================================================*/
+
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bump whenever any engine's results could change for the same run, so
+ * entries from older versions are never used.
+ */
+#define CACHE_VERSION   1
+
+/*
+ * Default size limit, in bytes.
+ */
+#define CACHE_SIZE      (256ULL << 20)
+
+/*
+ * A cache key, built up from the inputs to a run. Not a cryptographic hash:
+ * anyone who can write to the cache directory can forge results anyway.
+ */
+struct lc3cachekey {
+    uint64_t h[2];
+};
+
+struct lc3cache;
+
+/*
+ * Open a cache directory, creating it if needed, and trim it to its size
+ * limit. Errors are reported on stderr.
+ *
+ * @param dir       the cache directory
+ * @param max_size  the most bytes of entries to keep
+ * @return          the cache
+ *                  NULL if the directory cannot be created or opened
+ */
+struct lc3cache * cache_open(const char *dir, uint64_t max_size);
+
+/*
+ * Close a cache. Safe to call on NULL.
+ */
+void cache_close(struct lc3cache *c);
+
+/*
+ * Start a key, mixing in CACHE_VERSION.
+ */
+void cache_key_init(struct lc3cachekey *k);
+
+/*
+ * Mix bytes into a key. Variable-length data should be preceded by its
+ * length, so that adjacent fields cannot run into each other.
+ *
+ * @param data  the bytes to add
+ * @param len   the number of bytes
+ */
+void cache_key_add(struct lc3cachekey *k, const void *data, size_t len);
+
+/*
+ * Look up an entry, marking it as recently used. Corrupt entries are deleted
+ * and count as misses. Safe to call from several threads at once.
+ *
+ * @param data  a pointer to store the entry's contents, to be freed by the
+ *              caller
+ * @param len   a pointer to store the length of the contents
+ * @return      0 on a hit
+ *              -1 on a miss
+ */
+int cache_get(struct lc3cache *c, const struct lc3cachekey *k,
+              char **data, size_t *len);
+
+/*
+ * Store an entry, replacing any with the same key, and evict the least
+ * recently used entries if the cache has grown past its limit. Failures only
+ * lose the entry. Safe to call from several threads at once.
+ *
+ * @param data  the contents to store
+ * @param len   the length of the contents
+ */
+void cache_put(struct lc3cache *c, const struct lc3cachekey *k,
+               const char *data, size_t len);
+
+#endif /* __CACHE_H */
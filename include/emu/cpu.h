@@ -22,8 +22,67 @@
 #ifndef __CPU_H
 #define __CPU_H
 
+#include <stdio.h>
 #include <emu/lc3.h>
 
+/*
+ * Instruction cycle counts.
+ * Each value is the number of clock cycles the microcoded path spends on the
+ * instruction, from its fetch state (18, or 19 after STB) to just before the
+ * next fetch state. Engines that run whole instructions charge these to stay
+ * cycle-accurate.
+ */
+#define FETCH_CYCLES    (3 + MEM_CYCLES)    /* 18, 33, 35, 32 */
+
+#define CYC_BR          (FETCH_CYCLES + 1)              /* 0 (+22 if taken) */
+#define CYC_ALU         (FETCH_CYCLES + 1)              /* 1, 5, 9, 13, 14 */
+#define CYC_LDB         (FETCH_CYCLES + 2 + MEM_CYCLES) /* 2, 29, 31 */
+#define CYC_STB         (FETCH_CYCLES + 2 + MEM_CYCLES) /* 3, 24, 17 */
+#define CYC_JSR         (FETCH_CYCLES + 2)              /* 4, 20/21 */
+#define CYC_LDW         (FETCH_CYCLES + 2 + MEM_CYCLES) /* 6, 25, 27 */
+#define CYC_STW         (FETCH_CYCLES + 2 + MEM_CYCLES) /* 7, 23, 16 */
+#define CYC_LDI         (FETCH_CYCLES + 3 + 2*MEM_CYCLES) /* 10, 56, 58, 25, 27 */
+#define CYC_STI         (FETCH_CYCLES + 3 + 2*MEM_CYCLES) /* 11, 60, 62, 23, 16 */
+#define CYC_JMP         (FETCH_CYCLES + 1)              /* 12 */
+#define CYC_TRAP        (FETCH_CYCLES + 2 + MEM_CYCLES) /* 15, 28, 30 */
+
+/*
+ * Memory-mapped I/O test.
+ * Engines that run whole instructions leave anything touching the I/O page
+ * to the microcode, which models the device access timing.
+ */
+#define IS_IO(addr)     ((addr) >= A_IO)
+
+/*
+ * Condition codes (PSR[2:0]) set by a result.
+ */
+#define CC_NZP(val)     (((val) & 0x8000) ? 4 : ((val) == 0) ? 2 : 1)
+
+/*
+ * Microcode state that begins an instruction (fetch, or interrupt entry).
+ * Engines that run whole instructions only take over from this state.
+ */
+#define INITIAL_STATE   18
+
+/*
+ * Instruction boundary test. The microcode fetches the instruction after an
+ * STB in state 19, which does the same as state 18; an engine that leaves an
+ * STB to the microcode stays on the microcode until the next state 18.
+ */
+#define IS_FETCH(state) ((state) == INITIAL_STATE || (state) == 19)
+
+/*
+ * Execution engines.
+ */
+enum lc3engine {
+    ENGINE_MICRO,   /* microcoded; one state per clock cycle */
+    ENGINE_FAST,    /* instruction-level; one instruction per dispatch */
+    ENGINE_JIT,     /* basic blocks translated to host code (x86-64) */
+    ENGINE_AOT,     /* basic blocks translated ahead of time by lc3aot */
+    ENGINE_SIMD,    /* many machines in lockstep, one vector lane each */
+    NUM_ENGINES     /* (number of engines) */
+};
+
 /*
  * Reset the CPU.
  *
@@ -32,26 +91,81 @@
  *   - R6 set to default supervisor stack pointer (0x3000)
  *   - Zero flag set to 1
  */
-void cpu_reset(void);
+void cpu_reset(struct lc3machine *m);
+
+/*
+ * Register the Machine Control Register.
+ *
+ * @return      0 on success
+ *              -1 if out of memory
+ */
+int cpu_init(struct lc3machine *m);
 
 /*
  * Execute one clock cycle.
+ * Devices are not clocked.
+ */
+void cpu_tick(struct lc3machine *m);
+
+/*
+ * Execute one whole instruction.
+ *
+ * The instruction runs in a single dispatch and is charged the same number of
+ * clock cycles the microcoded path would take. Anything the instruction-level
+ * engine does not model (a pending interrupt, RTI, memory-mapped I/O, or a CPU
+ * that is not at the start of a FETCH cycle) falls back to a single microcoded
+ * state, so the machine behaves exactly as it would under cpu_tick().
+ *
+ * Devices are not clocked; the caller must clock them once before calling
+ * this, and once more for each additional cycle consumed.
+ *
+ * @return the number of clock cycles consumed
+ */
+int cpu_step(struct lc3machine *m);
+
+/*
+ * Get the most clock cycles cpu_step() can charge for an instruction.
+ * Engines that run several instructions at once add these up to know how far
+ * a block may run before a device event or the end of its budget.
+ *
+ * @param ir    the instruction
+ * @return      the worst-case cycle count
+ *              0 for RTI, which is always left to the microcode
+ */
+int cpu_cost(lc3word ir);
+
+/*
+ * Run the machine until the clock is disabled or a number of clock cycles have
+ * elapsed. Every device is clocked once per CPU clock cycle.
+ *
+ * The microcoded engine stops on the exact cycle. The instruction-level engine
+ * runs whole instructions, so it may run a few cycles past the limit, but the
+ * I/O accesses, RTI and interrupt entries it leaves to the microcode run one
+ * state at a time, and a run can stop in the middle of those. The block
+ * engines (jit and aot) only enter a block whose worst case ends within the
+ * limit and before the next device event (sched.next) could be seen, and
+ * step one instruction at a time otherwise. So they stop, and take
+ * interrupts, at the same points as the instruction-level engine.
+ *
+ * @param engine    the execution engine to use
+ * @param max       the maximum number of clock cycles to run
+ * @return          the number of clock cycles run
  */
-void cpu_tick(void);
+uint64_t cpu_run(struct lc3machine *m, enum lc3engine engine, uint64_t max);
 
 /*
  * Get the current value of INTF (boolean).
  *
  * @return the current value of INTF
  */
-int cpu_intf(void);
+int cpu_intf(struct lc3machine *m);
 
 /*
  * Get the current priority level.
  *
  * @return the current priority level
  */
-int cpu_prio(void);
+int cpu_prio(struct lc3machine *m);
 
 /*
  * Raise an interrupt on the CPU.
@@ -59,25 +173,83 @@ int cpu_prio(void);
  * @param vec   the interrupt vector
  * @param prio  the interrupt priority
  */
-void cpu_interrupt(lc3byte vec, lc3byte prio);
+void cpu_interrupt(struct lc3machine *m, lc3byte vec, lc3byte prio);
+
+/*
+ * Discard the predecoded copy of the instruction at an address, if any.
+ * Must be called whenever a word of memory is written.
+ *
+ * @param addr  the address written to
+ */
+void cpu_invalidate(struct lc3machine *m, lc3word addr);
+
+/*
+ * Get the value of a register.
+ *
+ * @param reg   the register to read
+ * @return      the current value of the register
+ */
+lc3word cpu_getreg(struct lc3machine *m, enum lc3reg reg);
+
+/*
+ * Set the value of a register.
+ *
+ * @param reg   the register to write
+ * @param value the new value
+ */
+void cpu_setreg(struct lc3machine *m, enum lc3reg reg, lc3word value);
 
 /*
  * Dump the current register values to STDOUT.
  */
-void cpu_dumpregs(void);
+void cpu_dumpregs(struct lc3machine *m);
+
+/*
+ * Dump the current register values to a stream.
+ *
+ * @param f     the stream to write to
+ */
+void cpu_fdumpregs(struct lc3machine *m, FILE *f);
 
 /*
  * Get the value of the Machine Control Register.
  *
  * @return      current value in MCR
  */
-lc3word get_mcr(void);
+lc3word get_mcr(struct lc3machine *m);
 
 /*
  * Set the value of the Machine Control Register.
  *
  * @param value the value to put in MCR
  */
-void set_mcr(lc3word value);
+void set_mcr(struct lc3machine *m, lc3word value);
+
+/*
+ * Get the value of a CPU's PSR.
+ * Instructions only record the result that sets the condition codes, and
+ * PSR[2:0] is worked out from it here, so read the PSR through this rather
+ * than from 'psr.value'.
+ *
+ * @return      current value in PSR
+ */
+static inline lc3word cpu_psr(const struct lc3cpu *cpu)
+{
+    if (cpu->cc == CC_PSR) {
+        return cpu->psr.value;
+    }
+    return (cpu->psr.value & 0xFFF8) | CC_NZP((lc3word) cpu->cc);
+}
+
+/*
+ * Set the value of a CPU's PSR, condition codes included.
+ *
+ * @param value the value to put in PSR
+ */
+static inline void cpu_setpsr(struct lc3cpu *cpu, lc3word value)
+{
+    cpu->psr.value = value;
+    cpu->cc = CC_PSR;
+}
 
 #endif /* __CPU_H */
@@ -29,51 +29,101 @@
  */
 #define DISP_IRQ    3
 
+/*
+ * Default interval between flushes of buffered terminal output, in
+ * milliseconds.
+ */
+#define DISP_FLUSH_MS   20
+
 /*
  * Display state.
  */
 struct lc3disp {
     lc3word dsr;    /* status register */
     lc3word ddr;    /* data register */
-    unsigned int c; /* busy counter */
+    uint64_t done;  /* cycle the current write completes on */
 };
 
+/*
+ * Register the display's I/O registers.
+ *
+ * @return      0 on success
+ *              -1 if out of memory
+ */
+int disp_init(struct lc3machine *m);
+
 /*
  * Reset the display state.
  */
-void disp_reset(void);
+void disp_reset(struct lc3machine *m);
 
 /*
- * Execute one clock cycle on the display device.
+ * Complete a write to DDR. Run by the scheduler (EV_DISP).
  */
-void disp_tick(void);
+void disp_event(struct lc3machine *m);
 
 /*
  * Get the value of the Display Status Register.
  *
  * @return      current value in DSR
  */
-lc3word get_dsr(void);
+lc3word get_dsr(struct lc3machine *m);
 
 /*
  * Set the value of the Display Status Register.
  *
  * @param value the value to put in DSR
  */
-void set_dsr(lc3word value);
+void set_dsr(struct lc3machine *m, lc3word value);
 
 /*
  * Get the value of the Display Data Register.
  *
  * @return      current value in DDR
  */
-lc3word get_ddr(void);
+lc3word get_ddr(struct lc3machine *m);
 
 /*
  * Set the value of the Display Data Register.
  *
  * @param value the value to put in DDR
  */
-void set_ddr(lc3word value);
+void set_ddr(struct lc3machine *m, lc3word value);
+
+/*
+ * Display a character at once, bypassing DDR. Any character the display is
+ * still sending goes first, and the display is left ready.
+ *
+ * @param c     the character to display
+ */
+void disp_put(struct lc3machine *m, int c);
+
+/*
+ * Configure terminal output. Output is buffered and written out once enough
+ * has built up, once the oldest character has waited 'flush_ms', or on
+ * disp_term_flush(). Pending output is flushed first.
+ *
+ * @param flush_ms  the longest output may stay buffered, in milliseconds;
+ *                  0 writes every character as soon as it is displayed
+ * @param thread    nonzero to write from a background thread, so the
+ *                  interval is kept even while nothing is displayed
+ */
+void disp_term_setup(int flush_ms, int thread);
+
+/*
+ * Default display output hook: queue a character for the terminal.
+ *
+ * @param ctx   unused
+ * @param c     the character to write
+ */
+void disp_term_putc(void *ctx, int c);
+
+/*
+ * Default display flush hook: write out all buffered terminal output, and
+ * wait until it has been written.
+ *
+ * @param ctx   unused
+ */
+void disp_term_flush(void *ctx);
 
 #endif /* __DISP_H */
@@ -0,0 +1,69 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*==============================================================================
+ *   File: include/emu/headless.h
+ * Author: Wes Hampson
+ *   Desc: Headless I/O. Feeds the keyboard from a file or pipe and sends the
+ *         display to a file or a memory buffer, so a machine can run with no
+ *         terminal attached.
+ *============================================================================*/
+
+#ifndef __HEADLESS_H
+#define __HEADLESS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <emu/lc3.h>
+
+/*
+ * Headless I/O state.
+ */
+struct headless {
+    struct lc3machine *m;   /* machine the hooks are attached to */
+    FILE *in;               /* keyboard input, or NULL once exhausted */
+    FILE *out;              /* display output, or NULL to use 'buf' */
+    int pipe;               /* 'in' may block; flush 'out' before reading */
+    uint64_t rate;          /* minimum cycles between keys */
+    uint64_t next;          /* earliest cycle for the next key */
+    char *buf;              /* display output, if 'out' is NULL */
+    size_t len;
+    size_t cap;
+};
+
+/*
+ * Replace a machine's I/O hooks with headless ones.
+ *
+ * Each input byte is delivered once the program has read the previous one
+ * from KBDR, so none are lost; with a nonzero rate, keys also arrive at least
+ * that many cycles apart. Input is delivered on keyboard polls, so rates
+ * finer than KBD_POLL_CYCLES only apply while the program is reading keys.
+ *
+ * @param h     the state to initialize; must outlive the hooks
+ * @param in    keyboard input, or NULL for none
+ * @param out   display output, or NULL to collect it in h->buf
+ * @param rate  minimum cycles between keys, 0 to deliver each key as soon
+ *              as the previous one has been read
+ */
+void headless_attach(struct headless *h, struct lc3machine *m, FILE *in,
+                     FILE *out, uint64_t rate);
+
+/*
+ * Flush display output and release the memory buffer. The streams are left
+ * open.
+ */
+void headless_detach(struct headless *h);
+
+#endif /* __HEADLESS_H */
@@ -0,0 +1,75 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: include/emu/idle.h
+ * Author: Wes Hampson
+ *   Desc: Idle-loop detection.
+ *         Guests spend most of their time in wait loops: a branch to itself,
+ *         or a load of KBSR or DSR followed by a branch back to it. When a
+ *         backward branch returns to the same PC with the CPU in exactly the
+ *         state it was in one iteration ago, and nothing was written to memory
+ *         and no device event ran in between, every further iteration is the
+ *         same until the next device event. Those iterations are skipped and
+ *         their cycles credited, so results and cycle counts are unchanged.
+ *============================================================================*/
+
+#ifndef __IDLE_H
+#define __IDLE_H
+
+#include <stdint.h>
+#include <emu/lc3.h>
+
+/*
+ * Milliseconds to block waiting for input when the machine is idle until the
+ * next keyboard poll.
+ */
+#define IDLE_WAIT_MS    100
+
+/*
+ * Idle detector state.
+ */
+struct lc3idle {
+    lc3word last;           /* PC at the previous instruction boundary */
+    lc3word head;           /* loop head being watched */
+    int armed;              /* 'snap' holds the state at 'head' */
+    struct lc3cpu snap;     /* CPU state on the last arrival at 'head' */
+    uint64_t now;           /* device cycle of that arrival */
+    uint64_t writes;        /* memory writes by then */
+    uint64_t changes;       /* scheduler changes by then */
+};
+
+/*
+ * Forget any loop being watched.
+ */
+void idle_reset(struct lc3machine *m);
+
+/*
+ * Check for an idle loop on arriving at a loop head (an instruction boundary
+ * reached by a backward transfer), and skip ahead if the machine is idle.
+ * Whole iterations are skipped up to, but not into, the next device event. If
+ * that event is a keyboard poll, first block until input arrives or
+ * IDLE_WAIT_MS elapse.
+ *
+ * The device clock is advanced by the cycles skipped; crediting them to the
+ * CPU is left to the caller.
+ *
+ * @param budget    the cycles the engine may still run (at least 1)
+ * @return          the number of cycles skipped
+ */
+uint64_t idle_skip(struct lc3machine *m, uint64_t budget);
+
+#endif /* __IDLE_H */
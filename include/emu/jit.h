@@ -0,0 +1,65 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*==============================================================================
+ *   File: include/emu/jit.h
+ * Author: Wes Hampson
+ *   Desc: Basic-block translator for the LC-3c.
+ *         Hot guest basic blocks are compiled to x86-64 machine code and run
+ *         directly on the host. Anything the translator does not handle
+ *         (memory-mapped I/O, RTI, interrupt delivery) is left to the
+ *         interpreter.
+ *============================================================================*/
+
+#ifndef __JIT_H
+#define __JIT_H
+
+#include <emu/lc3.h>
+
+/*
+ * Allocate the translation buffer or, if the machine already has one,
+ * discard its contents and hotness counts as if it were new.
+ *
+ * @return      0 on success
+ *              -1 if the host does not support translation
+ */
+int jit_init(struct lc3machine *m);
+
+/*
+ * Run the translated block starting at the current PC, translating it first
+ * if it has become hot. The CPU must be at the start of an instruction with
+ * no interrupt pending.
+ *
+ * @param room  the most clock cycles the block may take; a block that could
+ *              take longer is left to the interpreter
+ * @return      the number of clock cycles spent
+ *              0 if no block was run; the interpreter should take over
+ */
+int jit_exec(struct lc3machine *m, uint64_t room);
+
+/*
+ * Discard any translated code covering a memory address.
+ * Called on every memory write.
+ *
+ * @param addr  the address written
+ */
+void jit_invalidate(struct lc3machine *m, lc3word addr);
+
+/*
+ * Release the translation buffer.
+ */
+void jit_free(struct lc3machine *m);
+
+#endif /* __JIT_H */
@@ -29,50 +29,84 @@
  */
 #define KBD_IRQ     4
 
+/*
+ * Clock cycles between keyboard polls while no input is being read.
+ */
+#define KBD_POLL_CYCLES 10000
+
 /*
  * Keyboard state.
  */
 struct lc3kbd {
     lc3word kbsr;   /* status register */
     lc3word kbdr;   /* data register */
+    int taken;      /* KBDR has been read since the last key arrived */
 };
 
+/*
+ * Register the keyboard's I/O registers.
+ *
+ * @return      0 on success
+ *              -1 if out of memory
+ */
+int kbd_init(struct lc3machine *m);
+
 /*
  * Reset the keyboard state.
  */
-void kbd_reset(void);
+void kbd_reset(struct lc3machine *m);
 
 /*
- * Execute one clock cycle on the keyboard.
+ * Poll for a key. Run by the scheduler (EV_KBD) every KBD_POLL_CYCLES, and on
+ * the cycle after the program reads KBDR.
  */
-void kbd_tick(void);
+void kbd_event(struct lc3machine *m);
 
 /*
  * Get the value of the Keyboard Status Register.
  *
  * @return      current value in KBSR
  */
-lc3word get_kbsr(void);
+lc3word get_kbsr(struct lc3machine *m);
 
 /*
  * Set the value of the Keyboard Status Register.
  *
  * @param value the value to put in KBSR
  */
-void set_kbsr(lc3word value);
+void set_kbsr(struct lc3machine *m, lc3word value);
 
 /*
  * Get the value of the Keyboard Data Register.
  *
  * @return      current value in KBDR
  */
-lc3word get_kbdr(void);
+lc3word get_kbdr(struct lc3machine *m);
 
 /*
  * Set the value of the Keyboard Data Register.
  *
  * @param value the value to put in KBDR
  */
-void set_kbdr(lc3word value);
+void set_kbdr(struct lc3machine *m, lc3word value);
+
+/*
+ * Default keyboard input hook: take the next key read from the terminal,
+ * without blocking. Keys are read by a background thread that is started on
+ * first use. Exits the program when Ctrl+C is read.
+ *
+ * @param ctx   unused
+ * @return      the next character, or -1 if no key has been pressed
+ */
+int kbd_term_getc(void *ctx);
+
+/*
+ * Default keyboard wait hook: block until a key has been read from the
+ * terminal or a timeout elapses.
+ *
+ * @param ctx   unused
+ * @param ms    the timeout in milliseconds
+ */
+void kbd_term_wait(void *ctx, int ms);
 
 #endif /* __KBD_H */
@@ -51,6 +51,7 @@
 #define A_START         0x0400  /* initial PC value (start of execution) */
 #define A_SSP           0x3000  /* default supervisor stack pointer */
 #define A_USP           0xFE00  /* default user stack pointer */
+#define A_IO            0xFE00  /* start of memory-mapped I/O */
 #define A_KBSR          0xFE00  /* keyboard status register */
 #define A_KBDR          0xFE02  /* keyboard data register */
 #define A_DSR           0xFE04  /* display status register */
@@ -78,6 +79,12 @@
 #define MEM_DELAY       1
 #define DISP_DELAY      1
 
+/*
+ * Number of clock cycles taken by a memory access (the access state spins
+ * until memory is ready, then runs once more to latch the data).
+ */
+#define MEM_CYCLES      (MEM_DELAY + 1)
+
 /*
  * LC-3 data types.
  */
@@ -85,6 +92,16 @@ typedef uint8_t         lc3byte;
 typedef uint16_t        lc3word;
 typedef int16_t         lc3sword;
 
+/*
+ * An emulated machine; see emu/machine.h.
+ */
+struct lc3machine;
+
+/*
+ * Marks the condition codes as held in the PSR; see lc3cpu.cc.
+ */
+#define CC_PSR          (-1)
+
 /*
  * The LC-3 CPU state.
  */
@@ -108,12 +125,15 @@ struct lc3cpu {
         };
         lc3word value;                  /* (aggregate value) */
     } psr;                  /* processor status register */
+    int32_t cc;             /* result the condition codes were last set from,
+                               or CC_PSR if PSR[2:0] holds them */
     int     ben;            /* branch enable flag */
     int     intf;           /* interrupt flag */
     lc3byte intv;           /* interrupt vector */
     lc3byte intp;           /* interrupt priority */
     int     state;          /* current state */
     lc3word mcr;            /* machine control register */
+    uint64_t cycles;        /* elapsed clock cycles */
 };
 
 /*
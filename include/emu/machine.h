@@ -0,0 +1,134 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: include/emu/machine.h
+ * Author: Wes Hampson
+ *   Desc: A complete LC-3c machine: CPU, memory, devices, and engine state.
+ *         Every CPU, memory, and device function takes the machine it acts on
+ *         as its first argument, so any number of machines can run side by
+ *         side, one per thread.
+ *============================================================================*/
+
+#ifndef __MACHINE_H
+#define __MACHINE_H
+
+#include <emu/lc3.h>
+#include <emu/mem.h>
+#include <emu/pic.h>
+#include <emu/kbd.h>
+#include <emu/disp.h>
+#include <emu/sched.h>
+#include <emu/idle.h>
+
+/*
+ * Character I/O hooks, used by the keyboard and display. 'wait' may be NULL
+ * if input never arrives on its own, and 'flush' may be NULL if output is not
+ * buffered. 'flush' is called when a key is read, before waiting for input,
+ * and when the clock is stopped.
+ */
+struct lc3io {
+    int (*getc)(void *ctx);             /* next input char, or -1 if none */
+    void (*putc)(void *ctx, int c);     /* write an output char */
+    void (*wait)(void *ctx, int ms);    /* block until input may be ready */
+    void (*flush)(void *ctx);           /* write out buffered output */
+    void *ctx;                          /* passed to all hooks */
+};
+
+/*
+ * Machine state.
+ */
+struct lc3machine {
+    struct lc3cpu cpu;          /* CPU registers */
+    struct lc3mem mem;          /* main memory */
+    struct lc3pic pic;          /* interrupt controller */
+    struct lc3kbd kbd;          /* keyboard */
+    struct lc3disp disp;        /* display */
+    struct lc3sched sched;      /* device clock and pending events */
+    struct lc3idle idle;        /* idle-loop detector */
+    struct lc3io io;            /* keyboard/display I/O hooks */
+    struct decoded *dcache;     /* predecoded instructions (fast engine) */
+    struct jit_state *jit;      /* translated code (jit engine) */
+    struct aot_state *aot;      /* loaded module (aot engine) */
+    struct lc3traps *traps;     /* native trap routines, or NULL */
+    struct lc3prof *prof;       /* execution profile, or NULL */
+};
+
+/*
+ * Create a machine and reset it. I/O goes to the terminal until the hooks
+ * are replaced.
+ *
+ * @return      the new machine
+ *              NULL if out of memory
+ */
+struct lc3machine * machine_create(void);
+
+/*
+ * Destroy a machine, releasing any engine state it holds.
+ */
+void machine_destroy(struct lc3machine *m);
+
+/*
+ * Fork a machine. The fork starts in the same state, with the same I/O hooks
+ * and native traps, and shares the machine's memory copy-on-write, so this
+ * costs a page-table copy however much memory either side later writes.
+ * Engine state is not shared; set up jit_init() or aot_load() on the fork as
+ * for a new machine.
+ *
+ * @return      the fork
+ *              NULL if out of memory
+ */
+struct lc3machine * machine_fork(struct lc3machine *m);
+
+/*
+ * Return a fork to the current state of the machine it was forked from, as
+ * if forked again, but keeping its engine state and native traps. Only the
+ * pages either side has written since are touched, so a pool of forks can
+ * be recycled between jobs without reallocating their caches. JIT
+ * translations are dropped, as they affect where a run stops.
+ *
+ * @param f     the fork
+ * @param m     the machine it was forked from
+ */
+void machine_rewind(struct lc3machine *f, struct lc3machine *m);
+
+/*
+ * Reset the CPU, memory control signals, devices, and device clock. Memory
+ * contents are left alone.
+ */
+void machine_reset(struct lc3machine *m);
+
+/*
+ * Write a block of words into memory.
+ *
+ * @param addr  the address of the first word
+ * @param data  the words to write
+ * @param n     the number of words
+ */
+void machine_fill(struct lc3machine *m, lc3word addr, const lc3word *data,
+                  int n);
+
+/*
+ * Load an object image into memory. Errors are reported on stderr.
+ *
+ * @param path      the image file
+ * @param origin    a pointer to store the load address
+ * @return          0 on success
+ *                  -1 on error
+ */
+int machine_load(struct lc3machine *m, const char *path, lc3word *origin);
+
+#endif /* __MACHINE_H */
@@ -19,11 +19,23 @@
  *   Desc: Main memory for the LC-3c.
  *         Memory is word-addressable, but individual bytes can be written by
  *         manipulating the write mask.
+ *
+ *         RAM is kept in pages reached through a per-machine page table.
+ *         Pages are reference-counted and shared copy-on-write between a
+ *         machine and its forks, so a fork costs a page-table copy and each
+ *         page is only duplicated when one side first writes to it.
+ *         Pages that have never been written all map one shared zero page,
+ *         so a machine only allocates the pages its program writes to.
+ *
+ *         Accesses are dispatched by page. RAM pages go straight to memory;
+ *         the I/O page goes to the handlers devices register for each of its
+ *         registers, or to memory for addresses no device claims.
  *============================================================================*/
 
 #ifndef __MEM_H
 #define __MEM_H
 
+#include <stdint.h>
 #include <emu/lc3.h>
 
 /*
@@ -41,25 +53,178 @@
  */
 #define MEM_DEPTH       ((MEM_SIZE) / (MEM_WIDTH / 8))
 
+/*
+ * Page size in bytes, the unit of copy-on-write sharing.
+ */
+#define MEM_PAGE_SHIFT  8
+#define MEM_PAGE_SIZE   (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGE_MASK   (MEM_PAGE_SIZE - 1)
+
+/*
+ * Number of pages.
+ */
+#define MEM_PAGES       ((MEM_SIZE) / (MEM_PAGE_SIZE))
+
+/*
+ * Pages of RAM below the memory-mapped I/O page.
+ */
+#define MEM_RAM_PAGES   ((A_IO) >> (MEM_PAGE_SHIFT))
+
+/*
+ * Overwrite the bits of a value based on a write mask.
+ *
+ * @param src   data with bits to overwrite
+ * @param data  data with bits to be written
+ * @param wmask write mask
+ */
+#define WRITE_BITS(src,data,wmask)  ((src & ~wmask) | (data & wmask))
+
+/*
+ * Device register read handler.
+ *
+ * @param addr  the register address
+ * @return      the value read
+ */
+typedef lc3word (*lc3io_read_fn)(struct lc3machine *m, lc3word addr);
+
+/*
+ * Device register write handler. Byte writes only change the bits set in
+ * the mask; see WRITE_BITS().
+ *
+ * @param addr  the register address
+ * @param data  the data to write
+ * @param wmask a bitmask indicating which bits to overwrite
+ */
+typedef void (*lc3io_write_fn)(struct lc3machine *m, lc3word addr,
+                               lc3word data, lc3word wmask);
+
+/*
+ * Handlers for one device register. Either may be NULL, in which case that
+ * access goes to memory.
+ */
+struct lc3mmio {
+    lc3io_read_fn read;
+    lc3io_write_fn write;
+};
+
 /*
  * Memory state.
  */
 struct lc3mem {
-    unsigned int c;             /* busy counter */
+    uint64_t done;              /* cycle the current access completes on */
+    uint64_t writes;            /* writes so far, to RAM or devices */
     int r_en;                   /* read enable flag */
     int w_en;                   /* write enable flag */
-    lc3word d[MEM_DEPTH];       /* data (16-bit word addressable) */
+    int ram_pages;              /* RAM pages backed; writes above are lost */
+    lc3word *page[MEM_PAGES];   /* data of each page, possibly shared */
+    struct lc3mmio *io[MEM_PAGES];  /* register handlers, NULL for RAM */
 };
 
 /*
- * Reset control signals.
+ * Memory footprint of a machine.
+ */
+struct lc3memstats {
+    int pages;                  /* pages written, MEM_PAGE_SIZE bytes each */
+    int shared;                 /* of those, pages shared with other machines */
+};
+
+/*
+ * Read a word of RAM directly, for engines that run from memory. Writes must
+ * go through mem_write_nodelay(), which unshares the page and keeps cached
+ * and translated code coherent.
+ *
+ * @param addr  the address to read
+ * @return      the word at 'addr'
+ */
+static inline lc3word mem_word(const struct lc3mem *mem, lc3word addr)
+{
+    return mem->page[addr >> MEM_PAGE_SHIFT][(addr & MEM_PAGE_MASK) >> 1];
+}
+
+/*
+ * Give a machine a full complement of zeroed memory. No pages are allocated
+ * until they are written.
  */
-void mem_reset(void);
+void mem_init(struct lc3machine *m);
 
 /*
- * Execute one clock cycle on the memory unit.
+ * Release a machine's pages and register handlers.
  */
-void mem_tick(void);
+void mem_free(struct lc3machine *m);
+
+/*
+ * Share another machine's pages copy-on-write, and copy its register
+ * handlers. The machine must not have pages or handlers of its own.
+ *
+ * @param from  the machine whose memory to share
+ * @return      0 on success
+ *              -1 if out of memory
+ */
+int mem_share(struct lc3machine *m, struct lc3machine *from);
+
+/*
+ * Return a machine's memory to that of another machine it shares pages
+ * with, such as the one it was forked from. Only pages that differ are
+ * swapped back, and cached translations of them are dropped.
+ *
+ * @param from  the machine whose memory to take
+ */
+void mem_rewind(struct lc3machine *m, struct lc3machine *from);
+
+/*
+ * Register a device's handlers for an I/O register, replacing any already
+ * registered there. The execution engines leave every access at or above
+ * A_IO to mem_read() and mem_write(), so registers must be in the I/O page.
+ *
+ * @param addr  the register address, word-aligned and at least A_IO
+ * @param read  the read handler, or NULL to read memory
+ * @param write the write handler, or NULL to write memory
+ * @return      0 on success
+ *              -1 if 'addr' is not in the I/O page, or out of memory
+ */
+int mem_map_io(struct lc3machine *m, lc3word addr, lc3io_read_fn read,
+               lc3io_write_fn write);
+
+/*
+ * Limit the RAM a machine has, starting from address 0. Above the limit, RAM
+ * reads as zero and writes are discarded; memory-mapped I/O is unaffected.
+ * Anything already written above the limit is lost.
+ *
+ * @param kib   the amount of RAM, in KiB
+ * @return      0 on success
+ *              -1 if 'kib' is 0 or more than MEM_SIZE allows
+ */
+int mem_limit(struct lc3machine *m, unsigned int kib);
+
+/*
+ * Get a value indicating whether an address is backed by RAM or I/O.
+ *
+ * @param addr  the address to check
+ * @return      1 if writes to 'addr' are kept
+ *              0 if 'addr' is above the RAM limit
+ */
+int mem_backed(struct lc3machine *m, lc3word addr);
+
+/*
+ * Get a machine's memory footprint.
+ *
+ * @param s     a pointer to store the statistics
+ */
+void mem_stats(struct lc3machine *m, struct lc3memstats *s);
+
+/*
+ * Get the number of pages allocated by all machines in this process.
+ *
+ * @param peak  a pointer to store the most pages ever allocated at once,
+ *              or NULL
+ * @return      the number of pages allocated now
+ */
+int64_t mem_allocated(int64_t *peak);
+
+/*
+ * Reset control signals.
+ */
+void mem_reset(struct lc3machine *m);
 
 /*
  * Get a value indicating whether memory is idle.
@@ -67,7 +232,7 @@ void mem_tick(void);
  * @return      if memory is idle
  *              0 if memory is busy performing a read or write
  */
-int mem_ready(void);
+int mem_ready(struct lc3machine *m);
 
 /*
  * Read a word from memory.
@@ -77,7 +242,7 @@ int mem_ready(void);
  * @return      1 when reading is complete
  *              0 while data is being read
  */
-int mem_read(lc3word *data, lc3word addr);
+int mem_read(struct lc3machine *m, lc3word *data, lc3word addr);
 
 /* Write a word to memory.
  *
@@ -87,7 +252,7 @@ int mem_read(lc3word *data, lc3word addr);
  * @return      1 when writing is complete
  *              0 while data is being written
  */
-int mem_write(lc3word addr, lc3word data, lc3word wmask);
+int mem_write(struct lc3machine *m, lc3word addr, lc3word data, lc3word wmask);
 
 /*
  * Read a word from memory, but don't simulate memory slowness.
@@ -96,7 +261,7 @@ int mem_write(lc3word addr, lc3word data, lc3word wmask);
  * @param data  a pointer to store the value read
  * @param addr  the address to read from
  */
-void mem_read_nodelay(lc3word *data, lc3word addr);
+void mem_read_nodelay(struct lc3machine *m, lc3word *data, lc3word addr);
 
 /* Write a word to memory, but don't simulate memory slowness.
  * Use this for initialization and debugging only.
@@ -105,6 +270,38 @@ void mem_read_nodelay(lc3word *data, lc3word addr);
  * @param data  the data to write
  * @param wmask a bitmask indicating which bits to overwrite
  */
-void mem_write_nodelay(lc3word addr, lc3word data, lc3word wmask);
+void mem_write_nodelay(struct lc3machine *m, lc3word addr, lc3word data,
+                       lc3word wmask);
+
+/*
+ * Read a word from memory as the CPU would, device registers included, but
+ * don't simulate memory slowness. Reading a device register may change the
+ * device's state (reading KBDR takes the key).
+ *
+ * @param data  a pointer to store the value read
+ * @param addr  the address to read from
+ */
+void mem_read_untimed(struct lc3machine *m, lc3word *data, lc3word addr);
+
+/*
+ * Write a word to memory as the CPU would, device registers included, but
+ * don't simulate memory slowness.
+ *
+ * @param addr  the address to write to
+ * @param data  the data to write
+ * @param wmask a bitmask indicating which bits to overwrite
+ */
+void mem_write_untimed(struct lc3machine *m, lc3word addr, lc3word data,
+                       lc3word wmask);
+
+/*
+ * Get the page table, for generated code that reads RAM directly; the word
+ * at 'addr' is pages[addr >> MEM_PAGE_SHIFT][(addr & MEM_PAGE_MASK) >> 1].
+ * Entries change as pages are unshared, so they must be looked up on every
+ * access. Writes must go through mem_write_nodelay().
+ *
+ * @return      the page table, MEM_PAGES entries
+ */
+lc3word ** mem_pages(struct lc3machine *m);
 
 #endif /* __MEM_H */
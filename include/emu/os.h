@@ -0,0 +1,35 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: include/emu/os.h
+ * Author: Wes Hampson
+ *   Desc: Built-in operating system and interrupt service routines.
+ *============================================================================*/
+
+#ifndef __OS_H
+#define __OS_H
+
+#include <emu/lc3.h>
+
+/*
+ * Write the built-in OS and device ISRs into memory, fill in their interrupt
+ * vectors, and mask display interrupts. The OS starts at A_START, where
+ * cpu_reset() leaves the PC.
+ */
+void os_load(struct lc3machine *m);
+
+#endif /* __OS_H */
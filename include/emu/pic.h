@@ -46,68 +46,94 @@ struct lc3pic {
     uint8_t irr;        /* interrupt request register */
     uint8_t isr;        /* in-service register */
     uint8_t imr;        /* interrupt mask register */
+    uint8_t lines;      /* device request lines held high */
     lc3word iccr;       /* interrupt controller command register */
     lc3word icdr;       /* interrupt controller data register */
 };
 
+/*
+ * Register the PIC's I/O registers.
+ *
+ * @return      0 on success
+ *              -1 if out of memory
+ */
+int pic_init(struct lc3machine *m);
+
 /*
  * Reset PIC control signals.
  */
-void pic_reset(void);
+void pic_reset(struct lc3machine *m);
+
+/*
+ * Latch requests, deliver the highest-priority one the CPU will take, and
+ * carry out any command in ICCR. Run by the scheduler (EV_PIC) on the cycle
+ * after anything that could change the outcome.
+ */
+void pic_event(struct lc3machine *m);
 
 /*
- * Execute one clock cycle on the PIC.
+ * Have the PIC look at its requests again on the next cycle. Call this when
+ * the CPU lowers its priority or becomes ready to take another interrupt.
  */
-void pic_tick(void);
+void pic_poll(struct lc3machine *m);
 
 /*
  * Signal that a device requires service.
  *
  * @param num   the interrupt request number
  */
-void raise_irq(int num);
+void raise_irq(struct lc3machine *m, int num);
+
+/*
+ * Drive a device's interrupt request line. A request is latched on every
+ * cycle the line is high, unless it is masked or already in service.
+ *
+ * @param num   the interrupt request number
+ * @param level nonzero to hold the line high
+ */
+void set_irq_line(struct lc3machine *m, int num, int level);
 
 /*
  * Mark that an interrupt has been serviced.
  *
  * @param num   the interrupt request number
  */
-void finish_irq(int num);
+void finish_irq(struct lc3machine *m, int num);
 
 /*
  * Get the current value of the Interrupt Request Register.
  *
  * @return the current value in IRR
  */
-uint8_t get_irr(void);
+uint8_t get_irr(struct lc3machine *m);
 
 /*
  * Get the current value of the In-Service Register.
  *
  * @return the current value in ISR
  */
-uint8_t get_isr(void);
+uint8_t get_isr(struct lc3machine *m);
 
 /*
  * Get the current value of the Interrupt Mask Register.
  *
  * @return the current value in IMR
  */
-uint8_t get_imr(void);
+uint8_t get_imr(struct lc3machine *m);
 
 /*
  * Set the value of the Interrupt Mask Register.
  *
  * @param mask  the new IMR value
  */
-void set_imr(uint8_t mask);
+void set_imr(struct lc3machine *m, uint8_t mask);
 
 /*
  * Get the current value of the Interrupt Controller Command Register.
  *
  * @return the current value in ICCR
  */
-lc3word get_iccr(void);
+lc3word get_iccr(struct lc3machine *m);
 
 /*
  * Set the value of the Interrupt Controller Command Register.
@@ -115,20 +141,20 @@ lc3word get_iccr(void);
  *
  * @param cmd   the new ICCR value
  */
-void set_iccr(lc3word cmd);
+void set_iccr(struct lc3machine *m, lc3word cmd);
 
 /*
  * Get the current value of the Interrupt Controller Data Register.
  *
  * @return the current value in ICDR
  */
-lc3word get_icdr(void);
+lc3word get_icdr(struct lc3machine *m);
 
 /*
  * Set the value of the Interrupt Controller Data Register.
  *
  * @param data  the new ICDR value
  */
-void set_icdr(lc3word data);
+void set_icdr(struct lc3machine *m, lc3word data);
 
 #endif /* __PIC_H */
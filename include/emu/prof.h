@@ -0,0 +1,159 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: include/emu/prof.h
+ * Author: Wes Hampson
+ *   Desc: Guest execution profiler.
+ *         Counts the instructions run and cycles spent at each guest PC, and
+ *         charges cycles to calling contexts: JSR, JSRR, TRAP and interrupts
+ *         push a frame on a shadow call stack, and RET and RTI pop back to
+ *         the frame they return to. Contexts form a tree, one node per path
+ *         of function entry points from the first instruction run.
+ *
+ *         A profiled machine runs on its own copy of the microcoded engine
+ *         (whatever engine is asked for), so the hooks cost nothing when
+ *         profiling is off.
+ *============================================================================*/
+
+#ifndef __PROF_H
+#define __PROF_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <emu/lc3.h>
+#include <emu/mem.h>
+
+/*
+ * Deepest shadow call stack. Calls beyond it are charged to the deepest
+ * context.
+ */
+#define PROF_DEPTH      256
+
+/*
+ * A calling context: a function entry point reached by a path of calls.
+ */
+struct prof_node {
+    lc3word func;       /* entry point */
+    int parent;         /* caller's context, or -1 for the root */
+    int child;          /* first callee's context, or -1 */
+    int next;           /* next context with the same caller, or -1 */
+    uint64_t calls;     /* times entered */
+    uint64_t cycles;    /* cycles spent here, not in callees */
+};
+
+/*
+ * A shadow call stack frame.
+ */
+struct prof_frame {
+    lc3word ret;        /* return address */
+    int node;           /* context to return to */
+};
+
+/*
+ * Profiler state.
+ */
+struct lc3prof {
+    uint64_t insns[MEM_DEPTH];      /* instructions run, by word address */
+    uint64_t cycles[MEM_DEPTH];     /* cycles spent, by word address */
+    lc3word pc;                     /* instruction being charged */
+    int started;                    /* the root context has its entry */
+    int node;                       /* current context */
+    int depth;                      /* frames on the stack */
+    uint64_t lost;                  /* calls past PROF_DEPTH */
+    struct prof_frame stack[PROF_DEPTH];
+    struct prof_node *nodes;        /* contexts; node 0 is the root */
+    int num_nodes;
+    int cap_nodes;
+};
+
+/*
+ * Start profiling a machine. Its runs are charged from here on.
+ *
+ * @return      0 on success
+ *              -1 if out of memory
+ */
+int prof_enable(struct lc3machine *m);
+
+/*
+ * Stop profiling a machine and discard its profile. Safe to call on an
+ * unprofiled machine.
+ */
+void prof_free(struct lc3machine *m);
+
+/*
+ * Note the start of an instruction (or interrupt) at a PC.
+ */
+static inline void prof_fetch(struct lc3prof *p, lc3word pc)
+{
+    p->pc = pc;
+    if (!p->started) {
+        p->nodes[0].func = pc;
+        p->started = 1;
+    }
+}
+
+/*
+ * Count the current instruction, once it is decoded.
+ */
+static inline void prof_insn(struct lc3prof *p)
+{
+    p->insns[p->pc >> 1]++;
+}
+
+/*
+ * Charge cycles to the current instruction and context.
+ */
+static inline void prof_charge(struct lc3prof *p, uint64_t n)
+{
+    p->cycles[p->pc >> 1] += n;
+    p->nodes[p->node].cycles += n;
+}
+
+/*
+ * Enter a function.
+ *
+ * @param func  the function's entry point
+ * @param ret   the address it returns to
+ */
+void prof_call(struct lc3prof *p, lc3word func, lc3word ret);
+
+/*
+ * Return to an address, popping back to the innermost frame that returns
+ * there. A jump to anywhere else leaves the stack as it is.
+ *
+ * @param addr  the address returned to
+ */
+void prof_return(struct lc3prof *p, lc3word addr);
+
+/*
+ * Write the flat profile: cycles, calls and instructions by function, then
+ * by address, busiest first.
+ *
+ * @param f     the file to write to
+ */
+void prof_write_flat(struct lc3machine *m, FILE *f);
+
+/*
+ * Write the calling contexts in collapsed-stack form, one line per context
+ * of semicolon-separated entry points and the cycles spent there, as read by
+ * flame graph tools.
+ *
+ * @param f     the file to write to
+ */
+void prof_write_stacks(struct lc3machine *m, FILE *f);
+
+#endif /* __PROF_H */
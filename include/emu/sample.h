@@ -0,0 +1,109 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: include/emu/sample.h
+ * Author: Wes Hampson
+ *   Desc: Sampling profiler. The run is cut into slices of about a fixed
+ *         number of cycles, and where the machine stands at the end of each
+ *         is recorded: PC, privilege, priority, R7, and the innermost
+ *         function on the shadow call stack when the exact profiler is on
+ *         too. The engines are not touched, so the cost is one return from
+ *         cpu_run() per sample, on any engine.
+ *
+ *         Samples go into a buffer allocated up front. When it fills, every
+ *         other sample is dropped and the interval doubled, so a run of any
+ *         length is covered evenly in bounded memory.
+ *============================================================================*/
+
+#ifndef __SAMPLE_H
+#define __SAMPLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <emu/lc3.h>
+
+/*
+ * Default cycles between samples.
+ */
+#define SAMPLE_INTERVAL     10000
+
+/*
+ * Samples the buffer holds.
+ */
+#define SAMPLE_MAX          (1 << 18)
+
+/*
+ * Where the machine stood at a sample.
+ */
+struct lc3sample {
+    lc3word pc;         /* instruction running or about to run */
+    lc3word r7;         /* return address of the latest call */
+    lc3word func;       /* innermost function, or 'pc' if not profiling */
+    uint8_t priv;       /* privilege; super = 0, user = 1 */
+    uint8_t prio;       /* priority level */
+};
+
+/*
+ * Sampler state.
+ */
+struct lc3sampler {
+    uint64_t interval;          /* mean cycles between samples */
+    uint32_t seed;              /* jitter generator state */
+    int contexts;               /* samples carry shadow stack functions */
+    struct lc3sample *buf;      /* samples, SAMPLE_MAX of them */
+    size_t count;
+};
+
+/*
+ * Set up a sampler.
+ *
+ * @param interval  mean cycles between samples
+ * @return          0 on success
+ *                  -1 if out of memory
+ */
+int sampler_init(struct lc3sampler *s, uint64_t interval);
+
+/*
+ * Release a sampler's buffer.
+ */
+void sampler_free(struct lc3sampler *s);
+
+/*
+ * Choose the cycles to run before the next sample. Intervals are spread
+ * evenly over half to one and a half times the mean, so that samples do not
+ * fall into step with a loop.
+ *
+ * @return      the cycles to run
+ */
+uint64_t sampler_next(struct lc3sampler *s);
+
+/*
+ * Record where a machine stands. A machine stopped mid-instruction is
+ * recorded at the address of that instruction.
+ */
+void sampler_take(struct lc3sampler *s, struct lc3machine *m);
+
+/*
+ * Write the sample histogram: samples by address, privilege and priority,
+ * then by function (with the exact profiler on) or by R7, most first.
+ *
+ * @param f     the file to write to
+ */
+void sampler_write(struct lc3sampler *s, FILE *f);
+
+#endif /* __SAMPLE_H */
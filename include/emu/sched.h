@@ -0,0 +1,98 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: include/emu/sched.h
+ * Author: Wes Hampson
+ *   Desc: Device event scheduler.
+ *         Devices do no work on clock cycles where nothing happens to them.
+ *         Instead, each one schedules an event for the cycle its next change
+ *         is due (a memory or display operation completing, a keyboard poll)
+ *         and register writes schedule whatever reaction they need. Pending
+ *         events are kept in a min-heap ordered by cycle, so the CPU runs
+ *         freely until the next one is due.
+ *============================================================================*/
+
+#ifndef __SCHED_H
+#define __SCHED_H
+
+#include <stdint.h>
+#include <emu/lc3.h>
+
+/*
+ * Event sources. Events due on the same cycle run in this order, which is the
+ * order the devices were clocked in when each was ticked every cycle.
+ */
+enum lc3event {
+    EV_KBD,         /* keyboard poll */
+    EV_DISP,        /* display write complete */
+    EV_PIC,         /* interrupt controller update */
+    NUM_EVENTS      /* (number of event sources) */
+};
+
+/*
+ * A pending event.
+ */
+struct lc3timer {
+    uint64_t when;  /* cycle the event is due on */
+    int ev;         /* event source */
+};
+
+/*
+ * Scheduler state.
+ * 'now' counts device clock cycles. Each source has at most one pending event.
+ */
+struct lc3sched {
+    uint64_t now;                       /* current cycle */
+    uint64_t next;                      /* cycle of the earliest event */
+    uint64_t changes;                   /* events scheduled or run so far */
+    int busy;                           /* running events for 'now' */
+    int size;                           /* pending events */
+    struct lc3timer heap[NUM_EVENTS];   /* pending events, min-heap */
+    int pos[NUM_EVENTS];                /* each source's heap slot, or -1 */
+};
+
+/*
+ * Clear all pending events and restart the cycle count.
+ */
+void sched_reset(struct lc3machine *m);
+
+/*
+ * Schedule an event, replacing any pending event from the same source.
+ * Events cannot be due before the next cycle the scheduler has not yet run.
+ *
+ * @param ev    the event source
+ * @param when  the cycle the event is due on
+ */
+void sched_at(struct lc3machine *m, enum lc3event ev, uint64_t when);
+
+/*
+ * Schedule an event for the next cycle the scheduler has not yet run: the
+ * current one while events are running, the following one otherwise.
+ *
+ * @param ev    the event source
+ */
+void sched_soon(struct lc3machine *m, enum lc3event ev);
+
+/*
+ * Advance the clock, running every event that falls due on the way in the
+ * order it is due.
+ *
+ * @param n     the number of clock cycles
+ */
+void sched_advance(struct lc3machine *m, uint64_t n);
+
+#endif /* __SCHED_H */
@@ -0,0 +1,51 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: include/emu/simd.h
+ * Author: Wes Hampson
+ *   Desc: Lockstep engine for the LC-3c.
+ *         Runs many machines at once, holding the CPU registers of each in one
+ *         lane of a set of vectors. Machines at the same PC execute the
+ *         instruction there together; the rest wait their turn.
+ *============================================================================*/
+
+#ifndef __SIMD_H
+#define __SIMD_H
+
+#include <stdint.h>
+#include <emu/lc3.h>
+
+/*
+ * Number of machines run in lockstep.
+ */
+#define SIMD_LANES      16
+
+/*
+ * Run machines until each has disabled its clock or used up its cycle budget.
+ * Machines are taken SIMD_LANES at a time; a lane freed by a machine that
+ * stops is refilled with the next one. Each machine ends in exactly the state
+ * the instruction-level engine would leave it in.
+ *
+ * @param m     the machines
+ * @param max   the cycle budget of each machine
+ * @param count an array to store the number of cycles each machine ran
+ * @param n     the number of machines
+ */
+void simd_run(struct lc3machine **m, const uint64_t *max, uint64_t *count,
+              int n);
+
+#endif /* __SIMD_H */
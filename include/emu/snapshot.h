@@ -0,0 +1,93 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: include/emu/snapshot.h
+ * Author: Wes Hampson
+ *   Desc: Machine snapshots. A snapshot holds everything needed to resume a
+ *         machine exactly where it stopped: CPU and micro-state, memory
+ *         control signals, PIC, keyboard and display registers, and pending
+ *         device events. Engine caches and I/O hooks are not saved; they are
+ *         rebuilt as the machine runs.
+ *
+ *         File layout (host byte order):
+ *           0x0000     header page: magic, version, layout, machine state
+ *           0x1000     memory image, MEM_SIZE bytes
+ *         The memory image is page-aligned, so it is mapped straight from
+ *         the file rather than parsed.
+ *============================================================================*/
+
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include <emu/lc3.h>
+
+/*
+ * Alignment of the memory image within a snapshot file, in bytes.
+ */
+#define SNAP_PAGE       4096
+
+/*
+ * An opened snapshot. It is only read once opened, so one snapshot can be
+ * restored into any number of machines at once.
+ */
+struct lc3snap;
+
+/*
+ * Write a machine's state to a snapshot file. The file is written under a
+ * temporary name and renamed into place, so an existing snapshot is never
+ * left half-written. Errors are reported on stderr.
+ *
+ * @param path  the snapshot file
+ * @return      0 on success
+ *              -1 on error
+ */
+int snapshot_save(struct lc3machine *m, const char *path);
+
+/*
+ * Open a snapshot file and check that this build can restore it. Errors are
+ * reported on stderr.
+ *
+ * @param path  the snapshot file
+ * @return      the snapshot
+ *              NULL on error
+ */
+struct lc3snap * snapshot_open(const char *path);
+
+/*
+ * Restore a machine from a snapshot. Only memory words that differ from the
+ * snapshot are written, so cached and translated code that is still valid is
+ * kept.
+ *
+ * @param s     the snapshot
+ */
+void snapshot_restore(struct lc3machine *m, const struct lc3snap *s);
+
+/*
+ * Close a snapshot.
+ */
+void snapshot_close(struct lc3snap *s);
+
+/*
+ * Open a snapshot file, restore a machine from it, and close it.
+ *
+ * @param path  the snapshot file
+ * @return      0 on success
+ *              -1 on error
+ */
+int snapshot_load(struct lc3machine *m, const char *path);
+
+#endif /* __SNAPSHOT_H */
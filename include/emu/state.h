@@ -24,69 +24,69 @@
 
 #include <emu/lc3.h>
 
-void state_00(void);
-void state_01(void);
-void state_02(void);
-void state_03(void);
-void state_04(void);
-void state_05(void);
-void state_06(void);
-void state_07(void);
-void state_08(void);
-void state_09(void);
-void state_10(void);
-void state_11(void);
-void state_12(void);
-void state_13(void);
-void state_14(void);
-void state_15(void);
-void state_16(void);
-void state_17(void);
-void state_18(void);
-void state_19(void);
-void state_20(void);
-void state_21(void);
-void state_22(void);
-void state_23(void);
-void state_24(void);
-void state_25(void);
-void state_26(void);
-void state_27(void);
-void state_28(void);
-void state_29(void);
-void state_30(void);
-void state_31(void);
-void state_32(void);
-void state_33(void);
-void state_34(void);
-void state_35(void);
-void state_36(void);
-void state_37(void);
-void state_38(void);
-void state_39(void);
-void state_40(void);
-void state_41(void);
-void state_42(void);
-void state_43(void);
-void state_44(void);
-void state_45(void);
-void state_46(void);
-void state_47(void);
-void state_48(void);
-void state_49(void);
-void state_50(void);
-void state_51(void);
-void state_52(void);
-void state_53(void);
-void state_54(void);
-void state_55(void);
-void state_56(void);
-void state_57(void);
-void state_58(void);
-void state_59(void);
-void state_60(void);
-void state_61(void);
-void state_62(void);
-void state_63(void);
+void state_00(struct lc3machine *m);
+void state_01(struct lc3machine *m);
+void state_02(struct lc3machine *m);
+void state_03(struct lc3machine *m);
+void state_04(struct lc3machine *m);
+void state_05(struct lc3machine *m);
+void state_06(struct lc3machine *m);
+void state_07(struct lc3machine *m);
+void state_08(struct lc3machine *m);
+void state_09(struct lc3machine *m);
+void state_10(struct lc3machine *m);
+void state_11(struct lc3machine *m);
+void state_12(struct lc3machine *m);
+void state_13(struct lc3machine *m);
+void state_14(struct lc3machine *m);
+void state_15(struct lc3machine *m);
+void state_16(struct lc3machine *m);
+void state_17(struct lc3machine *m);
+void state_18(struct lc3machine *m);
+void state_19(struct lc3machine *m);
+void state_20(struct lc3machine *m);
+void state_21(struct lc3machine *m);
+void state_22(struct lc3machine *m);
+void state_23(struct lc3machine *m);
+void state_24(struct lc3machine *m);
+void state_25(struct lc3machine *m);
+void state_26(struct lc3machine *m);
+void state_27(struct lc3machine *m);
+void state_28(struct lc3machine *m);
+void state_29(struct lc3machine *m);
+void state_30(struct lc3machine *m);
+void state_31(struct lc3machine *m);
+void state_32(struct lc3machine *m);
+void state_33(struct lc3machine *m);
+void state_34(struct lc3machine *m);
+void state_35(struct lc3machine *m);
+void state_36(struct lc3machine *m);
+void state_37(struct lc3machine *m);
+void state_38(struct lc3machine *m);
+void state_39(struct lc3machine *m);
+void state_40(struct lc3machine *m);
+void state_41(struct lc3machine *m);
+void state_42(struct lc3machine *m);
+void state_43(struct lc3machine *m);
+void state_44(struct lc3machine *m);
+void state_45(struct lc3machine *m);
+void state_46(struct lc3machine *m);
+void state_47(struct lc3machine *m);
+void state_48(struct lc3machine *m);
+void state_49(struct lc3machine *m);
+void state_50(struct lc3machine *m);
+void state_51(struct lc3machine *m);
+void state_52(struct lc3machine *m);
+void state_53(struct lc3machine *m);
+void state_54(struct lc3machine *m);
+void state_55(struct lc3machine *m);
+void state_56(struct lc3machine *m);
+void state_57(struct lc3machine *m);
+void state_58(struct lc3machine *m);
+void state_59(struct lc3machine *m);
+void state_60(struct lc3machine *m);
+void state_61(struct lc3machine *m);
+void state_62(struct lc3machine *m);
+void state_63(struct lc3machine *m);
 
 #endif  /* __STATE_H */
@@ -0,0 +1,104 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*==============================================================================
+ *   File: include/emu/traps.h
+ * Author: Wes Hampson
+ *   Desc: Native trap service routines.
+ *         An optional host-side table of trap vectors. A TRAP to a vector in
+ *         the table runs the host routine in a single step instead of the
+ *         guest's service routine, then returns to the instruction after the
+ *         TRAP as if the routine had executed RET.
+ *============================================================================*/
+
+#ifndef __TRAPS_H
+#define __TRAPS_H
+
+#include <emu/lc3.h>
+
+/*
+ * Standard trap vectors serviced by traps_enable().
+ */
+#define TRAP_GETC       0x20    /* R0 = next key */
+#define TRAP_OUT        0x21    /* display R0[7:0] */
+#define TRAP_PUTS       0x22    /* display the string at R0, one char/word */
+#define TRAP_PUTSP      0x24    /* display the string at R0, two chars/word */
+#define TRAP_HALT       0x25    /* stop the clock */
+
+/*
+ * Default cycles charged for a natively serviced TRAP, including its fetch.
+ */
+#define TRAP_COST       50
+
+/*
+ * Native trap service routine.
+ * Called with R7 already holding the return address.
+ *
+ * @return      nonzero when done
+ *              0 to run the TRAP again later (e.g. no key is ready yet)
+ */
+typedef int (*lc3trap_fn)(struct lc3machine *m);
+
+/*
+ * Native trap table.
+ */
+struct lc3traps {
+    lc3trap_fn fn[256];     /* routine for each vector, or NULL */
+    int cost;               /* cycles charged per TRAP */
+};
+
+/*
+ * Service the standard trap vectors natively. Must be called before the
+ * machine runs, so the translating engines see the table.
+ *
+ * @param cost  cycles to charge per TRAP; raised to at least the cost of
+ *              fetching it
+ * @return      0 on success
+ *              -1 if out of memory
+ */
+int traps_enable(struct lc3machine *m, int cost);
+
+/*
+ * Set the native routine for a trap vector. Native traps must be enabled.
+ *
+ * @param vec   the trap vector
+ * @param fn    the routine, or NULL to run the guest's routine
+ */
+void traps_set(struct lc3machine *m, lc3byte vec, lc3trap_fn fn);
+
+/*
+ * Stop servicing traps natively and release the table.
+ */
+void traps_free(struct lc3machine *m);
+
+/*
+ * Check whether an instruction is a TRAP that is serviced natively.
+ *
+ * @param ir    the instruction
+ * @return      nonzero if it is
+ */
+int traps_native(struct lc3machine *m, lc3word ir);
+
+/*
+ * Service a TRAP natively, once it has been fetched. On return, the PC is at
+ * the next instruction, or back at the TRAP if it must run again.
+ *
+ * @param vec   the trap vector
+ * @return      the cycles to charge for the whole TRAP
+ *              0 if the vector is not serviced natively
+ */
+int traps_exec(struct lc3machine *m, lc3byte vec);
+
+#endif /* __TRAPS_H */
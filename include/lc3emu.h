@@ -0,0 +1,278 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: include/lc3emu.h
+ * Author: Wes Hampson
+ *   Desc: liblc3emu, the LC-3c emulator as a library. Lets a program create
+ *         machines, load images, feed them input and run them in-process,
+ *         with no terminal and no child process.
+ *
+ *         Only this header is part of the library's stable interface; the
+ *         headers under emu/ may change from one release to the next. A
+ *         machine may be used by one thread at a time, and separate machines
+ *         may run on separate threads.
+ *============================================================================*/
+
+#ifndef __LC3EMU_H
+#define __LC3EMU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Interface version. Bumped on any incompatible change.
+ */
+#define LC3EMU_API_VERSION  1
+
+/*
+ * Symbols exported from the shared library.
+ */
+#if defined(__GNUC__) && !defined(_WIN32)
+#define LC3EMU_API      __attribute__((visibility("default")))
+#else
+#define LC3EMU_API
+#endif
+
+/*
+ * An emulated machine.
+ */
+struct lc3emu;
+
+/*
+ * Execution engines; all give the same results and cycle counts, and take
+ * interrupts on the same instructions. See lc3emu_run_for() for where a run
+ * that spends its budget stops.
+ */
+enum lc3emu_engine {
+    LC3EMU_MICRO,       /* microcoded; one state per clock cycle */
+    LC3EMU_FAST,        /* instruction-level; one instruction per dispatch */
+    LC3EMU_JIT,         /* hot code translated to x86-64 */
+    LC3EMU_AOT,         /* code translated by lc3aot; see lc3emu_load_aot() */
+    LC3EMU_SIMD         /* vector engine, running a single lane */
+};
+
+/*
+ * Registers, as for cpu_getreg() in the emulator.
+ */
+enum lc3emu_reg {
+    LC3EMU_R0, LC3EMU_R1, LC3EMU_R2, LC3EMU_R3,
+    LC3EMU_R4, LC3EMU_R5, LC3EMU_R6, LC3EMU_R7,
+    LC3EMU_PC,
+    LC3EMU_IR,
+    LC3EMU_MAR,
+    LC3EMU_MDR,
+    LC3EMU_SSP,         /* saved supervisor stack pointer */
+    LC3EMU_USP,         /* saved user stack pointer */
+    LC3EMU_PSR,
+    LC3EMU_KBSR,
+    LC3EMU_KBDR,
+    LC3EMU_DSR,
+    LC3EMU_DDR,
+    LC3EMU_MCR
+};
+
+/*
+ * Why a run returned.
+ */
+enum lc3emu_status {
+    LC3EMU_HALTED,      /* the program stopped the clock */
+    LC3EMU_BUDGET,      /* the cycle budget was spent */
+    LC3EMU_BREAK        /* the PC reached the requested address */
+};
+
+/*
+ * Get the interface version the library was built with.
+ *
+ * @return      LC3EMU_API_VERSION of the library
+ */
+LC3EMU_API int lc3emu_version(void);
+
+/*
+ * Create a machine with the built-in OS loaded, ready to run it on the
+ * microcoded engine. The machine has no keyboard input until some is fed
+ * with lc3emu_input(), and its display output is discarded until a buffer
+ * is given with lc3emu_set_output().
+ *
+ * @return      the new machine
+ *              NULL if out of memory
+ */
+LC3EMU_API struct lc3emu * lc3emu_create(void);
+
+/*
+ * Destroy a machine.
+ */
+LC3EMU_API void lc3emu_destroy(struct lc3emu *e);
+
+/*
+ * Choose the engine that runs the machine from now on.
+ *
+ * @param engine    the engine; LC3EMU_AOT is set by lc3emu_load_aot()
+ * @return          0 on success
+ *                  -1 if the engine is not available on this host
+ */
+LC3EMU_API int lc3emu_set_engine(struct lc3emu *e, enum lc3emu_engine engine);
+
+/*
+ * Load a module built by lc3aot and run the machine on it from now on. The
+ * module's own image is not loaded; load it with lc3emu_load().
+ *
+ * @param path  the module file
+ * @return      0 on success
+ *              -1 if it cannot be loaded (reported on stderr)
+ */
+LC3EMU_API int lc3emu_load_aot(struct lc3emu *e, const char *path);
+
+/*
+ * Service the standard TRAPs (GETC, OUT, PUTS, PUTSP and HALT) on the host
+ * instead of running the OS routines. Call before running the machine.
+ *
+ * @param cost  cycles to charge per TRAP, or 0 to run the OS routines again
+ * @return      0 on success
+ *              -1 if out of memory
+ */
+LC3EMU_API int lc3emu_native_traps(struct lc3emu *e, int cost);
+
+/*
+ * Limit the machine's RAM, starting from address 0. Above the limit, reads
+ * return 0 and writes are lost.
+ *
+ * @param kib   KiB of RAM, 1 to 64
+ * @return      0 on success
+ *              -1 if 'kib' is out of range
+ */
+LC3EMU_API int lc3emu_set_memory(struct lc3emu *e, unsigned int kib);
+
+/*
+ * Load an object image and start running it: the PC is set to its origin.
+ *
+ * @param path  the image file
+ * @return      0 on success
+ *              -1 if it cannot be read or does not fit (reported on stderr)
+ */
+LC3EMU_API int lc3emu_load(struct lc3emu *e, const char *path);
+
+/*
+ * Queue keyboard input. Keys are delivered in order, each once the program
+ * has read the previous one from KBDR, so none are lost.
+ *
+ * @param data  the bytes to type
+ * @param len   the number of bytes
+ * @return      0 on success
+ *              -1 if out of memory
+ */
+LC3EMU_API int lc3emu_input(struct lc3emu *e, const void *data, size_t len);
+
+/*
+ * Collect display output in a buffer. Output is appended from the start of
+ * the buffer; anything past its end is counted but dropped. The buffer is
+ * not terminated and must stay valid while the machine runs.
+ *
+ * @param buf   the buffer, or NULL to discard output
+ * @param size  the size of the buffer in bytes
+ */
+LC3EMU_API void lc3emu_set_output(struct lc3emu *e, char *buf, size_t size);
+
+/*
+ * Get the number of bytes displayed since lc3emu_set_output(), including
+ * any that did not fit in the buffer.
+ *
+ * @return      the number of bytes displayed
+ */
+LC3EMU_API size_t lc3emu_output_len(const struct lc3emu *e);
+
+/*
+ * Run until the program halts or 'cycles' have been spent. The microcoded
+ * engine stops on the exact cycle. Every other engine (translated blocks
+ * included) runs most instructions whole, and overruns the budget by the
+ * rest of the instruction it runs out in; but I/O accesses, RTI and
+ * interrupt entry run one microcode state at a time on every engine, so a
+ * run can also stop in the middle of one of those.
+ *
+ * @param cycles    the cycle budget
+ * @return          LC3EMU_HALTED or LC3EMU_BUDGET
+ */
+LC3EMU_API enum lc3emu_status lc3emu_run_for(struct lc3emu *e,
+                                             uint64_t cycles);
+
+/*
+ * Run until the machine is about to execute the instruction at 'pc', the
+ * program halts, or 'cycles' have been spent. At least one cycle is run, so
+ * this can be called again to reach the next visit to 'pc'. The machine is
+ * stepped one instruction at a time, so this is slower than lc3emu_run_for()
+ * on the translating engines.
+ *
+ * @param pc        the address to stop at
+ * @param cycles    the cycle budget
+ * @return          LC3EMU_BREAK, LC3EMU_HALTED or LC3EMU_BUDGET
+ */
+LC3EMU_API enum lc3emu_status lc3emu_run_until(struct lc3emu *e, uint16_t pc,
+                                               uint64_t cycles);
+
+/*
+ * Get the number of cycles the machine has run.
+ *
+ * @return      elapsed clock cycles
+ */
+LC3EMU_API uint64_t lc3emu_cycles(const struct lc3emu *e);
+
+/*
+ * Read a register.
+ *
+ * @param reg   the register
+ * @return      its value
+ */
+LC3EMU_API uint16_t lc3emu_get_reg(struct lc3emu *e, enum lc3emu_reg reg);
+
+/*
+ * Write a register.
+ *
+ * @param reg   the register
+ * @param value the value to write
+ */
+LC3EMU_API void lc3emu_set_reg(struct lc3emu *e, enum lc3emu_reg reg,
+                               uint16_t value);
+
+/*
+ * Read words of memory, as the CPU would: device registers in the I/O page
+ * are read through their devices (reading KBDR takes the key).
+ *
+ * @param addr  the address of the first word
+ * @param buf   a buffer to store the words
+ * @param n     the number of words
+ */
+LC3EMU_API void lc3emu_read_mem(struct lc3emu *e, uint16_t addr,
+                                uint16_t *buf, size_t n);
+
+/*
+ * Write words of memory, as the CPU would.
+ *
+ * @param addr  the address of the first word
+ * @param buf   the words to write
+ * @param n     the number of words
+ */
+LC3EMU_API void lc3emu_write_mem(struct lc3emu *e, uint16_t addr,
+                                 const uint16_t *buf, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LC3EMU_H */
@@ -22,6 +22,8 @@
 #ifndef __LC3TOOLS_H
 #define __LC3TOOLS_H
 
+#include <stdint.h>
+
 #ifndef _WIN32
 /* we'll assume POSIX... */
 #include <termios.h>
@@ -60,4 +62,25 @@
  */
 char * get_filename(char *path);
 
+
+/* ===== Functions defined in src/lib/obj.c ===== */
+
+/*
+ * Maximum number of words in an object image (the size of LC-3c memory).
+ */
+#define OBJ_MAX_WORDS   32768
+
+/*
+ * Read an object image. The image starts with its origin and size in bytes,
+ * both 64-bit little-endian, followed by the contents as little-endian words.
+ * Errors are reported on stderr.
+ *
+ * @param path      the image file
+ * @param origin    a pointer to store the load address
+ * @param words     a buffer of OBJ_MAX_WORDS words to store the contents
+ * @return          the number of words read
+ *                  -1 on error
+ */
+int read_object(const char *path, uint16_t *origin, uint16_t *words);
+
 #endif /* __LC3TOOLS_H */
@@ -0,0 +1,698 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*==============================================================================
+ *   File: src/aot/main.c
+ * Author: Wes Hampson
+ *   Desc: Ahead-of-time translator for LC-3c object images.
+ *         Recovers the control-flow graph of an image, emits its basic blocks
+ *         as C, and compiles that into a shared object for lc3emu --aot.
+ *============================================================================*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lc3tools.h>
+#include <emu/lc3.h>
+#include <emu/cpu.h>
+#include <emu/mem.h>
+#include <emu/aot.h>
+
+/*
+ * Maximum number of instructions in a block.
+ */
+#define MAX_BLOCK       64
+
+/*
+ * Compiler command, used when $CC is not set.
+ */
+#define DEFAULT_CC      "cc"
+
+/*
+ * Compiler flags for building the shared object.
+ */
+#define CFLAGS          "-O2 -shared -fPIC"
+
+/*
+ * Instruction fields.
+ */
+#define OP(ir)          ((ir) >> 12)
+#define DR(ir)          (((ir) >> 9) & 7)
+#define SR1(ir)         (((ir) >> 6) & 7)
+#define SR2(ir)         ((ir) & 7)
+#define NZP(ir)         (((ir) >> 9) & 7)
+
+static int in_image(unsigned int addr);
+static lc3word word_at(lc3word addr);
+static void find_code(void);
+static void mark_leader(unsigned int addr);
+static int ends_block(lc3word ir);
+static int sets_cc(int op);
+static int touches_mem(int op);
+static lc3sword sext(lc3word val, int pos);
+
+static void emit_module(FILE *f, const char *src_name);
+static void emit_block(FILE *f, lc3word start, lc3word end);
+static void emit_insn(FILE *f, lc3word addr, lc3word ir, int cycles,
+                      int cc_live, lc3word start, lc3word end);
+static void emit_exit(FILE *f, lc3word pc, int cycles);
+
+static int compile(const char *c_path, const char *so_path);
+
+static void usage(const char *prog_name);
+static void help(const char *prog_name);
+
+static lc3word origin;
+static int num_words;
+static lc3word words[OBJ_MAX_WORDS];
+
+static uint8_t reached[OBJ_MAX_WORDS];      /* word is reachable code */
+static uint8_t leader[OBJ_MAX_WORDS];       /* word starts a basic block */
+
+static lc3word worklist[OBJ_MAX_WORDS];
+static int worklist_len;
+
+int main(int argc, char *argv[])
+{
+    const char *image;
+    const char *out;
+    char so_path[4096];
+    char c_path[4096];
+    char *dot;
+    FILE *f;
+    int emit_only;
+    int i;
+
+    image = NULL;
+    out = NULL;
+    emit_only = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            help(argv[0]);
+            return 0;
+        }
+        else if (strcmp(argv[i], "-S") == 0) {
+            emit_only = 1;
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out = argv[++i];
+        }
+        else if (argv[i][0] == '-' || image != NULL) {
+            usage(argv[0]);
+            return 1;
+        }
+        else {
+            image = argv[i];
+        }
+    }
+
+    if (image == NULL) {
+        fprintf(stderr, "error: missing object image\n");
+        return 1;
+    }
+
+    num_words = read_object(image, &origin, words);
+    if (num_words < 0) {
+        return 2;
+    }
+
+    /* Default output: the image name with its extension replaced */
+    if (out == NULL) {
+        snprintf(so_path, sizeof(so_path) - 4, "%s", image);
+        dot = strrchr(so_path, '.');
+        if (dot != NULL && strchr(dot, FILE_SEPARATOR) == NULL) {
+            *dot = '\0';
+        }
+        strcat(so_path, emit_only ? ".c" : ".so");
+        out = so_path;
+    }
+
+    find_code();
+
+    if (emit_only) {
+        snprintf(c_path, sizeof(c_path), "%s", out);
+    }
+    else {
+        snprintf(c_path, sizeof(c_path), "%s.c", out);
+    }
+
+    f = fopen(c_path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "error: failed to create '%s'\n", c_path);
+        return 2;
+    }
+    emit_module(f, get_filename((char *) image));
+    if (fclose(f) != 0) {
+        fprintf(stderr, "error: failed to write '%s'\n", c_path);
+        return 2;
+    }
+
+    if (emit_only) {
+        return 0;
+    }
+
+    i = compile(c_path, out);
+    remove(c_path);
+    return i;
+}
+
+/* ===== Control-Flow Recovery ===== */
+
+/*
+ * Get a value indicating whether an address holds image contents that can be
+ * translated.
+ */
+static int in_image(unsigned int addr)
+{
+    return addr >= origin && addr < origin + 2u * num_words
+        && !(addr & 1) && !IS_IO(addr);
+}
+
+static lc3word word_at(lc3word addr)
+{
+    return words[(addr - origin) >> 1];
+}
+
+/*
+ * Find all code reachable from the image origin and the leaders of its basic
+ * blocks. Indirect jumps (JMP, JSRR, TRAP, RTI) cannot be followed; the
+ * address after a call is a leader since that is where it returns, and
+ * addresses taken by LEA are treated as possible code.
+ */
+static void find_code(void)
+{
+    lc3word addr;
+    lc3word ir;
+    lc3word target;
+    int done;
+
+    worklist_len = 0;
+    mark_leader(origin);
+
+    while (worklist_len > 0) {
+        addr = worklist[--worklist_len];
+        done = 0;
+        while (!done && in_image(addr) && !reached[(addr - origin) >> 1]) {
+            reached[(addr - origin) >> 1] = 1;
+            ir = word_at(addr);
+            switch (OP(ir)) {
+                case OP_BR:
+                    if (NZP(ir) == 0) {
+                        break;
+                    }
+                    target = addr + 2 + (sext(ir & 0x01FF, 9) << 1);
+                    mark_leader(target);
+                    if (NZP(ir) != 7) {
+                        mark_leader(addr + 2);
+                    }
+                    done = 1;
+                    break;
+                case OP_JSR:
+                    if (ir & 0x0800) {
+                        mark_leader(addr + 2 + (sext(ir & 0x07FF, 11) << 1));
+                    }
+                    mark_leader(addr + 2);
+                    done = 1;
+                    break;
+                case OP_TRAP:
+                    mark_leader(addr + 2);
+                    done = 1;
+                    break;
+                case OP_JMP:
+                case OP_RTI:
+                    done = 1;
+                    break;
+                case OP_LEA:
+                    mark_leader(addr + 2 + (sext(ir & 0x01FF, 9) << 1));
+                    break;
+            }
+            addr += 2;
+        }
+    }
+}
+
+/*
+ * Mark an address as the start of a basic block and queue it for scanning.
+ */
+static void mark_leader(unsigned int addr)
+{
+    addr &= 0xFFFF;
+    if (!in_image(addr) || leader[(addr - origin) >> 1]) {
+        return;
+    }
+
+    leader[(addr - origin) >> 1] = 1;
+    worklist[worklist_len++] = addr;
+}
+
+static int ends_block(lc3word ir)
+{
+    switch (OP(ir)) {
+        case OP_BR:
+            return NZP(ir) != 0;
+        case OP_JSR:
+        case OP_JMP:
+        case OP_TRAP:
+        case OP_RTI:
+            return 1;
+    }
+    return 0;
+}
+
+static int sets_cc(int op)
+{
+    return op == OP_ADD || op == OP_AND || op == OP_XOR || op == OP_SHF
+        || op == OP_LEA || op == OP_LDB || op == OP_LDW || op == OP_LDI;
+}
+
+static int touches_mem(int op)
+{
+    return op == OP_LDB || op == OP_STB || op == OP_LDW || op == OP_STW
+        || op == OP_LDI || op == OP_STI;
+}
+
+static lc3sword sext(lc3word val, int pos)
+{
+    lc3word mask;
+
+    mask = 1 << (pos - 1);
+    return (lc3sword) ((val ^ mask) - mask);
+}
+
+/* ===== Code Generation ===== */
+
+/*
+ * Write the C source for the translated module.
+ */
+static void emit_module(FILE *f, const char *src_name)
+{
+    static lc3word blocks[2 * OBJ_MAX_WORDS];
+    lc3word start;
+    lc3word end;
+    lc3word ir;
+    int num_blocks;
+    int i, n;
+
+    /* Split reachable code into blocks */
+    num_blocks = 0;
+    for (i = 0; i < num_words; i++) {
+        if (!leader[i] || !reached[i]) {
+            continue;
+        }
+
+        start = origin + 2 * i;
+        end = start;
+        for (n = 0; n < MAX_BLOCK; n++) {
+            ir = word_at(end);
+            if (OP(ir) == OP_RTI) {
+                break;      /* left to the interpreter */
+            }
+            end += 2;
+            if (ends_block(ir) || !in_image(end)
+                || !reached[(end - origin) >> 1]
+                || leader[(end - origin) >> 1]) {
+                break;
+            }
+        }
+
+        if (end != start) {
+            blocks[2*num_blocks] = start;
+            blocks[2*num_blocks+1] = end;
+            num_blocks++;
+        }
+    }
+
+    fprintf(f, "/* Generated by lc3aot from %s. Do not edit. */\n\n", src_name);
+    fprintf(f, "#include <stdint.h>\n\n");
+
+    fprintf(f, "#define OFF_R   %u\n", (unsigned) offsetof(struct lc3cpu, r));
+    fprintf(f, "#define OFF_PC  %u\n", (unsigned) offsetof(struct lc3cpu, pc));
+    fprintf(f, "#define OFF_IR  %u\n", (unsigned) offsetof(struct lc3cpu, ir));
+    fprintf(f, "#define OFF_MAR %u\n", (unsigned) offsetof(struct lc3cpu, mar));
+    fprintf(f, "#define OFF_MDR %u\n", (unsigned) offsetof(struct lc3cpu, mdr));
+    fprintf(f, "#define OFF_PSR %u\n\n", (unsigned) offsetof(struct lc3cpu, psr));
+
+    fprintf(f, "#define R(n)    (*(uint16_t *) (cpu + OFF_R + 2 * (n)))\n");
+    fprintf(f, "#define PC      (*(uint16_t *) (cpu + OFF_PC))\n");
+    fprintf(f, "#define IR      (*(uint16_t *) (cpu + OFF_IR))\n");
+    fprintf(f, "#define MAR     (*(uint16_t *) (cpu + OFF_MAR))\n");
+    fprintf(f, "#define MDR     (*(uint16_t *) (cpu + OFF_MDR))\n");
+    fprintf(f, "#define PSR     (*(uint16_t *) (cpu + OFF_PSR))\n");
+    fprintf(f, "#define RAM(a)  ram[(uint16_t) (a) >> %d][((a) & 0x%X) >> 1]\n",
+            MEM_PAGE_SHIFT, MEM_PAGE_MASK);
+    fprintf(f, "#define IO(a)   ((uint16_t) (a) >= 0x%04X)\n", A_IO);
+    fprintf(f, "#define CC(v)   (PSR = (PSR & 0xFFF8) "
+               "| (((v) & 0x8000) ? 4 : (v) ? 1 : 2))\n\n");
+
+    fprintf(f, "typedef void (*store_fn)(void *, unsigned int, unsigned int, "
+               "unsigned int);\n\n");
+
+    fprintf(f, "struct aot_module {\n");
+    fprintf(f, "    unsigned int abi;\n");
+    fprintf(f, "    unsigned int cpu_size;\n");
+    fprintf(f, "    uint16_t origin;\n");
+    fprintf(f, "    unsigned int size;\n");
+    fprintf(f, "    const uint16_t *image;\n");
+    fprintf(f, "    unsigned int num_blocks;\n");
+    fprintf(f, "    const uint16_t *blocks;\n");
+    fprintf(f, "    int (*run)(unsigned char *, uint16_t **, store_fn, "
+               "void *);\n");
+    fprintf(f, "};\n\n");
+
+    fprintf(f, "static const uint16_t image[%d] = {", num_words ? num_words : 1);
+    for (i = 0; i < num_words; i++) {
+        fprintf(f, "%s0x%04X,", (i % 8) ? " " : "\n    ", words[i]);
+    }
+    fprintf(f, "\n};\n\n");
+
+    fprintf(f, "static const uint16_t blocks[%d] = {",
+            num_blocks ? 2 * num_blocks : 1);
+    for (i = 0; i < num_blocks; i++) {
+        fprintf(f, "%s0x%04X, 0x%04X,", (i % 4) ? " " : "\n    ",
+                blocks[2*i], blocks[2*i+1]);
+    }
+    fprintf(f, "\n};\n\n");
+
+    fprintf(f, "static int run(unsigned char *cpu, uint16_t **ram, "
+               "store_fn store, void *m)\n{\n");
+    fprintf(f, "    uint16_t a, v;\n\n");
+    fprintf(f, "    switch (PC) {\n");
+    for (i = 0; i < num_blocks; i++) {
+        emit_block(f, blocks[2*i], blocks[2*i+1]);
+    }
+    fprintf(f, "    }\n\n");
+    fprintf(f, "    (void) a;\n    (void) v;\n    (void) ram;\n");
+    fprintf(f, "    (void) store;\n    (void) m;\n");
+    fprintf(f, "    return 0;\n}\n\n");
+
+    fprintf(f, "const struct aot_module %s = {\n", AOT_MODULE_SYMBOL);
+    fprintf(f, "    %d, %u, 0x%04X, %d, image, %d, blocks, run\n",
+            AOT_ABI_VERSION, (unsigned) sizeof(struct lc3cpu), origin,
+            num_words, num_blocks);
+    fprintf(f, "};\n");
+}
+
+/*
+ * Write one basic block as a case of the dispatch switch.
+ */
+static void emit_block(FILE *f, lc3word start, lc3word end)
+{
+    lc3word addr;
+    lc3word ir;
+    int live[MAX_BLOCK];
+    int cycles;
+    int op;
+    int n, i;
+
+    /*
+     * Condition codes only need computing when something reads them: a
+     * branch, or the interpreter after any exit. Loads and stores can exit
+     * early, so they count as readers of the codes set before them.
+     */
+    n = (end - start) >> 1;
+    live[n - 1] = 1;
+    for (i = n - 1; i > 0; i--) {
+        op = OP(word_at(start + 2 * i));
+        live[i - 1] = live[i];
+        if (sets_cc(op)) {
+            live[i - 1] = 0;
+        }
+        if (op == OP_BR || touches_mem(op)) {
+            live[i - 1] = 1;
+        }
+    }
+
+    fprintf(f, "    case 0x%04X:\n", start);
+
+    cycles = 0;
+    for (i = 0; i < n; i++) {
+        addr = start + 2 * i;
+        ir = word_at(addr);
+        emit_insn(f, addr, ir, cycles, live[i], start, end);
+
+        switch (OP(ir)) {
+            case OP_BR:         cycles += CYC_BR;   break;
+            case OP_LDB:        cycles += CYC_LDB;  break;
+            case OP_STB:        cycles += CYC_STB;  break;
+            case OP_LDW:        cycles += CYC_LDW;  break;
+            case OP_STW:        cycles += CYC_STW;  break;
+            case OP_LDI:        cycles += CYC_LDI;  break;
+            case OP_STI:        cycles += CYC_STI;  break;
+            default:            cycles += CYC_ALU;  break;
+        }
+    }
+
+    /* Fell off the end of a block cut short */
+    ir = word_at(end - 2);
+    if (!ends_block(ir)) {
+        fprintf(f, "        IR = 0x%04X;\n", ir);
+        if (!touches_mem(OP(ir))) {
+            fprintf(f, "        MAR = 0x%04X;\n", end - 2);
+            fprintf(f, "        MDR = 0x%04X;\n", ir);
+        }
+        emit_exit(f, end, cycles);
+    }
+}
+
+/*
+ * Write one instruction. Every path out of the block sets the PC and returns
+ * the cycles spent so far.
+ */
+static void emit_insn(FILE *f, lc3word addr, lc3word ir, int cycles,
+                      int cc_live, lc3word start, lc3word end)
+{
+    const char *io_exit;
+    const char *ops;
+    lc3word next;
+    lc3word target;
+    char buf[64];
+    int off6, off6w;
+
+    next = addr + 2;
+    off6 = sext(ir & 0x003F, 6);
+    off6w = off6 << 1;
+
+    /* Side exit to the interpreter, leaving this instruction unexecuted */
+    snprintf(buf, sizeof(buf), "{ PC = 0x%04X; return %d; }", addr, cycles);
+    io_exit = buf;
+
+    fprintf(f, "        /* %04X: %04X */\n", addr, ir);
+    switch (OP(ir)) {
+        case OP_BR:
+            if (NZP(ir) == 0) {
+                break;
+            }
+            target = next + (sext(ir & 0x01FF, 9) << 1);
+            fprintf(f, "        IR = MDR = 0x%04X;\n", ir);
+            fprintf(f, "        MAR = 0x%04X;\n", addr);
+            if (NZP(ir) != 7) {
+                fprintf(f, "        if (PSR & %d) ", NZP(ir));
+                fprintf(f, "{ PC = 0x%04X; return %d; }\n",
+                        target, cycles + CYC_BR + 1);
+                emit_exit(f, next, cycles + CYC_BR);
+            }
+            else {
+                emit_exit(f, target, cycles + CYC_BR + 1);
+            }
+            break;
+
+        case OP_ADD:
+        case OP_AND:
+        case OP_XOR:
+            ops = (OP(ir) == OP_ADD) ? "+" : (OP(ir) == OP_AND) ? "&" : "^";
+            if (ir & 0x0020) {
+                fprintf(f, "        v = R(%d) %s 0x%04X;\n", SR1(ir), ops,
+                        (lc3word) sext(ir & 0x001F, 5));
+            }
+            else {
+                fprintf(f, "        v = R(%d) %s R(%d);\n", SR1(ir), ops,
+                        SR2(ir));
+            }
+            fprintf(f, "        R(%d) = v;\n", DR(ir));
+            if (cc_live) {
+                fprintf(f, "        CC(v);\n");
+            }
+            break;
+
+        case OP_SHF:
+            if ((ir & 0x0030) == 0x0030) {
+                fprintf(f, "        v = (uint16_t) ((int16_t) R(%d) >> %d);\n",
+                        SR1(ir), ir & 0x000F);
+            }
+            else {
+                fprintf(f, "        v = R(%d) %s %d;\n", SR1(ir),
+                        (ir & 0x0010) ? ">>" : "<<", ir & 0x000F);
+            }
+            fprintf(f, "        R(%d) = v;\n", DR(ir));
+            if (cc_live) {
+                fprintf(f, "        CC(v);\n");
+            }
+            break;
+
+        case OP_LEA:
+            fprintf(f, "        v = 0x%04X;\n",
+                    (lc3word) (next + (sext(ir & 0x01FF, 9) << 1)));
+            fprintf(f, "        R(%d) = v;\n", DR(ir));
+            if (cc_live) {
+                fprintf(f, "        CC(v);\n");
+            }
+            break;
+
+        case OP_LDW:
+            fprintf(f, "        a = R(%d) + %d;\n", SR1(ir), off6w);
+            fprintf(f, "        if (IO(a)) %s\n", io_exit);
+            fprintf(f, "        MAR = a;\n");
+            fprintf(f, "        v = MDR = RAM(a);\n");
+            fprintf(f, "        R(%d) = v;\n", DR(ir));
+            if (cc_live) {
+                fprintf(f, "        CC(v);\n");
+            }
+            break;
+
+        case OP_LDB:
+            fprintf(f, "        a = R(%d) + %d;\n", SR1(ir), off6);
+            fprintf(f, "        MAR = a;\n");
+            fprintf(f, "        if (IO(a & 0xFFFE)) %s\n", io_exit);
+            fprintf(f, "        MDR = RAM(a);\n");
+            fprintf(f, "        v = (MDR >> ((a & 1) << 3)) & 0xFF;\n");
+            fprintf(f, "        v = (v ^ 0x80) - 0x80;\n");
+            fprintf(f, "        R(%d) = v;\n", DR(ir));
+            if (cc_live) {
+                fprintf(f, "        CC(v);\n");
+            }
+            break;
+
+        case OP_LDI:
+            fprintf(f, "        a = R(%d) + %d;\n", SR1(ir), off6w);
+            fprintf(f, "        if (IO(a)) %s\n", io_exit);
+            fprintf(f, "        a = RAM(a);\n");
+            fprintf(f, "        if (IO(a)) %s\n", io_exit);
+            fprintf(f, "        MAR = a;\n");
+            fprintf(f, "        v = MDR = RAM(a);\n");
+            fprintf(f, "        R(%d) = v;\n", DR(ir));
+            if (cc_live) {
+                fprintf(f, "        CC(v);\n");
+            }
+            break;
+
+        case OP_STW:
+        case OP_STB:
+        case OP_STI:
+            fprintf(f, "        a = R(%d) + %d;\n", SR1(ir),
+                    (OP(ir) == OP_STB) ? off6 : off6w);
+            fprintf(f, "        if (IO(a)) %s\n", io_exit);
+            if (OP(ir) == OP_STI) {
+                fprintf(f, "        a = RAM(a);\n");
+                fprintf(f, "        if (IO(a)) %s\n", io_exit);
+            }
+            fprintf(f, "        MAR = a;\n");
+            if (OP(ir) == OP_STB) {
+                fprintf(f, "        MDR = R(%d) & 0xFF;\n", DR(ir));
+                fprintf(f, "        store(m, a, MDR << ((a & 1) << 3), "
+                           "0xFF << ((a & 1) << 3));\n");
+            }
+            else {
+                fprintf(f, "        MDR = R(%d);\n", DR(ir));
+                fprintf(f, "        store(m, a, MDR, 0xFFFF);\n");
+            }
+            /* Stop if this block's own code was overwritten */
+            fprintf(f, "        if (a >= 0x%04X && a < 0x%04X) ", start, end);
+            fprintf(f, "{ IR = 0x%04X; PC = 0x%04X; return %d; }\n", ir, next,
+                    cycles + ((OP(ir) == OP_STI) ? CYC_STI
+                            : (OP(ir) == OP_STB) ? CYC_STB : CYC_STW));
+            break;
+
+        case OP_JSR:
+            fprintf(f, "        IR = MDR = 0x%04X;\n", ir);
+            fprintf(f, "        MAR = 0x%04X;\n", addr);
+            fprintf(f, "        R(7) = 0x%04X;\n", next);
+            if (ir & 0x0800) {
+                emit_exit(f, next + (sext(ir & 0x07FF, 11) << 1),
+                          cycles + CYC_JSR);
+            }
+            else {
+                /* R7 is written first, as in state 20 */
+                fprintf(f, "        PC = R(%d);\n", SR1(ir));
+                fprintf(f, "        return %d;\n", cycles + CYC_JSR);
+            }
+            break;
+
+        case OP_JMP:
+            fprintf(f, "        IR = MDR = 0x%04X;\n", ir);
+            fprintf(f, "        MAR = 0x%04X;\n", addr);
+            fprintf(f, "        PC = R(%d);\n", SR1(ir));
+            fprintf(f, "        return %d;\n", cycles + CYC_JMP);
+            break;
+
+        case OP_TRAP:
+            fprintf(f, "        IR = 0x%04X;\n", ir);
+            fprintf(f, "        MAR = 0x%04X;\n", (ir & 0x00FF) << 1);
+            fprintf(f, "        MDR = RAM(0x%04X);\n", (ir & 0x00FF) << 1);
+            fprintf(f, "        R(7) = 0x%04X;\n", next);
+            fprintf(f, "        PC = MDR;\n");
+            fprintf(f, "        return %d;\n", cycles + CYC_TRAP);
+            break;
+    }
+}
+
+static void emit_exit(FILE *f, lc3word pc, int cycles)
+{
+    fprintf(f, "        PC = 0x%04X;\n", pc);
+    fprintf(f, "        return %d;\n", cycles);
+}
+
+/*
+ * Compile the generated source into a shared object.
+ */
+static int compile(const char *c_path, const char *so_path)
+{
+    const char *cc;
+    char cmd[3 * 4096];
+
+    cc = getenv("CC");
+    if (cc == NULL || cc[0] == '\0') {
+        cc = DEFAULT_CC;
+    }
+
+    snprintf(cmd, sizeof(cmd), "%s %s -o '%s' '%s'", cc, CFLAGS, so_path,
+             c_path);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "error: failed to compile '%s'\n", c_path);
+        return 3;
+    }
+
+    return 0;
+}
+
+static void usage(const char *prog_name)
+{
+    printf("Usage: %s [options] image\n", prog_name);
+    printf("Run '%s --help' for options.\n", prog_name);
+}
+
+static void help(const char *prog_name)
+{
+    printf("Usage: %s [options] image\n", prog_name);
+    printf("Translate an object image into a shared object for lc3emu --aot.\n");
+    printf("Options:\n");
+    printf("  -o <file>  output file (default: image name with .so)\n");
+    printf("  -S         write the generated C source instead of compiling\n");
+    printf("  --help     show this message\n");
+    printf("The compiler is taken from $CC (default '%s').\n", DEFAULT_CC);
+}
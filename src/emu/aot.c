@@ -0,0 +1,239 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*==============================================================================
+ *   File: src/emu/aot.c
+ * Author: Wes Hampson
+ *   Desc: Loader for ahead-of-time translated code.
+ *         Each translated block carries the image words it was compiled from,
+ *         and only runs while memory still holds them; a write that changes
+ *         a block's code hands it back to the interpreter until the original
+ *         code is restored.
+ *============================================================================*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+#include <emu/lc3.h>
+#include <emu/cpu.h>
+#include <emu/mem.h>
+#include <emu/aot.h>
+#include <emu/machine.h>
+#include <emu/traps.h>
+
+/*
+ * Per-machine loader state.
+ */
+struct aot_state {
+    const struct aot_module *mod;   /* loaded module */
+    void *handle;                   /* shared object handle */
+
+    /*
+     * Owning block of each word of translated code (block number + 1), by
+     * word address. 0 if the word is not part of a block.
+     */
+    uint16_t owner[MEM_DEPTH];
+
+    /*
+     * Whether the block starting at each word can run, by word address.
+     */
+    uint8_t entry[MEM_DEPTH];
+
+    /*
+     * Worst-case cycles of the block starting at each word, by word address.
+     */
+    uint32_t cost[MEM_DEPTH];
+};
+
+static void check_block(struct lc3machine *m, unsigned int n);
+static void store(void *m, unsigned int addr, unsigned int data,
+                  unsigned int wmask);
+
+/* ===== Public Functions ===== */
+
+int aot_load(struct lc3machine *m, const char *path)
+{
+#ifndef _WIN32
+    const struct aot_module *mod;
+    struct aot_state *a;
+    char buf[4096];
+    void *handle;
+    unsigned int end;
+    unsigned int i;
+    lc3word addr;
+
+    /* Keep dlopen() from searching the library path for bare file names */
+    if (strchr(path, '/') == NULL) {
+        snprintf(buf, sizeof(buf), "./%s", path);
+        path = buf;
+    }
+
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        fprintf(stderr, "error: %s\n", dlerror());
+        return -1;
+    }
+
+    mod = dlsym(handle, AOT_MODULE_SYMBOL);
+    if (mod == NULL) {
+        fprintf(stderr, "error: '%s' is not an lc3aot module\n", path);
+        dlclose(handle);
+        return -1;
+    }
+
+    if (mod->abi != AOT_ABI_VERSION
+        || mod->cpu_size != sizeof(struct lc3cpu)) {
+        fprintf(stderr, "error: '%s' was built for a different lc3emu\n", path);
+        dlclose(handle);
+        return -1;
+    }
+
+    end = mod->origin + 2 * mod->size;
+    for (i = 0; i < mod->num_blocks; i++) {
+        if (mod->blocks[2*i] < mod->origin || mod->blocks[2*i+1] > end
+            || mod->blocks[2*i] >= mod->blocks[2*i+1]
+            || (mod->blocks[2*i] & 1) || i >= UINT16_MAX) {
+            fprintf(stderr, "error: '%s' is corrupt\n", path);
+            dlclose(handle);
+            return -1;
+        }
+    }
+
+    a = calloc(1, sizeof(struct aot_state));
+    if (a == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        dlclose(handle);
+        return -1;
+    }
+
+    for (i = 0; i < mod->num_blocks; i++) {
+        for (addr = mod->blocks[2*i]; addr < mod->blocks[2*i+1]; addr += 2) {
+            a->owner[addr >> 1] = i + 1;
+            a->cost[mod->blocks[2*i] >> 1] +=
+                cpu_cost(mod->image[(addr - mod->origin) >> 1]);
+        }
+    }
+
+    aot_unload(m);
+    a->mod = mod;
+    a->handle = handle;
+    m->aot = a;
+    for (i = 0; i < mod->num_blocks; i++) {
+        check_block(m, i);
+    }
+
+    return 0;
+#else
+    (void) m;
+    fprintf(stderr, "error: cannot load '%s'; "
+                    "translated code is not supported on this host\n", path);
+    return -1;
+#endif
+}
+
+void aot_unload(struct lc3machine *m)
+{
+    if (m->aot == NULL) {
+        return;
+    }
+
+#ifndef _WIN32
+    dlclose(m->aot->handle);
+#endif
+    free(m->aot);
+    m->aot = NULL;
+}
+
+const lc3word * aot_image(struct lc3machine *m, lc3word *origin,
+                          unsigned int *size)
+{
+    if (m->aot == NULL) {
+        return NULL;
+    }
+
+    *origin = m->aot->mod->origin;
+    *size = m->aot->mod->size;
+    return m->aot->mod->image;
+}
+
+int aot_exec(struct lc3machine *m, uint64_t room)
+{
+    lc3word pc;
+    lc3word end;
+
+    pc = m->cpu.pc;
+    if (m->aot == NULL || (pc & 1) || !m->aot->entry[pc >> 1]
+        || m->aot->cost[pc >> 1] > room) {
+        return 0;
+    }
+
+    /* Leave a block ending in a natively serviced TRAP to the interpreter */
+    if (m->traps != NULL) {
+        end = m->aot->mod->blocks[2 * (m->aot->owner[pc >> 1] - 1) + 1];
+        if (traps_native(m, mem_word(&m->mem, end - 2))) {
+            return 0;
+        }
+    }
+
+    return m->aot->mod->run(&m->cpu, mem_pages(m), store, m);
+}
+
+void aot_invalidate(struct lc3machine *m, lc3word addr)
+{
+    if (m->aot != NULL && m->aot->owner[addr >> 1] != 0) {
+        check_block(m, m->aot->owner[addr >> 1] - 1);
+    }
+}
+
+/* ===== Private Functions ===== */
+
+/*
+ * Enable a block if memory holds the code it was translated from, disable it
+ * otherwise.
+ */
+static void check_block(struct lc3machine *m, unsigned int n)
+{
+    const struct aot_module *mod;
+    lc3word start;
+    lc3word end;
+    lc3word a;
+
+    mod = m->aot->mod;
+    start = mod->blocks[2*n];
+    end = mod->blocks[2*n+1];
+    for (a = start; a < end; a += 2) {
+        if (mem_word(&m->mem, a) != mod->image[(a - mod->origin) >> 1]) {
+            m->aot->entry[start >> 1] = 0;
+            return;
+        }
+    }
+
+    m->aot->entry[start >> 1] = 1;
+}
+
+/*
+ * Store helper called from translated code.
+ */
+static void store(void *m, unsigned int addr, unsigned int data,
+                  unsigned int wmask)
+{
+    mem_write_nodelay(m, addr, data, wmask);
+}
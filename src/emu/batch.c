@@ -0,0 +1,1091 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: src/emu/batch.c
+ * Author: Wes Hampson
+ *   Desc: Batch runner.
+ *         Jobs are dealt out to the workers in contiguous runs. Each worker
+ *         takes jobs from the back of its own run; once that is empty it
+ *         steals from the front of another worker's, so long jobs do not
+ *         leave the other cores idle. Jobs never create jobs, so a worker
+ *         stops when every run is empty. On the SIMD engine a worker takes
+ *         up to SIMD_LANES jobs at a time and runs them in lockstep.
+ *         A machine is booted once. Each worker forks the machines it needs
+ *         from it and rewinds them between jobs, so jobs share the booted
+ *         memory until they write to it and engine caches carry over.
+ *
+ *         As a server, each worker accepts connections on a Unix domain
+ *         socket and runs the jobs sent over its connection one at a time.
+ *
+ *         With a result cache, a job is keyed once its image and input are
+ *         loaded: by the pages the image wrote, its entry point, its input
+ *         and budget, and everything common to the batch (engine, booted
+ *         state, module, memory limit and trap cost). A hit supplies its
+ *         record without running it.
+ *============================================================================*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <emu/lc3.h>
+#include <emu/cpu.h>
+#include <emu/machine.h>
+#include <emu/jit.h>
+#include <emu/aot.h>
+#include <emu/os.h>
+#include <emu/simd.h>
+#include <emu/batch.h>
+#include <emu/traps.h>
+#include <emu/snapshot.h>
+#include <emu/cache.h>
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define LINE_MAX_LEN    4096
+#define MAX_INPUT       (1 << 24)   /* most keyboard input in a request */
+#define BAD_REQUEST     "error: expected 'image input-bytes cycles'\n"
+
+/*
+ * A batch job.
+ */
+struct job {
+    int n;                      /* job number, from 1 */
+    char *image;                /* object image path */
+    char *input;                /* keyboard input path, or NULL */
+    uint64_t budget;            /* maximum clock cycles */
+    struct lc3machine *m;       /* machine, while running */
+    enum lc3engine engine;      /* engine the machine runs on */
+    unsigned char *in;          /* keyboard input */
+    size_t in_len;
+    size_t in_pos;
+    char *out;                  /* display output */
+    size_t out_len;
+    size_t out_cap;
+    char *record;               /* results text */
+    size_t record_len;
+    struct lc3cachekey key;     /* cache key, once loaded */
+};
+
+/*
+ * A worker's run of jobs, [head, tail). The owner takes from the tail and
+ * thieves take from the head.
+ */
+struct deque {
+    pthread_mutex_t lock;
+    int head;
+    int tail;
+};
+
+/*
+ * Batch-wide state shared by the workers.
+ */
+struct pool {
+    struct job *jobs;
+    struct deque *deques;
+    int num_workers;
+    enum lc3engine engine;
+    const char *module;
+    struct lc3machine *base;    /* booted machine each job is forked from */
+    int trap_cost;
+    struct lc3cache *cache;     /* result cache, or NULL */
+    struct lc3cachekey key;     /* cache key of what every job shares */
+    int sock;                   /* listening socket, when serving */
+};
+
+/*
+ * Worker thread argument.
+ */
+struct worker {
+    struct pool *pool;
+    int id;
+    pthread_t thread;
+    struct lc3machine *m[SIMD_LANES];   /* machines, rewound between jobs */
+};
+
+static struct lc3machine * boot(unsigned int memory, const char *snapshot);
+static void pool_key(struct pool *pool, const char *snapshot,
+                     unsigned int memory);
+static int read_manifest(const char *path, struct job **jobs);
+static void * worker_main(void *arg);
+static int take(struct deque *d, int from_tail);
+static void * serve_main(void *arg);
+static void serve_conn(struct worker *w, int fd);
+static int read_request(FILE *f, char *line, struct job *job);
+static int send_all(int fd, const char *data, size_t len);
+static void run_jobs(struct worker *w, struct job **jobs, int count);
+static int job_start(struct worker *w, struct job *job, int slot);
+static struct lc3machine * new_machine(struct pool *pool, struct job *job);
+static int job_cached(struct pool *pool, struct job *job);
+static void job_finish(struct job *job);
+static void free_machines(struct worker *w);
+static void write_record(struct job *job, const char *status,
+                         uint64_t cycles);
+static void write_cached(struct job *job, const char *body, size_t len);
+static int read_file(const char *path, unsigned char **data, size_t *len);
+static int job_getc(void *ctx);
+static void job_putc(void *ctx, int c);
+
+/* ===== Public Functions ===== */
+
+int batch_run(const char *manifest, const char *results,
+              enum lc3engine engine, const char *module, const char *snapshot,
+              unsigned int memory, int trap_cost, struct lc3cache *cache,
+              int workers)
+{
+    struct lc3machine *base;
+    struct pool pool;
+    struct worker *w;
+    struct job *jobs;
+    FILE *f;
+    int num_jobs;
+    int i;
+
+    num_jobs = read_manifest(manifest, &jobs);
+    if (num_jobs < 0) {
+        return -num_jobs;
+    }
+
+    base = boot(memory, snapshot);
+    if (base == NULL) {
+        return 2;
+    }
+
+    if (strcmp(results, "-") == 0) {
+        f = stdout;
+    }
+    else if ((f = fopen(results, "wb")) == NULL) {
+        fprintf(stderr, "error: failed to open '%s'\n", results);
+        machine_destroy(base);
+        return 2;
+    }
+
+    if (workers <= 0) {
+        workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (workers > num_jobs) {
+        workers = num_jobs;
+    }
+    if (workers < 1) {
+        workers = 1;
+    }
+
+    pool.jobs = jobs;
+    pool.deques = calloc(workers, sizeof(struct deque));
+    pool.num_workers = workers;
+    pool.engine = engine;
+    pool.module = module;
+    pool.base = base;
+    pool.trap_cost = trap_cost;
+    pool.cache = cache;
+    pool.sock = -1;
+    pool_key(&pool, snapshot, memory);
+    w = calloc(workers, sizeof(struct worker));
+    if (pool.deques == NULL || w == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(2);
+    }
+
+    for (i = 0; i < workers; i++) {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].head = (int) ((int64_t) num_jobs * i / workers);
+        pool.deques[i].tail = (int) ((int64_t) num_jobs * (i + 1) / workers);
+        w[i].pool = &pool;
+        w[i].id = i;
+    }
+
+    /* Worker 0 is this thread */
+    for (i = 1; i < workers; i++) {
+        if (pthread_create(&w[i].thread, NULL, worker_main, &w[i]) != 0) {
+            fprintf(stderr, "error: failed to start worker thread\n");
+            exit(2);
+        }
+    }
+    worker_main(&w[0]);
+    for (i = 1; i < workers; i++) {
+        pthread_join(w[i].thread, NULL);
+    }
+
+    for (i = 0; i < num_jobs; i++) {
+        fwrite(jobs[i].record, 1, jobs[i].record_len, f);
+        free(jobs[i].record);
+        free(jobs[i].image);
+        free(jobs[i].input);
+    }
+
+    for (i = 0; i < workers; i++) {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    }
+    free(pool.deques);
+    free(w);
+    free(jobs);
+    machine_destroy(base);
+
+    if (f != stdout) {
+        fclose(f);
+    }
+    else {
+        fflush(f);
+    }
+    return 0;
+}
+
+int batch_serve(const char *path, enum lc3engine engine, const char *module,
+                const char *snapshot, unsigned int memory, int trap_cost,
+                struct lc3cache *cache, int workers)
+{
+    struct sockaddr_un addr;
+    struct lc3machine *base;
+    struct pool pool;
+    struct worker *w;
+    struct stat st;
+    int sock;
+    int i;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "error: socket path '%s' is too long\n", path);
+        return 2;
+    }
+    strcpy(addr.sun_path, path);
+
+    base = boot(memory, snapshot);
+    if (base == NULL) {
+        return 2;
+    }
+
+    /* A socket left behind by an earlier server is replaced */
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0
+        || listen(sock, SOMAXCONN) != 0) {
+        fprintf(stderr, "error: cannot listen on '%s': %s\n", path,
+                strerror(errno));
+        if (sock >= 0) {
+            close(sock);
+        }
+        machine_destroy(base);
+        return 2;
+    }
+
+    /* A client that hangs up before its results are sent is just dropped */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (workers <= 0) {
+        workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (workers < 1) {
+        workers = 1;
+    }
+
+    memset(&pool, 0, sizeof(pool));
+    pool.engine = engine;
+    pool.module = module;
+    pool.base = base;
+    pool.trap_cost = trap_cost;
+    pool.cache = cache;
+    pool.sock = sock;
+    pool_key(&pool, snapshot, memory);
+    w = calloc(workers, sizeof(struct worker));
+    if (w == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(2);
+    }
+
+    /* Worker 0 is this thread */
+    for (i = 0; i < workers; i++) {
+        w[i].pool = &pool;
+        w[i].id = i;
+    }
+    for (i = 1; i < workers; i++) {
+        if (pthread_create(&w[i].thread, NULL, serve_main, &w[i]) != 0) {
+            fprintf(stderr, "error: failed to start worker thread\n");
+            exit(2);
+        }
+    }
+    serve_main(&w[0]);
+
+    /* Only reached if the socket fails */
+    close(sock);
+    for (i = 1; i < workers; i++) {
+        pthread_join(w[i].thread, NULL);
+    }
+    unlink(path);
+    free(w);
+    machine_destroy(base);
+    return 2;
+}
+
+/*
+ * Boot the machine every job is forked from. Errors are reported on stderr.
+ *
+ * @param memory    KiB of RAM, or 0 for all of it
+ * @param snapshot  a snapshot to restore instead of booting the OS, or NULL
+ * @return          the booted machine
+ *                  NULL if the snapshot cannot be loaded
+ */
+static struct lc3machine * boot(unsigned int memory, const char *snapshot)
+{
+    struct lc3machine *m;
+
+    m = machine_create();
+    if (m == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(2);
+    }
+    if (memory != 0) {
+        mem_limit(m, memory);
+    }
+    if (snapshot != NULL) {
+        if (snapshot_load(m, snapshot) != 0) {
+            machine_destroy(m);
+            return NULL;
+        }
+    }
+    else {
+        os_load(m);
+    }
+
+    return m;
+}
+
+/*
+ * Start the cache key every job's key is built from. If the snapshot or
+ * module cannot be read, the cache is not used.
+ *
+ * @param snapshot  the snapshot the machines start from, or NULL
+ * @param memory    KiB of RAM, or 0 for all of it
+ */
+static void pool_key(struct pool *pool, const char *snapshot,
+                     unsigned int memory)
+{
+    unsigned char *data;
+    uint64_t len;
+    size_t size;
+    int32_t field[3];
+
+    if (pool->cache == NULL) {
+        return;
+    }
+
+    cache_key_init(&pool->key);
+    field[0] = pool->engine;
+    field[1] = pool->trap_cost;
+    field[2] = (int32_t) memory;
+    cache_key_add(&pool->key, field, sizeof(field));
+
+    /* The built-in OS is covered by CACHE_VERSION */
+    if (snapshot != NULL) {
+        if (read_file(snapshot, &data, &size) != 0) {
+            goto fail;
+        }
+        len = size;
+        cache_key_add(&pool->key, &len, sizeof(len));
+        cache_key_add(&pool->key, data, size);
+        free(data);
+    }
+    else {
+        len = 0;
+        cache_key_add(&pool->key, &len, sizeof(len));
+    }
+
+    if (pool->module != NULL) {
+        if (read_file(pool->module, &data, &size) != 0) {
+            goto fail;
+        }
+        len = size;
+        cache_key_add(&pool->key, &len, sizeof(len));
+        cache_key_add(&pool->key, data, size);
+        free(data);
+    }
+    else {
+        len = 0;
+        cache_key_add(&pool->key, &len, sizeof(len));
+    }
+    return;
+
+fail:
+    fprintf(stderr, "warning: result cache disabled\n");
+    pool->cache = NULL;
+}
+
+/* ===== Scheduling ===== */
+
+/*
+ * Parse a manifest. Errors are reported on stderr.
+ *
+ * @param path  the manifest file
+ * @param jobs  a pointer to store the job array
+ * @return      the number of jobs
+ *              -1 if the manifest is malformed
+ *              -2 if it cannot be opened
+ */
+static int read_manifest(const char *path, struct job **jobs)
+{
+    char line[LINE_MAX_LEN];
+    char *field[4];
+    char *end;
+    struct job *j;
+    FILE *f;
+    int num_jobs;
+    int cap;
+    int lineno;
+    int n;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "error: failed to open manifest '%s'\n", path);
+        return -2;
+    }
+
+    *jobs = NULL;
+    num_jobs = 0;
+    cap = 0;
+    lineno = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+        if ((end = strchr(line, '#')) != NULL) {
+            *end = '\0';
+        }
+
+        n = 0;
+        field[n] = strtok(line, " \t\r\n");
+        while (field[n] != NULL && n < 3) {
+            field[++n] = strtok(NULL, " \t\r\n");
+        }
+        if (n == 0) {
+            continue;
+        }
+        if (n != 3 || field[3] != NULL) {
+            fprintf(stderr, "%s:%d: error: expected 'image input cycles'\n",
+                    path, lineno);
+            fclose(f);
+            return -1;
+        }
+
+        if (num_jobs == cap) {
+            cap = cap ? 2 * cap : 64;
+            *jobs = realloc(*jobs, cap * sizeof(struct job));
+            if (*jobs == NULL) {
+                fprintf(stderr, "error: out of memory\n");
+                exit(2);
+            }
+        }
+
+        j = &(*jobs)[num_jobs++];
+        memset(j, 0, sizeof(struct job));
+        j->n = num_jobs;
+        j->budget = strtoull(field[2], &end, 10);
+        if (*end != '\0' || j->budget == 0 || field[2][0] == '-') {
+            fprintf(stderr, "%s:%d: error: invalid cycle budget '%s'\n",
+                    path, lineno, field[2]);
+            fclose(f);
+            return -1;
+        }
+        j->image = strdup(field[0]);
+        j->input = (strcmp(field[1], "-") == 0) ? NULL : strdup(field[1]);
+    }
+
+    fclose(f);
+    return num_jobs;
+}
+
+static void * worker_main(void *arg)
+{
+    struct worker *w;
+    struct pool *pool;
+    struct job *group[SIMD_LANES];
+    int size;
+    int victim;
+    int count;
+    int n;
+    int i;
+
+    w = arg;
+    pool = w->pool;
+    size = (pool->engine == ENGINE_SIMD) ? SIMD_LANES : 1;
+    for (;;) {
+        count = 0;
+        do {
+            n = take(&pool->deques[w->id], 1);
+            for (i = 1; n < 0 && i < pool->num_workers; i++) {
+                victim = (w->id + i) % pool->num_workers;
+                n = take(&pool->deques[victim], 0);
+            }
+            if (n >= 0) {
+                group[count++] = &pool->jobs[n];
+            }
+        } while (n >= 0 && count < size);
+        if (count == 0) {
+            break;
+        }
+        run_jobs(w, group, count);
+    }
+
+    free_machines(w);
+    return NULL;
+}
+
+/*
+ * Take a job from one end of a run.
+ *
+ * @param d         the run
+ * @param from_tail nonzero to take from the tail (owner), zero for the head
+ * @return          the job number
+ *                  -1 if the run is empty
+ */
+static int take(struct deque *d, int from_tail)
+{
+    int n;
+
+    n = -1;
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail) {
+        n = from_tail ? --d->tail : d->head++;
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    return n;
+}
+
+/* ===== Serving ===== */
+
+static void * serve_main(void *arg)
+{
+    struct worker *w;
+    int fd;
+
+    w = arg;
+    for (;;) {
+        fd = accept(w->pool->sock, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            fprintf(stderr, "error: accept failed: %s\n", strerror(errno));
+            break;
+        }
+        serve_conn(w, fd);
+    }
+
+    free_machines(w);
+    return NULL;
+}
+
+/*
+ * Run the jobs sent over a connection until the client closes it or sends
+ * a malformed request, then close it.
+ *
+ * @param fd    the connection
+ */
+static void serve_conn(struct worker *w, int fd)
+{
+    char line[LINE_MAX_LEN];
+    struct job job;
+    struct job *j;
+    FILE *f;
+    int n;
+    int r;
+
+    f = fdopen(fd, "rb");
+    if (f == NULL) {
+        close(fd);
+        return;
+    }
+
+    n = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        memset(&job, 0, sizeof(struct job));
+        r = read_request(f, line, &job);
+        if (r == 0) {
+            continue;
+        }
+        if (r < 0) {
+            send_all(fd, BAD_REQUEST, sizeof(BAD_REQUEST) - 1);
+            break;
+        }
+
+        job.n = ++n;
+        j = &job;
+        run_jobs(w, &j, 1);
+        r = send_all(fd, job.record, job.record_len);
+        free(job.record);
+        free(job.image);
+        if (r != 0) {
+            break;
+        }
+    }
+
+    fclose(f);
+}
+
+/*
+ * Parse a request line, and read the keyboard input that follows it.
+ *
+ * @param f     the connection
+ * @param line  the request line
+ * @param job   the job to fill in
+ * @return      1 on success
+ *              0 if the line is blank
+ *              -1 if the request is malformed or the input cut short
+ */
+static int read_request(FILE *f, char *line, struct job *job)
+{
+    char *field[4];
+    char *end;
+    unsigned long long len;
+    int n;
+
+    n = 0;
+    field[n] = strtok(line, " \t\r\n");
+    while (field[n] != NULL && n < 3) {
+        field[++n] = strtok(NULL, " \t\r\n");
+    }
+    if (n == 0) {
+        return 0;
+    }
+    if (n != 3 || field[3] != NULL) {
+        return -1;
+    }
+
+    len = strtoull(field[1], &end, 10);
+    if (*end != '\0' || field[1][0] == '-' || len > MAX_INPUT) {
+        return -1;
+    }
+    job->budget = strtoull(field[2], &end, 10);
+    if (*end != '\0' || job->budget == 0 || field[2][0] == '-') {
+        return -1;
+    }
+
+    job->in = malloc(len ? len : 1);
+    if (job->in == NULL || fread(job->in, 1, len, f) != len) {
+        free(job->in);
+        job->in = NULL;
+        return -1;
+    }
+    job->in_len = len;
+
+    job->image = strdup(field[0]);
+    if (job->image == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(2);
+    }
+    return 1;
+}
+
+/*
+ * Write all of a buffer to a socket.
+ *
+ * @return      0 on success
+ *              -1 if the connection has failed
+ */
+static int send_all(int fd, const char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* ===== Jobs ===== */
+
+/*
+ * Run a group of jobs, together on the SIMD engine and one after another
+ * otherwise.
+ *
+ * @param jobs  the jobs
+ * @param count the number of jobs, at most SIMD_LANES
+ */
+static void run_jobs(struct worker *w, struct job **jobs, int count)
+{
+    struct job *ready[SIMD_LANES];
+    struct lc3machine *m[SIMD_LANES];
+    uint64_t max[SIMD_LANES];
+    uint64_t cycles[SIMD_LANES];
+    char *body;
+    int num_ready;
+    int i;
+
+    num_ready = 0;
+    for (i = 0; i < count; i++) {
+        if (job_start(w, jobs[i], i) == 0 && !job_cached(w->pool, jobs[i])) {
+            ready[num_ready] = jobs[i];
+            m[num_ready] = ready[num_ready]->m;
+            max[num_ready] = ready[num_ready]->budget;
+            num_ready++;
+        }
+    }
+
+    if (w->pool->engine == ENGINE_SIMD) {
+        simd_run(m, max, cycles, num_ready);
+    }
+    else {
+        for (i = 0; i < num_ready; i++) {
+            cycles[i] = cpu_run(m[i], ready[i]->engine, max[i]);
+        }
+    }
+
+    for (i = 0; i < num_ready; i++) {
+        write_record(ready[i], (get_mcr(m[i]) & MCR_CE) ? "budget" : "halted",
+                     cycles[i]);
+        if (w->pool->cache != NULL) {
+            body = strchr(ready[i]->record, '\n') + 1;
+            cache_put(w->pool->cache, &ready[i]->key, body,
+                      ready[i]->record_len - (body - ready[i]->record));
+        }
+        job_finish(ready[i]);
+    }
+}
+
+/*
+ * Set up a job on one of the worker's machines, rewinding it to the booted
+ * state or forking it on first use. On failure, the error is recorded and
+ * the job is finished.
+ *
+ * @param slot  the worker's machine to use
+ * @return      0 if the machine is ready to run
+ */
+static int job_start(struct worker *w, struct job *job, int slot)
+{
+    struct pool *pool;
+    struct lc3machine *m;
+    lc3word origin;
+
+    pool = w->pool;
+    m = w->m[slot];
+    if (m != NULL) {
+        machine_rewind(m, pool->base);
+    }
+    else if ((m = new_machine(pool, job)) == NULL) {
+        job_finish(job);
+        return -1;
+    }
+    w->m[slot] = m;
+
+    job->m = m;
+    job->engine = (pool->engine == ENGINE_JIT && m->jit == NULL)
+                ? ENGINE_FAST : pool->engine;
+    m->io.getc = job_getc;
+    m->io.putc = job_putc;
+    m->io.wait = NULL;
+    m->io.flush = NULL;
+    m->io.ctx = job;
+
+    if (machine_load(m, job->image, &origin) != 0) {
+        write_record(job, "error (cannot load image)", 0);
+        goto fail;
+    }
+    cpu_setreg(m, R_PC, origin);
+
+    if (job->input != NULL
+        && read_file(job->input, &job->in, &job->in_len) != 0) {
+        write_record(job, "error (cannot read input)", 0);
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    job_finish(job);
+    return -1;
+}
+
+/*
+ * Fork a machine from the booted one and set up its engine. On failure, the
+ * error is recorded against the job.
+ *
+ * @return      the machine
+ *              NULL on failure
+ */
+static struct lc3machine * new_machine(struct pool *pool, struct job *job)
+{
+    job->m = machine_fork(pool->base);
+    if (job->m == NULL) {
+        write_record(job, "error (out of memory)", 0);
+        return NULL;
+    }
+
+    if (pool->trap_cost > 0 && traps_enable(job->m, pool->trap_cost) != 0) {
+        write_record(job, "error (out of memory)", 0);
+        goto fail;
+    }
+    if (pool->module != NULL && aot_load(job->m, pool->module) != 0) {
+        write_record(job, "error (cannot load module)", 0);
+        goto fail;
+    }
+
+    /* Without the JIT, jobs fall back to the fast engine */
+    if (pool->engine == ENGINE_JIT) {
+        jit_init(job->m);
+    }
+    return job->m;
+
+fail:
+    machine_destroy(job->m);
+    job->m = NULL;
+    return NULL;
+}
+
+/*
+ * Key a loaded job and look it up in the cache. On a hit, its record is
+ * written from the cached results and the job is finished.
+ *
+ * @return      1 on a hit
+ *              0 if the job must be run
+ */
+static int job_cached(struct pool *pool, struct job *job)
+{
+    struct lc3cachekey *k;
+    struct lc3machine *m;
+    uint64_t field[3];
+    uint32_t page;
+    char *body;
+    size_t len;
+
+    if (pool->cache == NULL) {
+        return 0;
+    }
+
+    /* A page the image was loaded into no longer maps the booted one */
+    k = &job->key;
+    m = job->m;
+    *k = pool->key;
+    for (page = 0; page < MEM_PAGES; page++) {
+        if (m->mem.page[page] != pool->base->mem.page[page]) {
+            cache_key_add(k, &page, sizeof(page));
+            cache_key_add(k, m->mem.page[page], MEM_PAGE_SIZE);
+        }
+    }
+    field[0] = cpu_getreg(m, R_PC);
+    field[1] = job->budget;
+    field[2] = job->in_len;
+    cache_key_add(k, field, sizeof(field));
+    cache_key_add(k, job->in, job->in_len);
+
+    if (cache_get(pool->cache, k, &body, &len) != 0) {
+        return 0;
+    }
+    write_cached(job, body, len);
+    free(body);
+    job_finish(job);
+    return 1;
+}
+
+/*
+ * Release a job's buffers. Its record is kept, and its machine is left to
+ * the worker for the next job.
+ */
+static void job_finish(struct job *job)
+{
+    job->m = NULL;
+    free(job->in);
+    job->in = NULL;
+    free(job->out);
+    job->out = NULL;
+}
+
+/*
+ * Destroy a worker's machines.
+ */
+static void free_machines(struct worker *w)
+{
+    int i;
+
+    for (i = 0; i < SIMD_LANES; i++) {
+        machine_destroy(w->m[i]);
+        w->m[i] = NULL;
+    }
+}
+
+/*
+ * Format a job's results. The machine must still exist.
+ */
+static void write_record(struct job *job, const char *status,
+                         uint64_t cycles)
+{
+    FILE *f;
+
+    f = open_memstream(&job->record, &job->record_len);
+    if (f == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(2);
+    }
+
+    fprintf(f, "job %d: %s\n", job->n, job->image);
+    fprintf(f, "status: %s\n", status);
+    fprintf(f, "cycles: %llu\n", (unsigned long long) cycles);
+    fprintf(f, "output: %zu bytes\n", job->out_len);
+    fwrite(job->out, 1, job->out_len, f);
+    if (job->out_len > 0) {
+        fputc('\n', f);
+    }
+    fprintf(f, "registers:\n");
+    if (job->m != NULL) {
+        cpu_fdumpregs(job->m, f);
+    }
+    fprintf(f, "\n");
+
+    fclose(f);
+}
+
+/*
+ * Format a job's results from a cache entry, which holds all but the first
+ * line of the record the job would have written.
+ */
+static void write_cached(struct job *job, const char *body, size_t len)
+{
+    FILE *f;
+
+    f = open_memstream(&job->record, &job->record_len);
+    if (f == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(2);
+    }
+
+    fprintf(f, "job %d: %s\n", job->n, job->image);
+    fwrite(body, 1, len, f);
+
+    fclose(f);
+}
+
+static int read_file(const char *path, unsigned char **data, size_t *len)
+{
+    FILE *f;
+    long size;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "error: failed to open '%s'\n", path);
+        return -1;
+    }
+
+    if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0
+        || fseek(f, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "error: failed to read '%s'\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    *data = malloc(size ? size : 1);
+    if (*data == NULL || fread(*data, 1, size, f) != (size_t) size) {
+        fprintf(stderr, "error: failed to read '%s'\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    *len = size;
+    fclose(f);
+    return 0;
+}
+
+/*
+ * Keyboard hook. Hands over the next input character once the program has
+ * read the previous one from KBDR, so no input is lost however slowly the
+ * program reads it.
+ */
+static int job_getc(void *ctx)
+{
+    struct job *job = ctx;
+
+    if (job->in_pos == job->in_len || !job->m->kbd.taken) {
+        return -1;
+    }
+
+    return job->in[job->in_pos++];
+}
+
+/*
+ * Display hook. Collects output in memory.
+ */
+static void job_putc(void *ctx, int c)
+{
+    struct job *job = ctx;
+
+    if (job->out_len == job->out_cap) {
+        job->out_cap = job->out_cap ? 2 * job->out_cap : 256;
+        job->out = realloc(job->out, job->out_cap);
+        if (job->out == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(2);
+        }
+    }
+
+    job->out[job->out_len++] = c;
+}
+
+#else
+
+int batch_run(const char *manifest, const char *results,
+              enum lc3engine engine, const char *module, const char *snapshot,
+              unsigned int memory, int trap_cost, struct lc3cache *cache,
+              int workers)
+{
+    (void) manifest;
+    (void) results;
+    (void) engine;
+    (void) module;
+    (void) snapshot;
+    (void) memory;
+    (void) trap_cost;
+    (void) cache;
+    (void) workers;
+
+    fprintf(stderr, "error: batch mode is not supported on this host\n");
+    return 2;
+}
+
+int batch_serve(const char *path, enum lc3engine engine, const char *module,
+                const char *snapshot, unsigned int memory, int trap_cost,
+                struct lc3cache *cache, int workers)
+{
+    (void) path;
+    (void) engine;
+    (void) module;
+    (void) snapshot;
+    (void) memory;
+    (void) trap_cost;
+    (void) cache;
+    (void) workers;
+
+    fprintf(stderr, "error: server mode is not supported on this host\n");
+    return 2;
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,512 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: src/emu/cache.c
+ * Author: Wes Hampson
+ *   Desc: On-disk result cache. Entries live in one directory, each in a
+ *         file named by its key in hex and holding a header line with the
+ *         length of the contents that follow, so an entry cut short by a
+ *         crash is recognised and thrown away.
+ *
+ *         Each process keeps a running estimate of the directory's size,
+ *         refreshed whenever it sweeps. It sweeps once its own writes push
+ *         the estimate over the limit, or add up to a sixteenth of it, so
+ *         several processes sharing the directory overshoot the limit by
+ *         little. A sweep takes an advisory lock, so only one runs at a time,
+ *         and trims the directory to seven eighths of the limit, oldest
+ *         modification time first.
+ *============================================================================*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include <emu/cache.h>
+
+#define FNV_OFFSET      0xcbf29ce484222325ULL
+#define FNV_PRIME       0x00000100000001b3ULL
+#define MIX_OFFSET      0x6a09e667f3bcc909ULL
+#define MIX_PRIME       0x9e3779b97f4a7c15ULL
+
+#define NAME_LEN        32                  /* hex digits in an entry name */
+#define MAGIC           "LC3CACHE"
+#define HEADER_MAX      64                  /* longest header line */
+#define LOCK_NAME       ".lock"
+#define TMP_PREFIX      ".tmp-"
+#define TMP_AGE         3600                /* seconds before a temporary
+                                               file is taken as abandoned */
+
+#ifndef _WIN32
+
+/*
+ * An open cache.
+ */
+struct lc3cache {
+    int dir;                    /* cache directory */
+    uint64_t max_size;          /* size limit */
+    pthread_mutex_t lock;       /* guards the fields below */
+    uint64_t used;              /* estimated size of all entries */
+    uint64_t written;           /* bytes written since the last sweep */
+    unsigned int seq;           /* temporary file counter */
+};
+
+/*
+ * An entry seen by a sweep.
+ */
+struct entry {
+    char name[NAME_LEN + 1];
+    uint64_t size;
+    struct timespec mtime;
+};
+
+static void sweep(struct lc3cache *c);
+static int is_entry(const char *name);
+static int by_age(const void *a, const void *b);
+static int write_all(int fd, const char *data, size_t len);
+
+#endif /* _WIN32 */
+
+static uint64_t finish(uint64_t h);
+static void key_name(const struct lc3cachekey *k, char *name);
+
+/* ===== Public Functions ===== */
+
+void cache_key_init(struct lc3cachekey *k)
+{
+    uint32_t version;
+
+    k->h[0] = FNV_OFFSET;
+    k->h[1] = MIX_OFFSET;
+    version = CACHE_VERSION;
+    cache_key_add(k, &version, sizeof(version));
+}
+
+void cache_key_add(struct lc3cachekey *k, const void *data, size_t len)
+{
+    const unsigned char *p;
+    uint64_t a, b;
+    size_t i;
+
+    /* Two unrelated 64-bit hashes, FNV-1a and a multiply-xorshift */
+    p = data;
+    a = k->h[0];
+    b = k->h[1];
+    for (i = 0; i < len; i++) {
+        a = (a ^ p[i]) * FNV_PRIME;
+        b = (b + p[i]) * MIX_PRIME;
+        b ^= b >> 29;
+    }
+    k->h[0] = a;
+    k->h[1] = b;
+}
+
+#ifndef _WIN32
+
+struct lc3cache * cache_open(const char *dir, uint64_t max_size)
+{
+    struct lc3cache *c;
+    int fd;
+
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "error: cannot create cache '%s': %s\n", dir,
+                strerror(errno));
+        return NULL;
+    }
+    fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        fprintf(stderr, "error: cannot open cache '%s': %s\n", dir,
+                strerror(errno));
+        return NULL;
+    }
+
+    c = calloc(1, sizeof(struct lc3cache));
+    if (c == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        close(fd);
+        return NULL;
+    }
+    c->dir = fd;
+    c->max_size = max_size;
+    pthread_mutex_init(&c->lock, NULL);
+
+    sweep(c);
+    return c;
+}
+
+void cache_close(struct lc3cache *c)
+{
+    if (c == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&c->lock);
+    close(c->dir);
+    free(c);
+}
+
+int cache_get(struct lc3cache *c, const struct lc3cachekey *k,
+              char **data, size_t *len)
+{
+    char name[NAME_LEN + 1];
+    char header[HEADER_MAX];
+    unsigned long long stored;
+    struct stat st;
+    char *buf;
+    char *end;
+    size_t size;
+    size_t n;
+    ssize_t r;
+    int fd;
+
+    key_name(k, name);
+    fd = openat(c->dir, name, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    buf = NULL;
+    if (fstat(fd, &st) != 0 || (uint64_t) st.st_size > c->max_size) {
+        goto corrupt;
+    }
+    size = (size_t) st.st_size;
+    buf = malloc(size + 1);
+    if (buf == NULL) {
+        goto miss;
+    }
+    for (n = 0; n < size; n += r) {
+        r = pread(fd, buf + n, size - n, n);
+        if (r < 0 && errno == EINTR) {
+            r = 0;
+            continue;
+        }
+        if (r <= 0) {
+            goto corrupt;
+        }
+    }
+    buf[size] = '\0';
+
+    /* "LC3CACHE <length>\n", then exactly that many bytes */
+    end = memchr(buf, '\n', size < HEADER_MAX ? size : HEADER_MAX);
+    if (end == NULL) {
+        goto corrupt;
+    }
+    n = end + 1 - buf;
+    memcpy(header, buf, n);
+    header[n - 1] = '\0';
+    if (sscanf(header, MAGIC " %llu", &stored) != 1
+        || stored != size - n) {
+        goto corrupt;
+    }
+    memmove(buf, buf + n, size - n);
+
+    /* Mark it as recently used */
+    futimens(fd, NULL);
+    close(fd);
+    *data = buf;
+    *len = size - n;
+    return 0;
+
+corrupt:
+    unlinkat(c->dir, name, 0);
+miss:
+    free(buf);
+    close(fd);
+    return -1;
+}
+
+void cache_put(struct lc3cache *c, const struct lc3cachekey *k,
+               const char *data, size_t len)
+{
+    char name[NAME_LEN + 1];
+    char tmp[NAME_LEN + 1];
+    char header[HEADER_MAX];
+    unsigned int seq;
+    uint64_t size;
+    int full;
+    int fd;
+    int n;
+
+    pthread_mutex_lock(&c->lock);
+    seq = c->seq++;
+    pthread_mutex_unlock(&c->lock);
+
+    /* Unique across processes and threads */
+    key_name(k, name);
+    snprintf(tmp, sizeof(tmp), TMP_PREFIX "%ld-%u", (long) getpid(), seq);
+    n = snprintf(header, sizeof(header), MAGIC " %llu\n",
+                 (unsigned long long) len);
+
+    fd = openat(c->dir, tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd < 0) {
+        return;
+    }
+    if (write_all(fd, header, n) != 0 || write_all(fd, data, len) != 0) {
+        close(fd);
+        unlinkat(c->dir, tmp, 0);
+        return;
+    }
+    close(fd);
+
+    /* Readers see the old entry, no entry or the new one, never a part */
+    if (renameat(c->dir, tmp, c->dir, name) != 0) {
+        unlinkat(c->dir, tmp, 0);
+        return;
+    }
+
+    size = n + len;
+    pthread_mutex_lock(&c->lock);
+    c->used += size;
+    c->written += size;
+    full = c->used > c->max_size || c->written > c->max_size / 16;
+    pthread_mutex_unlock(&c->lock);
+
+    if (full) {
+        sweep(c);
+    }
+}
+
+#else
+
+struct lc3cache * cache_open(const char *dir, uint64_t max_size)
+{
+    (void) dir;
+    (void) max_size;
+
+    fprintf(stderr, "error: the result cache is not supported on this host\n");
+    return NULL;
+}
+
+void cache_close(struct lc3cache *c)
+{
+    (void) c;
+}
+
+int cache_get(struct lc3cache *c, const struct lc3cachekey *k,
+              char **data, size_t *len)
+{
+    (void) c;
+    (void) k;
+    (void) data;
+    (void) len;
+
+    return -1;
+}
+
+void cache_put(struct lc3cache *c, const struct lc3cachekey *k,
+               const char *data, size_t len)
+{
+    (void) c;
+    (void) k;
+    (void) data;
+    (void) len;
+}
+
+#endif /* _WIN32 */
+
+/* ===== Private Functions ===== */
+
+/*
+ * Spread every input bit over the whole of a hash (the SplitMix64
+ * finaliser), so that names differ from the first digit.
+ */
+static uint64_t finish(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+/*
+ * Format the entry name for a key.
+ *
+ * @param name  a buffer of at least NAME_LEN + 1 bytes
+ */
+static void key_name(const struct lc3cachekey *k, char *name)
+{
+    sprintf(name, "%016llx%016llx",
+            (unsigned long long) finish(k->h[0]),
+            (unsigned long long) finish(k->h[1]));
+}
+
+#ifndef _WIN32
+
+/*
+ * Measure the cache and delete the least recently used entries if it is
+ * over its limit, along with abandoned temporary files. Does nothing if
+ * another thread or process is already sweeping.
+ */
+static void sweep(struct lc3cache *c)
+{
+    struct entry *entries;
+    struct entry *e;
+    struct dirent *d;
+    struct stat st;
+    DIR *dir;
+    uint64_t total;
+    uint64_t target;
+    time_t now;
+    int count;
+    int cap;
+    int lock;
+    int fd;
+    int i;
+
+    lock = openat(c->dir, LOCK_NAME, O_RDWR | O_CREAT, 0666);
+    if (lock < 0) {
+        return;
+    }
+    if (flock(lock, LOCK_EX | LOCK_NB) != 0) {
+        close(lock);
+        return;
+    }
+
+    fd = openat(c->dir, ".", O_RDONLY | O_DIRECTORY);
+    dir = (fd < 0) ? NULL : fdopendir(fd);
+    if (dir == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        close(lock);
+        return;
+    }
+
+    entries = NULL;
+    count = 0;
+    cap = 0;
+    total = 0;
+    now = time(NULL);
+    while ((d = readdir(dir)) != NULL) {
+        if (fstatat(c->dir, d->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0
+            || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (strncmp(d->d_name, TMP_PREFIX, strlen(TMP_PREFIX)) == 0) {
+            if (now - st.st_mtime > TMP_AGE) {
+                unlinkat(c->dir, d->d_name, 0);
+            }
+            continue;
+        }
+        if (!is_entry(d->d_name)) {
+            continue;
+        }
+
+        if (count == cap) {
+            cap = cap ? 2 * cap : 256;
+            e = realloc(entries, cap * sizeof(struct entry));
+            if (e == NULL) {
+                break;
+            }
+            entries = e;
+        }
+        e = &entries[count++];
+        strcpy(e->name, d->d_name);
+        e->size = (uint64_t) st.st_size;
+        e->mtime = st.st_mtim;
+        total += e->size;
+    }
+    closedir(dir);
+
+    /* Trim well below the limit, so the next sweep is not soon after */
+    if (total > c->max_size) {
+        target = c->max_size - c->max_size / 8;
+        qsort(entries, count, sizeof(struct entry), by_age);
+        for (i = 0; i < count && total > target; i++) {
+            if (unlinkat(c->dir, entries[i].name, 0) == 0
+                || errno == ENOENT) {
+                total -= entries[i].size;
+            }
+        }
+    }
+    free(entries);
+
+    pthread_mutex_lock(&c->lock);
+    c->used = total;
+    c->written = 0;
+    pthread_mutex_unlock(&c->lock);
+
+    close(lock);
+}
+
+/*
+ * Check whether a file name is an entry's, NAME_LEN lowercase hex digits.
+ */
+static int is_entry(const char *name)
+{
+    int i;
+
+    for (i = 0; i < NAME_LEN; i++) {
+        if (!((name[i] >= '0' && name[i] <= '9')
+              || (name[i] >= 'a' && name[i] <= 'f'))) {
+            return 0;
+        }
+    }
+
+    return name[NAME_LEN] == '\0';
+}
+
+/*
+ * Order entries least recently used first.
+ */
+static int by_age(const void *a, const void *b)
+{
+    const struct entry *x = a;
+    const struct entry *y = b;
+
+    if (x->mtime.tv_sec != y->mtime.tv_sec) {
+        return (x->mtime.tv_sec < y->mtime.tv_sec) ? -1 : 1;
+    }
+    if (x->mtime.tv_nsec != y->mtime.tv_nsec) {
+        return (x->mtime.tv_nsec < y->mtime.tv_nsec) ? -1 : 1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+static int write_all(int fd, const char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+#endif /* _WIN32 */
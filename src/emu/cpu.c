@@ -21,15 +21,24 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <emu/lc3.h>
 #include <emu/cpu.h>
+#include <emu/machine.h>
 #include <emu/state.h>
 #include <emu/mem.h>
 #include <emu/kbd.h>
 #include <emu/disp.h>
 #include <emu/pic.h>
+#include <emu/sched.h>
+#include <emu/idle.h>
+#include <emu/jit.h>
+#include <emu/aot.h>
+#include <emu/simd.h>
+#include <emu/traps.h>
+#include <emu/prof.h>
 
 /******
  * TODO:
@@ -41,47 +50,44 @@
 /*
  * Instruction Register fields.
  */
-#define OPCODE()        ((cpu.ir & 0xF000) >> 12)
-#define DR()            ((cpu.ir & 0x0E00) >> 9)
-#define SR()            ((cpu.ir & 0x0E00) >> 9)
-#define SR1()           ((cpu.ir & 0x01C0) >> 6)
-#define SR2()           (cpu.ir & 0x0007)
-#define BASER()         ((cpu.ir & 0x01C0) >> 6)
-#define IMM4()          (cpu.ir & 0x000F)
-#define IMM5()          (cpu.ir & 0x001F)
-#define OFF6()          (cpu.ir & 0x003F)
-#define OFF9()          (cpu.ir & 0x01FF)
-#define OFF11()         (cpu.ir & 0x07FF)
-#define TRAPVECT()      (cpu.ir & 0x00FF)
-#define IR_N()          (cpu.ir & 0x0800)
-#define IR_Z()          (cpu.ir & 0x0400)
-#define IR_P()          (cpu.ir & 0x0200)
-#define IR_11()         (cpu.ir & 0x0800)   /* N; addressing type (JSR) */
-#define IR_10()         (cpu.ir & 0x0400)   /* Z */
-#define IR_9()          (cpu.ir & 0x0200)   /* P */
-#define IR_5()          (cpu.ir & 0x0020)   /* ALU operation (ADD/AND/XOR) */
-#define IR_4()          (cpu.ir & 0x0010)   /* direction (SHF) */
+#define OPCODE()        ((m->cpu.ir & 0xF000) >> 12)
+#define DR()            ((m->cpu.ir & 0x0E00) >> 9)
+#define SR()            ((m->cpu.ir & 0x0E00) >> 9)
+#define SR1()           ((m->cpu.ir & 0x01C0) >> 6)
+#define SR2()           (m->cpu.ir & 0x0007)
+#define BASER()         ((m->cpu.ir & 0x01C0) >> 6)
+#define IMM4()          (m->cpu.ir & 0x000F)
+#define IMM5()          (m->cpu.ir & 0x001F)
+#define OFF6()          (m->cpu.ir & 0x003F)
+#define OFF9()          (m->cpu.ir & 0x01FF)
+#define OFF11()         (m->cpu.ir & 0x07FF)
+#define TRAPVECT()      (m->cpu.ir & 0x00FF)
+#define IR_N()          (m->cpu.ir & 0x0800)
+#define IR_Z()          (m->cpu.ir & 0x0400)
+#define IR_P()          (m->cpu.ir & 0x0200)
+#define IR_11()         (m->cpu.ir & 0x0800)   /* N; addressing type (JSR) */
+#define IR_10()         (m->cpu.ir & 0x0400)   /* Z */
+#define IR_9()          (m->cpu.ir & 0x0200)   /* P */
+#define IR_5()          (m->cpu.ir & 0x0020)   /* ALU operation (ADD/AND/XOR) */
+#define IR_4()          (m->cpu.ir & 0x0010)   /* direction (SHF) */
 
 /*
  * Processor State Register fields.
  */
-#define PRIORITY()      (cpu.psr.priority)
-#define PRIVILEGE()     (cpu.psr.privilege)
-#define N()             (cpu.psr.n)
-#define Z()             (cpu.psr.z)
-#define P()             (cpu.psr.p)
+#define PRIORITY()      (m->cpu.psr.priority)
+#define PRIVILEGE()     (m->cpu.psr.privilege)
+#define N()             ((cpu_psr(&m->cpu) >> 2) & 1)
+#define Z()             ((cpu_psr(&m->cpu) >> 1) & 1)
+#define P()             (cpu_psr(&m->cpu) & 1)
 
-#define SET_PRIORITY(x) (cpu.psr.priority = x)
-#define SET_PRIVILEGE(x)(cpu.psr.privilege = x)
-#define SET_N(x)        (cpu.psr.n = x)
-#define SET_Z(x)        (cpu.psr.z = x)
-#define SET_P(x)        (cpu.psr.p = x)
+#define SET_PRIORITY(x) (m->cpu.psr.priority = x)
+#define SET_PRIVILEGE(x)(m->cpu.psr.privilege = x)
 
 /*
  * Machine Control Register fields.
  */
-#define CE()        (cpu.mcr & MCR_CE)
-#define SET_CE(x)   (cpu.mcr = (x)?(cpu.mcr|MCR_CE):(cpu.mcr&~MCR_CE))
+#define CE()        (m->cpu.mcr & MCR_CE)
+#define SET_CE(x)   (m->cpu.mcr = (x)?(m->cpu.mcr|MCR_CE):(m->cpu.mcr&~MCR_CE))
 
 /*
  * Microsequencer conditional values.
@@ -103,44 +109,107 @@
 #define STATE_MASK_PRIV 0x08
 #define STATE_MASK_INT  0x10
 
-#define INITIAL_STATE   18
+/*
+ * Control store.
+ * Each entry is X(ird, cond, j): take the next state from the IR, the next
+ * state condition, and the next state number.
+ * Unused states: 26, 46, 53, 55, 57, 61, 63
+ */
+#define CTL_ROM(X) \
+/* 0-3   */ X(0, COND_BR,   18) X(0, COND_NONE, 18) X(0, COND_NONE, 29) X(0, COND_NONE, 24) \
+/* 4-7   */ X(0, COND_ADDR, 20) X(0, COND_NONE, 18) X(0, COND_NONE, 25) X(0, COND_NONE, 23) \
+/* 8-11  */ X(0, COND_PRIV, 36) X(0, COND_NONE, 18) X(0, COND_NONE, 56) X(0, COND_NONE, 60) \
+/* 12-15 */ X(0, COND_NONE, 18) X(0, COND_NONE, 18) X(0, COND_NONE, 18) X(0, COND_NONE, 28) \
+/* 16-19 */ X(0, COND_MEM,  16) X(0, COND_MEM,  17) X(0, COND_INT,  33) X(0, COND_INT,  33) \
+/* 20-23 */ X(0, COND_NONE, 18) X(0, COND_NONE, 18) X(0, COND_NONE, 18) X(0, COND_NONE, 16) \
+/* 24-27 */ X(0, COND_NONE, 17) X(0, COND_MEM,  25) X(0, COND_NONE, 00) X(0, COND_NONE, 18) \
+/* 28-31 */ X(0, COND_MEM,  28) X(0, COND_MEM,  29) X(0, COND_NONE, 18) X(0, COND_NONE, 18) \
+/* 32-35 */ X(1, COND_NONE, 00) X(0, COND_MEM,  33) X(0, COND_PRIV, 51) X(0, COND_NONE, 32) \
+/* 36-39 */ X(0, COND_MEM,  36) X(0, COND_NONE, 41) X(0, COND_NONE, 39) X(0, COND_NONE, 40) \
+/* 40-43 */ X(0, COND_MEM,  40) X(0, COND_MEM,  41) X(0, COND_NONE, 34) X(0, COND_NONE, 47) \
+/* 44-47 */ X(0, COND_NONE, 45) X(0, COND_NONE, 37) X(0, COND_NONE, 00) X(0, COND_NONE, 48) \
+/* 48-51 */ X(0, COND_MEM,  48) X(0, COND_PRIV, 37) X(0, COND_NONE, 52) X(0, COND_NONE, 18) \
+/* 52-55 */ X(0, COND_MEM,  52) X(0, COND_NONE, 00) X(0, COND_NONE, 18) X(0, COND_NONE, 00) \
+/* 56-59 */ X(0, COND_MEM,  56) X(0, COND_NONE, 00) X(0, COND_NONE, 25) X(0, COND_NONE, 18) \
+/* 60-63 */ X(0, COND_MEM,  60) X(0, COND_NONE, 00) X(0, COND_NONE, 23) X(0, COND_NONE, 00)
+
+/*
+ * Microsequencer condition vector.
+ * All conditions are sampled into a single vector, laid out like the next-state
+ * masks, which is used to index the next-state table.
+ */
+#define COND_VECTORS    32
+#define COND_ALL        (COND_VECTORS - 1)
+
+#define COND_MASK(cond)                         \
+    ((cond) == COND_MEM  ? STATE_MASK_MEM  :    \
+     (cond) == COND_BR   ? STATE_MASK_BR   :    \
+     (cond) == COND_ADDR ? STATE_MASK_ADDR :    \
+     (cond) == COND_PRIV ? STATE_MASK_PRIV :    \
+     (cond) == COND_INT  ? STATE_MASK_INT  : 0)
+
+/*
+ * Next-state table entries.
+ * An entry is either a state number or NEXT_IRD, which selects the state
+ * numbered by the opcode in IR.
+ */
+#define NEXT_IRD        0x40
+
+#define NEXT(ird,cond,j,v)                      \
+    ((ird) ? NEXT_IRD : ((j) | ((v) & COND_MASK(cond))))
+#define NEXT4(ird,cond,j,v)                     \
+    NEXT(ird,cond,j,(v)),     NEXT(ird,cond,j,(v)+1),   \
+    NEXT(ird,cond,j,(v)+2),   NEXT(ird,cond,j,(v)+3)
+#define NEXT16(ird,cond,j,v)                    \
+    NEXT4(ird,cond,j,(v)),    NEXT4(ird,cond,j,(v)+4),  \
+    NEXT4(ird,cond,j,(v)+8),  NEXT4(ird,cond,j,(v)+12)
+#define NEXT_ROW(ird,cond,j)                    \
+    { NEXT16(ird,cond,j,0), NEXT16(ird,cond,j,16) },
+#define COND_ENTRY(ird,cond,j)                  \
+    COND_MASK(cond),
 
 /*
- * Microsequencer control state.
+ * Next-state table, indexed by current state and condition vector.
+ * Expanded from the control store at compile time.
  */
-struct micro_op {
-    uint16_t ird    : 1;    /* 1 = get next state form IR*/
-    uint16_t cond   : 3;    /* next state conditional flags */
-    uint16_t j      : 6;    /* next state number */
+static const uint8_t next_table[][COND_VECTORS] = {
+    CTL_ROM(NEXT_ROW)
 };
 
 /*
- * Next state table.
- * Unused states: 26, 46, 53, 55, 57, 61, 63
+ * Conditions tested by each state, as a mask over the condition vector.
  */
-static const struct micro_op ctl_rom[] = {
-/*  0-3  */ { 0, COND_BR,   18 },   { 0, COND_NONE, 18 },   { 0, COND_NONE, 29 },   { 0, COND_NONE, 24 },
-/*  4-7  */ { 0, COND_ADDR, 20 },   { 0, COND_NONE, 18 },   { 0, COND_NONE, 25 },   { 0, COND_NONE, 23 },
-/*  8-11 */ { 0, COND_PRIV, 36 },   { 0, COND_NONE, 18 },   { 0, COND_NONE, 56 },   { 0, COND_NONE, 60 },
-/* 12-15 */ { 0, COND_NONE, 18 },   { 0, COND_NONE, 18 },   { 0, COND_NONE, 18 },   { 0, COND_NONE, 28 },
-/* 16-19 */ { 0, COND_MEM,  16 },   { 0, COND_MEM,  17 },   { 0, COND_INT,  33 },   { 0, COND_INT,  33 },
-/* 20-23 */ { 0, COND_NONE, 18 },   { 0, COND_NONE, 18 },   { 0, COND_NONE, 18 },   { 0, COND_NONE, 16 },
-/* 24-27 */ { 0, COND_NONE, 17 },   { 0, COND_MEM,  25 },   { 0, COND_NONE, 00 },   { 0, COND_NONE, 18 },
-/* 28-31 */ { 0, COND_MEM,  28 },   { 0, COND_MEM,  29 },   { 0, COND_NONE, 18 },   { 0, COND_NONE, 18 },
-/* 32-35 */ { 1, COND_NONE, 00 },   { 0, COND_MEM,  33 },   { 0, COND_PRIV, 51 },   { 0, COND_NONE, 32 },
-/* 36-39 */ { 0, COND_MEM,  36 },   { 0, COND_NONE, 41 },   { 0, COND_NONE, 39 },   { 0, COND_NONE, 40 },
-/* 40-43 */ { 0, COND_MEM,  40 },   { 0, COND_MEM,  41 },   { 0, COND_NONE, 34 },   { 0, COND_NONE, 47 },
-/* 44-47 */ { 0, COND_NONE, 45 },   { 0, COND_NONE, 37 },   { 0, COND_NONE, 00 },   { 0, COND_NONE, 48 },
-/* 48-51 */ { 0, COND_MEM,  48 },   { 0, COND_PRIV, 37 },   { 0, COND_NONE, 52 },   { 0, COND_NONE, 18 },
-/* 52-55 */ { 0, COND_MEM,  52 },   { 0, COND_NONE, 00 },   { 0, COND_NONE, 18 },   { 0, COND_NONE, 00 },
-/* 56-59 */ { 0, COND_MEM,  56 },   { 0, COND_NONE, 00 },   { 0, COND_NONE, 25 },   { 0, COND_NONE, 18 },
-/* 60-63 */ { 0, COND_MEM,  60 },   { 0, COND_NONE, 00 },   { 0, COND_NONE, 23 },   { 0, COND_NONE, 00 }
+static const uint8_t cond_table[] = {
+    CTL_ROM(COND_ENTRY)
 };
 
 /*
  * State function pointer type.
  */
-typedef void (*state_fn)(void);
+typedef void (*state_fn)(struct lc3machine *m);
+
+struct decoded;
+
+/*
+ * Instruction-level engine function pointer type.
+ * Returns the number of clock cycles taken, or 0 if the instruction must be
+ * handed back to the microcode.
+ */
+typedef int (*op_fn)(struct lc3machine *m, const struct decoded *d);
+
+/*
+ * Predecoded instruction.
+ * Fields are extracted and offsets sign-extended (and scaled to bytes, where
+ * the instruction calls for it) once, when the instruction is first fetched.
+ */
+struct decoded {
+    op_fn    fn;    /* handler; NULL if the entry is not valid */
+    lc3word  ir;    /* instruction word */
+    lc3sword imm;   /* immediate, offset or trap vector address */
+    uint8_t  a;     /* DR or SR (n/z/p mask for BR) */
+    uint8_t  b;     /* SR1 or BaseR */
+    uint8_t  c;     /* SR2 (shift amount for SHF) */
+};
 
 /*
  * State function pointer table.
@@ -164,65 +233,312 @@ static const state_fn state_table[] = {
     state_60, state_61, state_62, state_63
 };
 
-static inline lc3word reg_r(int n);
-static inline void reg_w(int n, lc3word data);
-static inline int next_state(void);
-static inline void setcc(void);
+static inline lc3word reg_r(struct lc3machine *m, int n);
+static inline void reg_w(struct lc3machine *m, int n, lc3word data);
+static inline int next_state(struct lc3machine *m);
+static inline unsigned int sample_conds(struct lc3machine *m,
+                                        unsigned int mask);
+static inline int next_from(struct lc3machine *m, uint8_t next);
+static inline void dev_advance(struct lc3machine *m, int n);
+static inline uint64_t idle_check(struct lc3machine *m, uint64_t budget);
+static inline int trap_check(struct lc3machine *m);
+static uint64_t run_micro(struct lc3machine *m, uint64_t max);
+static uint64_t run_prof(struct lc3machine *m, uint64_t max);
+static uint64_t run_fast(struct lc3machine *m, uint64_t max);
+static uint64_t run_blocks(struct lc3machine *m,
+                           int (*exec)(struct lc3machine *, uint64_t),
+                           uint64_t max);
+static inline void setcc(struct lc3machine *m);
+static lc3word mcr_read(struct lc3machine *m, lc3word addr);
+static void mcr_write(struct lc3machine *m, lc3word addr, lc3word data,
+                      lc3word wmask);
 static inline lc3sword sign_extend(lc3word val, int pos);
 
-/*
- * CPU instance.
- */
-static struct lc3cpu cpu;
+static inline void update_cc(struct lc3machine *m, lc3word val);
+static void decode(struct decoded *d, lc3word ir);
+
+static int op_br(struct lc3machine *m, const struct decoded *d);
+static int op_add(struct lc3machine *m, const struct decoded *d);
+static int op_addi(struct lc3machine *m, const struct decoded *d);
+static int op_ldb(struct lc3machine *m, const struct decoded *d);
+static int op_stb(struct lc3machine *m, const struct decoded *d);
+static int op_jsr(struct lc3machine *m, const struct decoded *d);
+static int op_jsrr(struct lc3machine *m, const struct decoded *d);
+static int op_and(struct lc3machine *m, const struct decoded *d);
+static int op_andi(struct lc3machine *m, const struct decoded *d);
+static int op_ldw(struct lc3machine *m, const struct decoded *d);
+static int op_stw(struct lc3machine *m, const struct decoded *d);
+static int op_rti(struct lc3machine *m, const struct decoded *d);
+static int op_xor(struct lc3machine *m, const struct decoded *d);
+static int op_xori(struct lc3machine *m, const struct decoded *d);
+static int op_ldi(struct lc3machine *m, const struct decoded *d);
+static int op_sti(struct lc3machine *m, const struct decoded *d);
+static int op_jmp(struct lc3machine *m, const struct decoded *d);
+static int op_lshf(struct lc3machine *m, const struct decoded *d);
+static int op_rshfl(struct lc3machine *m, const struct decoded *d);
+static int op_rshfa(struct lc3machine *m, const struct decoded *d);
+static int op_lea(struct lc3machine *m, const struct decoded *d);
+static int op_trap(struct lc3machine *m, const struct decoded *d);
 
 /* ===== Public Functions ===== */
 
-void cpu_reset(void)
+int cpu_init(struct lc3machine *m)
+{
+    return mem_map_io(m, A_MCR, mcr_read, mcr_write);
+}
+
+void cpu_reset(struct lc3machine *m)
 {
-    memset(&cpu, 0, sizeof(struct lc3cpu));
+    memset(&m->cpu, 0, sizeof(struct lc3cpu));
 
-    cpu.state = INITIAL_STATE;
-    cpu.pc = A_START;
-    reg_w(R_6, A_SSP);
-    SET_Z(1);
+    /* Predecoded instruction cache, indexed by word address. It stays valid
+       across resets, since memory does. */
+    if (m->dcache == NULL) {
+        m->dcache = calloc(MEM_DEPTH, sizeof(struct decoded));
+    }
+
+    m->cpu.state = INITIAL_STATE;
+    m->cpu.pc = A_START;
+    reg_w(m, R_6, A_SSP);
+    update_cc(m, 0);
     SET_CE(1);
 }
 
-void cpu_tick(void)
+void cpu_tick(struct lc3machine *m)
 {
     /* Execute current state operation and determine next state. */
-    state_table[cpu.state]();
-    cpu.state = next_state();
+    state_table[m->cpu.state](m);
+    m->cpu.state = next_state(m);
+    m->cpu.cycles++;
+}
+
+int cpu_step(struct lc3machine *m)
+{
+    struct decoded *d;
+    lc3word pc;
+    lc3word ir;
+    int n;
+
+    pc = m->cpu.pc;
+    if (m->cpu.state == INITIAL_STATE && !m->cpu.intf && !IS_IO(pc)
+        && m->dcache != NULL) {
+        /* Decode on first use */
+        d = &m->dcache[pc >> 1];
+        if (d->fn == NULL) {
+            mem_read_nodelay(m, &ir, pc);
+            decode(d, ir);
+        }
+
+        /* Fetch (states 18, 33, 35) */
+        m->cpu.mar = pc;
+        m->cpu.pc = pc + 2;
+        m->cpu.mdr = d->ir;
+        m->cpu.ir = d->ir;
+
+        /* Execute */
+        n = d->fn(m, d);
+        if (n > 0) {
+            m->cpu.cycles += n;
+            return n;
+        }
+
+        /* Not ours; rewind and let the microcode take it from the top */
+        m->cpu.pc = pc;
+    }
+
+    cpu_tick(m);
+    return 1;
+}
+
+int cpu_cost(lc3word ir)
+{
+    switch (ir >> 12) {
+        case OP_BR:
+            return CYC_BR + 1;
+        case OP_ADD:
+        case OP_AND:
+        case OP_XOR:
+        case OP_SHF:
+        case OP_LEA:
+            return CYC_ALU;
+        case OP_LDB:
+            return CYC_LDB;
+        case OP_STB:
+            return CYC_STB;
+        case OP_LDW:
+            return CYC_LDW;
+        case OP_STW:
+            return CYC_STW;
+        case OP_LDI:
+            return CYC_LDI;
+        case OP_STI:
+            return CYC_STI;
+        case OP_JSR:
+            return CYC_JSR;
+        case OP_JMP:
+            return CYC_JMP;
+        case OP_TRAP:
+            return CYC_TRAP;
+    }
+
+    return 0;
+}
+
+uint64_t cpu_run(struct lc3machine *m, enum lc3engine engine, uint64_t max)
+{
+    uint64_t count;
+
+    if (max == 0 || !CE()) {
+        return 0;
+    }
+
+    /* Profiled machines all take the instrumented microcode */
+    if (m->prof != NULL) {
+        return run_prof(m, max);
+    }
+    if (engine == ENGINE_FAST) {
+        return run_fast(m, max);
+    }
+    if (engine == ENGINE_JIT) {
+        return run_blocks(m, jit_exec, max);
+    }
+    if (engine == ENGINE_AOT) {
+        return run_blocks(m, aot_exec, max);
+    }
+    if (engine == ENGINE_SIMD) {
+        simd_run(&m, &max, &count, 1);
+        return count;
+    }
+
+    return run_micro(m, max);
 }
 
-int cpu_intf(void)
+int cpu_intf(struct lc3machine *m)
 {
-    return cpu.intf;
+    return m->cpu.intf;
 }
 
-int cpu_prio(void)
+int cpu_prio(struct lc3machine *m)
 {
     return PRIORITY();
 }
 
-void cpu_interrupt(lc3byte vec, lc3byte prio)
+void cpu_interrupt(struct lc3machine *m, lc3byte vec, lc3byte prio)
+{
+    m->cpu.intf = 1;
+    m->cpu.intv = vec;
+    m->cpu.intp = prio;
+}
+
+void cpu_invalidate(struct lc3machine *m, lc3word addr)
+{
+    if (m->dcache != NULL) {
+        m->dcache[addr >> 1].fn = NULL;
+    }
+    jit_invalidate(m, addr);
+    aot_invalidate(m, addr);
+}
+
+lc3word cpu_getreg(struct lc3machine *m, enum lc3reg reg)
+{
+    switch (reg) {
+        case R_0: case R_1: case R_2: case R_3:
+        case R_4: case R_5: case R_6: case R_7:
+            return reg_r(m, reg);
+        case R_PC:
+            return m->cpu.pc;
+        case R_IR:
+            return m->cpu.ir;
+        case R_MAR:
+            return m->cpu.mar;
+        case R_MDR:
+            return m->cpu.mdr;
+        case R_SSP:
+            return m->cpu.saved_ssp;
+        case R_USP:
+            return m->cpu.saved_usp;
+        case R_PSR:
+            return cpu_psr(&m->cpu);
+        case R_KBSR:
+            return get_kbsr(m);
+        case R_KBDR:
+            return get_kbdr(m);
+        case R_DSR:
+            return get_dsr(m);
+        case R_DDR:
+            return get_ddr(m);
+        case R_MCR:
+            return get_mcr(m);
+        default:
+            return 0;
+    }
+}
+
+void cpu_setreg(struct lc3machine *m, enum lc3reg reg, lc3word value)
+{
+    switch (reg) {
+        case R_0: case R_1: case R_2: case R_3:
+        case R_4: case R_5: case R_6: case R_7:
+            reg_w(m, reg, value);
+            break;
+        case R_PC:
+            m->cpu.pc = value;
+            break;
+        case R_IR:
+            m->cpu.ir = value;
+            break;
+        case R_MAR:
+            m->cpu.mar = value;
+            break;
+        case R_MDR:
+            m->cpu.mdr = value;
+            break;
+        case R_SSP:
+            m->cpu.saved_ssp = value;
+            break;
+        case R_USP:
+            m->cpu.saved_usp = value;
+            break;
+        case R_PSR:
+            cpu_setpsr(&m->cpu, value);
+            pic_poll(m);
+            break;
+        case R_KBSR:
+            set_kbsr(m, value);
+            break;
+        case R_KBDR:
+            set_kbdr(m, value);
+            break;
+        case R_DSR:
+            set_dsr(m, value);
+            break;
+        case R_DDR:
+            set_ddr(m, value);
+            break;
+        case R_MCR:
+            set_mcr(m, value);
+            break;
+        default:
+            break;
+    }
+}
+
+void cpu_dumpregs(struct lc3machine *m)
 {
-    cpu.intf = 1;
-    cpu.intv = vec;
-    cpu.intp = prio;
+    cpu_fdumpregs(m, stdout);
 }
 
-void cpu_dumpregs(void)
+void cpu_fdumpregs(struct lc3machine *m, FILE *f)
 {
-    printf("  R0 = 0x%04X   R1 = 0x%04X   R2 = 0x%04X   R3 = 0x%04X\r\n", reg_r(0), reg_r(1), reg_r(2), reg_r(3));
-    printf("  R4 = 0x%04X   R5 = 0x%04X   R6 = 0x%04X   R7 = 0x%04X\r\n", reg_r(4), reg_r(5), reg_r(6), reg_r(7));
-    printf("  PC = 0x%04X   IR = 0x%04X  MAR = 0x%04X  MDR = 0x%04X\r\n", cpu.pc, cpu.ir, cpu.mar, cpu.mdr);
-    printf(" SSP = 0x%04X  USP = 0x%04X\r\n", cpu.saved_ssp, cpu.saved_usp);
-    printf(" PSR = 0x%04X { priv = %d, prio = %d, n = %d, z = %d, p = %d }\r\n", cpu.psr.value, PRIVILEGE(), PRIORITY(), N(), Z(), P());
-    printf("INTV = 0x%02X INTP = 0x%02X INTF = %d\r\n", cpu.intv, cpu.intp, cpu.intf);
-    printf(" IRR = 0x%04X  IMR = 0x%04X  ISR = 0x%04X ICCR = 0x%04X ICDR = 0x%04X\r\n", get_irr(), get_imr(), get_isr(), get_iccr(), get_icdr());
-    printf("KBSR = 0x%04X KBDR = 0x%04X  DSR = 0x%04X  DDR = 0x%04X  MCR = 0X%04X\r\n", get_kbsr(), get_kbdr(), get_dsr(), get_ddr(), get_mcr());
-    printf("State = %d\r\n", cpu.state);
+    fprintf(f, "  R0 = 0x%04X   R1 = 0x%04X   R2 = 0x%04X   R3 = 0x%04X\r\n", reg_r(m, 0), reg_r(m, 1), reg_r(m, 2), reg_r(m, 3));
+    fprintf(f, "  R4 = 0x%04X   R5 = 0x%04X   R6 = 0x%04X   R7 = 0x%04X\r\n", reg_r(m, 4), reg_r(m, 5), reg_r(m, 6), reg_r(m, 7));
+    fprintf(f, "  PC = 0x%04X   IR = 0x%04X  MAR = 0x%04X  MDR = 0x%04X\r\n", m->cpu.pc, m->cpu.ir, m->cpu.mar, m->cpu.mdr);
+    fprintf(f, " SSP = 0x%04X  USP = 0x%04X\r\n", m->cpu.saved_ssp, m->cpu.saved_usp);
+    fprintf(f, " PSR = 0x%04X { priv = %d, prio = %d, n = %d, z = %d, p = %d }\r\n", cpu_psr(&m->cpu), PRIVILEGE(), PRIORITY(), N(), Z(), P());
+    fprintf(f, "INTV = 0x%02X INTP = 0x%02X INTF = %d\r\n", m->cpu.intv, m->cpu.intp, m->cpu.intf);
+    fprintf(f, " IRR = 0x%04X  IMR = 0x%04X  ISR = 0x%04X ICCR = 0x%04X ICDR = 0x%04X\r\n", get_irr(m), get_imr(m), get_isr(m), get_iccr(m), get_icdr(m));
+    fprintf(f, "KBSR = 0x%04X KBDR = 0x%04X  DSR = 0x%04X  DDR = 0x%04X  MCR = 0X%04X\r\n", get_kbsr(m), get_kbdr(m), get_dsr(m), get_ddr(m), get_mcr(m));
+    fprintf(f, "State = %d  Cycles = %llu\r\n", m->cpu.state, (unsigned long long) m->cpu.cycles);
 }
 
 /*
@@ -230,9 +546,9 @@ void cpu_dumpregs(void)
  *
  * @return      current value in MCR
  */
-lc3word get_mcr(void)
+lc3word get_mcr(struct lc3machine *m)
 {
-    return cpu.mcr;
+    return m->cpu.mcr;
 }
 
 /*
@@ -240,9 +556,14 @@ lc3word get_mcr(void)
  *
  * @param value the value to put in MCR
  */
-void set_mcr(lc3word value)
+void set_mcr(struct lc3machine *m, lc3word value)
 {
-    cpu.mcr = value;
+    m->cpu.mcr = value;
+
+    /* The program has halted; make sure all its output is seen */
+    if (!CE() && m->io.flush != NULL) {
+        m->io.flush(m->io.ctx);
+    }
 }
 
 /* ===== Private Helper Functions ===== */
@@ -250,64 +571,369 @@ void set_mcr(lc3word value)
 /*
  * Read a word from a general-purpose register.
  */
-static inline lc3word reg_r(int n)
+static inline lc3word reg_r(struct lc3machine *m, int n)
 {
-    return cpu.r[n & 0x07];
+    return m->cpu.r[n & 0x07];
 }
 
 /*
  * Write a word to a general-purpose register.
  */
-static inline void reg_w(int n, lc3word data)
+static inline void reg_w(struct lc3machine *m, int n, lc3word data)
 {
-    cpu.r[n & 0x07] = data;
+    m->cpu.r[n & 0x07] = data;
 }
 
 /*
  * Compute the next CPU state.
  */
-inline int next_state(void)
+static inline int next_state(struct lc3machine *m)
+{
+    return next_from(m, next_table[m->cpu.state][sample_conds(m, COND_ALL)]);
+}
+
+/*
+ * Sample the microsequencer conditions selected by a mask into a condition
+ * vector. When the mask is a constant, the untested conditions fold away.
+ */
+static inline unsigned int sample_conds(struct lc3machine *m,
+                                        unsigned int mask)
 {
-    struct micro_op m_op;
-    int next_state;
+    unsigned int v;
 
-    m_op = ctl_rom[cpu.state];
-    if (m_op.ird) {
-        return OPCODE();
+    v = 0;
+    if (mask & STATE_MASK_ADDR) {
+        v |= IR_11() ? STATE_MASK_ADDR : 0;
     }
+    if (mask & STATE_MASK_MEM) {
+        v |= mem_ready(m) ? STATE_MASK_MEM : 0;
+    }
+    if (mask & STATE_MASK_BR) {
+        v |= m->cpu.ben ? STATE_MASK_BR : 0;
+    }
+    if (mask & STATE_MASK_PRIV) {
+        v |= PRIVILEGE() ? STATE_MASK_PRIV : 0;
+    }
+    if (mask & STATE_MASK_INT) {
+        v |= m->cpu.intf ? STATE_MASK_INT : 0;
+    }
+
+    return v;
+}
+
+/*
+ * Resolve a next-state table entry to a state number.
+ */
+static inline int next_from(struct lc3machine *m, uint8_t next)
+{
+    return (next & ~NEXT_IRD) | (OPCODE() & -((next & NEXT_IRD) != 0));
+}
 
-    next_state = m_op.j;
-    if (m_op.cond == COND_MEM && mem_ready()) {
-        next_state |= STATE_MASK_MEM;
+/*
+ * Advance the device clock. The scheduler is only entered when an event
+ * falls due.
+ */
+static inline void dev_advance(struct lc3machine *m, int n)
+{
+    if (m->sched.now + n < m->sched.next) {
+        m->sched.now += n;
+    }
+    else {
+        sched_advance(m, n);
     }
-    if (m_op.cond == COND_BR && cpu.ben) {
-        next_state |= STATE_MASK_BR;
+}
+
+/*
+ * Skip ahead if the machine is idle, at an instruction boundary. Only a
+ * backward transfer (to a PC no higher than the last boundary's) can close a
+ * loop, so anything else costs a compare.
+ *
+ * @param budget    the cycles the engine may still run
+ * @return          the number of cycles skipped
+ */
+static inline uint64_t idle_check(struct lc3machine *m, uint64_t budget)
+{
+    lc3word last;
+
+    if (!IS_FETCH(m->cpu.state)) {
+        return 0;
     }
-    if (m_op.cond == COND_ADDR && IR_11()) {
-        next_state |= STATE_MASK_ADDR;
+
+    last = m->idle.last;
+    m->idle.last = m->cpu.pc;
+    if (m->cpu.pc > last) {
+        return 0;
     }
-    if (m_op.cond == COND_PRIV && PRIVILEGE()) {
-        next_state |= STATE_MASK_PRIV;
+
+    return idle_skip(m, budget);
+}
+
+/*
+ * Service a TRAP natively on reaching state 15, where the microcode has
+ * fetched and decoded it.
+ *
+ * @return          the cycles left to charge for the TRAP
+ *                  0 if the microcode should run it
+ */
+static inline int trap_check(struct lc3machine *m)
+{
+    int n;
+
+    if (m->traps == NULL || (n = traps_exec(m, TRAPVECT())) == 0) {
+        return 0;
     }
-    if (m_op.cond == COND_INT && cpu.intf) {
-        next_state |= STATE_MASK_INT;
+
+    return n - FETCH_CYCLES;
+}
+
+/*
+ * Run the microcoded engine.
+ *
+ * Each state is expanded in place so that it can be inlined, and jumps straight
+ * to the next one (threaded dispatch) when the compiler supports computed goto.
+ * Otherwise, every state returns to a single switch.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define THREADED_DISPATCH
+#endif
+
+#ifdef THREADED_DISPATCH
+#define LABEL(n)        S##n:
+#define DISPATCH()      goto *dispatch_table[m->cpu.state]
+#else
+#define LABEL(n)        case 1##n - 100:
+#define DISPATCH()      goto dispatch
+#endif
+
+#define EXEC(n)                                                 \
+    LABEL(n)                                                    \
+        if (IS_FETCH(1##n - 100)) {                             \
+            count += idle_check(m, max - count);                \
+        }                                                       \
+        if (1##n - 100 == 15 && (k = trap_check(m)) > 0) {      \
+            dev_advance(m, k);                                  \
+            m->cpu.state = INITIAL_STATE;                       \
+            count += k;                                         \
+            if (count >= max || !CE()) {                        \
+                goto done;                                      \
+            }                                                   \
+            DISPATCH();                                         \
+        }                                                       \
+        dev_advance(m, 1);                                      \
+        state_##n(m);                                           \
+        m->cpu.state = next_from(m,                                   \
+            next_table[1##n - 100][sample_conds(m, cond_table[1##n - 100])]); \
+        if (++count == max || !CE()) {                          \
+            goto done;                                          \
+        }                                                       \
+        DISPATCH();
+
+static uint64_t run_micro(struct lc3machine *m, uint64_t max)
+{
+#ifdef THREADED_DISPATCH
+    static void * const dispatch_table[] = {
+        &&S00, &&S01, &&S02, &&S03, &&S04, &&S05, &&S06, &&S07,
+        &&S08, &&S09, &&S10, &&S11, &&S12, &&S13, &&S14, &&S15,
+        &&S16, &&S17, &&S18, &&S19, &&S20, &&S21, &&S22, &&S23,
+        &&S24, &&S25, &&S26, &&S27, &&S28, &&S29, &&S30, &&S31,
+        &&S32, &&S33, &&S34, &&S35, &&S36, &&S37, &&S38, &&S39,
+        &&S40, &&S41, &&S42, &&S43, &&S44, &&S45, &&S46, &&S47,
+        &&S48, &&S49, &&S50, &&S51, &&S52, &&S53, &&S54, &&S55,
+        &&S56, &&S57, &&S58, &&S59, &&S60, &&S61, &&S62, &&S63
+    };
+#endif
+    uint64_t count;
+    int k;
+
+    count = 0;
+    DISPATCH();
+
+#ifndef THREADED_DISPATCH
+dispatch:
+    switch (m->cpu.state) {
+#endif
+    EXEC(00) EXEC(01) EXEC(02) EXEC(03) EXEC(04) EXEC(05) EXEC(06) EXEC(07)
+    EXEC(08) EXEC(09) EXEC(10) EXEC(11) EXEC(12) EXEC(13) EXEC(14) EXEC(15)
+    EXEC(16) EXEC(17) EXEC(18) EXEC(19) EXEC(20) EXEC(21) EXEC(22) EXEC(23)
+    EXEC(24) EXEC(25) EXEC(26) EXEC(27) EXEC(28) EXEC(29) EXEC(30) EXEC(31)
+    EXEC(32) EXEC(33) EXEC(34) EXEC(35) EXEC(36) EXEC(37) EXEC(38) EXEC(39)
+    EXEC(40) EXEC(41) EXEC(42) EXEC(43) EXEC(44) EXEC(45) EXEC(46) EXEC(47)
+    EXEC(48) EXEC(49) EXEC(50) EXEC(51) EXEC(52) EXEC(53) EXEC(54) EXEC(55)
+    EXEC(56) EXEC(57) EXEC(58) EXEC(59) EXEC(60) EXEC(61) EXEC(62) EXEC(63)
+#ifndef THREADED_DISPATCH
     }
+#endif
+
+done:
+    m->cpu.cycles += count;
+    return count;
+}
+
+#undef EXEC
+#undef DISPATCH
+#undef LABEL
+
+/*
+ * Run the microcoded engine one state at a time, charging each cycle to the
+ * instruction and calling context it is spent in. States are run as in
+ * run_micro(), and calls and returns are picked out by the state that moves
+ * the PC: 20 and 21 (JSRR, JSR), 30 (TRAP) and 54 (interrupt) enter a
+ * function, 12 with BaseR = R7 (RET) and 38 (RTI) leave one.
+ */
+static uint64_t run_prof(struct lc3machine *m, uint64_t max)
+{
+    struct lc3prof *p;
+    uint64_t count;
+    uint64_t skip;
+    lc3word pc;
+    int state;
+    int k;
+
+    p = m->prof;
+    count = 0;
+    do {
+        state = m->cpu.state;
+        pc = m->cpu.pc;
+        if (IS_FETCH(state)) {
+            prof_fetch(p, pc);
+            skip = idle_check(m, max - count);
+            count += skip;
+            m->cpu.cycles += skip;
+            prof_charge(p, skip);
+        }
+        if (state == 15 && (k = trap_check(m)) > 0) {
+            dev_advance(m, k);
+            m->cpu.state = INITIAL_STATE;
+            m->cpu.cycles += k;
+            count += k;
+            prof_charge(p, k);
+            continue;
+        }
+
+        dev_advance(m, 1);
+        state_table[state](m);
+        m->cpu.state = next_state(m);
+        m->cpu.cycles++;
+        count++;
+        prof_charge(p, 1);
+
+        switch (state) {
+        case 32:
+            prof_insn(p);
+            break;
+        case 20:
+        case 21:
+        case 30:
+            prof_call(p, m->cpu.pc, reg_r(m, R_7));
+            break;
+        case 54:
+            /* The interrupted instruction had been fetched */
+            prof_call(p, m->cpu.pc, pc - 2);
+            break;
+        case 12:
+            if (BASER() == R_7) {
+                prof_return(p, m->cpu.pc);
+            }
+            break;
+        case 38:
+            prof_return(p, m->cpu.pc);
+            break;
+        }
+    } while (count < max && CE());
+
+    return count;
+}
+
+/*
+ * Run the instruction-level engine.
+ */
+static uint64_t run_fast(struct lc3machine *m, uint64_t max)
+{
+    uint64_t count;
+    uint64_t skip;
+    int n;
+
+    count = 0;
+    do {
+        skip = idle_check(m, max - count);
+        count += skip;
+        m->cpu.cycles += skip;
+        dev_advance(m, 1);
+        n = cpu_step(m);
+        count += n;
+        dev_advance(m, n - 1);
+    } while (count < max && CE());
+
+    return count;
+}
+
+/*
+ * Run translated blocks, falling back to the instruction-level engine for
+ * code without a translation and anything the translator leaves to the
+ * interpreter.
+ *
+ * Devices stand still while a block runs, so a block is only entered if its
+ * worst case fits in the budget and ends before the next device event could
+ * be seen by any but its last instruction. The machine then stops, and takes
+ * interrupts, on the same instruction boundaries as under cpu_step().
+ *
+ * @param exec  runs the block at the PC if it takes no more than the given
+ *              number of cycles, returning its cycle count or 0
+ */
+static uint64_t run_blocks(struct lc3machine *m,
+                           int (*exec)(struct lc3machine *, uint64_t),
+                           uint64_t max)
+{
+    uint64_t count;
+    uint64_t skip;
+    uint64_t room;
+    int n;
+
+    count = 0;
+    do {
+        skip = idle_check(m, max - count);
+        count += skip;
+        m->cpu.cycles += skip;
+        dev_advance(m, 1);
+        n = 0;
+        if (m->cpu.state == INITIAL_STATE && !m->cpu.intf) {
+            /* Translated code keeps the condition codes in the PSR */
+            cpu_setpsr(&m->cpu, cpu_psr(&m->cpu));
+            room = max - count;
+            if (m->sched.next - m->sched.now < room - 1) {
+                room = m->sched.next - m->sched.now + 1;
+            }
+            n = exec(m, room);
+            m->cpu.cycles += n;
+        }
+        if (n == 0) {
+            n = cpu_step(m);
+        }
+        count += n;
+        dev_advance(m, n - 1);
+    } while (count < max && CE());
 
-    return next_state;
+    return count;
 }
 
 /*
  * Update the CPU's condition codes based on the value in the destination
  * register.
  */
-static inline void setcc(void)
+static inline void setcc(struct lc3machine *m)
 {
-    lc3word val;
+    update_cc(m, reg_r(m, DR()));
+}
 
-    val = reg_r(DR());
-    SET_N((val & 0x8000) == 0x8000);
-    SET_Z(val == 0);
-    SET_P(!(N() || Z()));
+/*
+ * Update the CPU's condition codes based on a value.
+ * Only the value is recorded; N, Z and P are worked out from it when
+ * something reads them (see cpu_psr()), since most results are overwritten
+ * before any branch looks at them.
+ */
+static inline void update_cc(struct lc3machine *m, lc3word val)
+{
+    m->cpu.cc = val;
 }
 
 /*
@@ -322,123 +948,139 @@ static inline lc3sword sign_extend(lc3word val, int pos)
     return (lc3sword) ((val ^ mask) - mask);
 }
 
+/*
+ * Machine Control Register I/O handlers.
+ */
+static lc3word mcr_read(struct lc3machine *m, lc3word addr)
+{
+    (void) addr;
+    return get_mcr(m);
+}
+
+static void mcr_write(struct lc3machine *m, lc3word addr, lc3word data,
+                      lc3word wmask)
+{
+    (void) addr;
+    set_mcr(m, WRITE_BITS(get_mcr(m), data, wmask));
+}
+
 /* ===== CPU States ===== */
 
-void state_00(void)
+void state_00(struct lc3machine *m)
 {
     /* BR (1/2) */
     /* NOP */
 }
 
-void state_01(void)
+void state_01(struct lc3machine *m)
 {
     /* ADD (1/1) */
     lc3word op1, op2;
     lc3word result;
 
-    op1 = reg_r(SR1());
+    op1 = reg_r(m, SR1());
     op2 = (IR_5())
         ? sign_extend(IMM5(), 5)
-        : reg_r(SR2());
+        : reg_r(m, SR2());
     result = op1 + op2;
-    reg_w(DR(), result);
-    setcc();
+    reg_w(m, DR(), result);
+    setcc(m);
 }
 
-void state_02(void)
+void state_02(struct lc3machine *m)
 {
     /* LDB (1/3) */
-    cpu.mar = reg_r(BASER()) + sign_extend(OFF6(), 6);
+    m->cpu.mar = reg_r(m, BASER()) + sign_extend(OFF6(), 6);
 }
 
-void state_03(void)
+void state_03(struct lc3machine *m)
 {
     /* STB (1/3) */
-    cpu.mar = reg_r(BASER()) + sign_extend(OFF6(), 6);
+    m->cpu.mar = reg_r(m, BASER()) + sign_extend(OFF6(), 6);
 }
 
-void state_04(void)
+void state_04(struct lc3machine *m)
 {
     /* JSR (1/3) */
     /* NOP */
 }
 
-void state_05(void)
+void state_05(struct lc3machine *m)
 {
     /* AND (1/1) */
     lc3word op1, op2;
     lc3word result;
 
-    op1 = reg_r(SR1());
+    op1 = reg_r(m, SR1());
     op2 = (IR_5())
         ? sign_extend(IMM5(), 5)
-        : reg_r(SR2());
+        : reg_r(m, SR2());
     result = op1 & op2;
-    reg_w(DR(), result);
-    setcc();
+    reg_w(m, DR(), result);
+    setcc(m);
 }
 
-void state_06(void)
+void state_06(struct lc3machine *m)
 {
     /* LDW (1/3) */
-    cpu.mar = reg_r(BASER()) + (sign_extend(OFF6(), 6) << 1);
+    m->cpu.mar = reg_r(m, BASER()) + (sign_extend(OFF6(), 6) << 1);
 }
 
-void state_07(void)
+void state_07(struct lc3machine *m)
 {
     /* STW (1/3) */
-    cpu.mar = reg_r(BASER()) + (sign_extend(OFF6(), 6) << 1);
+    m->cpu.mar = reg_r(m, BASER()) + (sign_extend(OFF6(), 6) << 1);
 }
 
-void state_08(void)
+void state_08(struct lc3machine *m)
 {
     /* RTI (1/9) */
-    cpu.mar = reg_r(R_6);
+    m->cpu.mar = reg_r(m, R_6);
 
     /* Tell the PIC we've serviced this interrupt (like EOI on the 8259) */
-    finish_irq(PRIORITY());
+    finish_irq(m, PRIORITY());
 }
 
-void state_09(void)
+void state_09(struct lc3machine *m)
 {
     /* XOR (1/1) */
     lc3word op1, op2;
     lc3word result;
 
-    op1 = reg_r(SR1());
+    op1 = reg_r(m, SR1());
     op2 = (IR_5())
         ? sign_extend(IMM5(), 5)
-        : reg_r(SR2());
+        : reg_r(m, SR2());
     result = op1 ^ op2;
-    reg_w(DR(), result);
-    setcc();
+    reg_w(m, DR(), result);
+    setcc(m);
 }
 
-void state_10(void)
+void state_10(struct lc3machine *m)
 {
     /* LDI (1/5) */
-    cpu.mar = reg_r(BASER()) + (sign_extend(OFF6(), 6) << 1);
+    m->cpu.mar = reg_r(m, BASER()) + (sign_extend(OFF6(), 6) << 1);
 }
 
-void state_11(void)
+void state_11(struct lc3machine *m)
 {
     /* STI (1/5) */
-    cpu.mar = reg_r(BASER()) + (sign_extend(OFF6(), 6) << 1);
+    m->cpu.mar = reg_r(m, BASER()) + (sign_extend(OFF6(), 6) << 1);
 }
 
-void state_12(void)
+void state_12(struct lc3machine *m)
 {
     /* JMP (1/1) */
-    cpu.pc = reg_r(BASER());
+    m->cpu.pc = reg_r(m, BASER());
 }
 
-void state_13(void)
+void state_13(struct lc3machine *m)
 {
     /* SHF (1/1) */
     lc3word op1, op2;
     lc3word result;
 
-    op1 = reg_r(SR1());
+    op1 = reg_r(m, SR1());
     op2 = IMM4();
     if (IR_4()) {
         if (IR_5()) {
@@ -453,351 +1095,687 @@ void state_13(void)
     else {
         result = op1 << op2;
     }
-    reg_w(DR(), result);
-    setcc();
+    reg_w(m, DR(), result);
+    setcc(m);
 }
 
-void state_14(void)
+void state_14(struct lc3machine *m)
 {
     /* LEA (1/1) */
-    reg_w(DR(), cpu.pc + (sign_extend(OFF9(), 9) << 1));
-    setcc();
+    reg_w(m, DR(), m->cpu.pc + (sign_extend(OFF9(), 9) << 1));
+    setcc(m);
 }
 
-void state_15(void)
+void state_15(struct lc3machine *m)
 {
     /* TRAP (1/3) */
-    cpu.mar = (TRAPVECT() << 1);
+    m->cpu.mar = (TRAPVECT() << 1);
 }
 
-void state_16(void)
+void state_16(struct lc3machine *m)
 {
     /* STW (3/3) */
     /* STI (5/5) */
-    mem_write(cpu.mar, cpu.mdr, 0xFFFF);
+    mem_write(m, m->cpu.mar, m->cpu.mdr, 0xFFFF);
 }
 
-void state_17(void)
+void state_17(struct lc3machine *m)
 {
     /* STB (3/3) */
-    if (cpu.mar & 1) {
-        mem_write(cpu.mar, cpu.mdr << 8, 0xFF00);
+    if (m->cpu.mar & 1) {
+        mem_write(m, m->cpu.mar, m->cpu.mdr << 8, 0xFF00);
     }
     else {
-        mem_write(cpu.mar, cpu.mdr, 0x00FF);
+        mem_write(m, m->cpu.mar, m->cpu.mdr, 0x00FF);
     }
 }
 
-void state_18(void)
+void state_18(struct lc3machine *m)
 {
     /* Fetch (1/3) */
-    cpu.mar = cpu.pc;
-    cpu.pc += 2;
+    m->cpu.mar = m->cpu.pc;
+    m->cpu.pc += 2;
 }
 
-void state_19(void)
+void state_19(struct lc3machine *m)
 {
     /* Fetch (1/3) (same as state 18) */
-    cpu.mar = cpu.pc;
-    cpu.pc += 2;
+    m->cpu.mar = m->cpu.pc;
+    m->cpu.pc += 2;
 }
 
-void state_20(void)
+void state_20(struct lc3machine *m)
 {
     /* JSR (2/3) */
-    reg_w(R_7, cpu.pc);
-    cpu.pc = reg_r(BASER());
+    reg_w(m, R_7, m->cpu.pc);
+    m->cpu.pc = reg_r(m, BASER());
 }
 
-void state_21(void)
+void state_21(struct lc3machine *m)
 {
     /* JSR (3/3) */
-    reg_w(R_7, cpu.pc);
-    cpu.pc = cpu.pc + (sign_extend(OFF11(), 11) << 1);
+    reg_w(m, R_7, m->cpu.pc);
+    m->cpu.pc = m->cpu.pc + (sign_extend(OFF11(), 11) << 1);
 }
 
-void state_22(void)
+void state_22(struct lc3machine *m)
 {
     /* BR (2/2) */
-    cpu.pc = cpu.pc + (sign_extend(OFF9(), 9) << 1);
+    m->cpu.pc = m->cpu.pc + (sign_extend(OFF9(), 9) << 1);
 }
 
-void state_23(void)
+void state_23(struct lc3machine *m)
 {
     /* STW (2/3) */
     /* STI (4/5) */
-    cpu.mdr = reg_r(SR());
+    m->cpu.mdr = reg_r(m, SR());
 }
 
-void state_24(void)
+void state_24(struct lc3machine *m)
 {
     /* STB (2/3) */
-    cpu.mdr = reg_r(SR()) & 0x00FF;
+    m->cpu.mdr = reg_r(m, SR()) & 0x00FF;
 }
 
-void state_25(void)
+void state_25(struct lc3machine *m)
 {
     /* LDW (2/3) */
     /* LDI (4/5) */
-    mem_read(&cpu.mdr, cpu.mar);
+    mem_read(m, &m->cpu.mdr, m->cpu.mar);
 }
 
-void state_26(void)
+void state_26(struct lc3machine *m)
 {
     /* (unused) */
 }
 
-void state_27(void)
+void state_27(struct lc3machine *m)
 {
     /* LDW (3/3) */
     /* LDI (5/5) */
-    reg_w(DR(), cpu.mdr);
-    setcc();
+    reg_w(m, DR(), m->cpu.mdr);
+    setcc(m);
 }
 
-void state_28(void)
+void state_28(struct lc3machine *m)
 {
     /* TRAP (2/3) */
-    mem_read(&cpu.mdr, cpu.mar);
-    reg_w(R_7, cpu.pc);
+    mem_read(m, &m->cpu.mdr, m->cpu.mar);
+    reg_w(m, R_7, m->cpu.pc);
 }
 
-void state_29(void)
+void state_29(struct lc3machine *m)
 {
     /* LDB (2/3) */
-    mem_read(&cpu.mdr, cpu.mar & 0xFFFE);
+    mem_read(m, &m->cpu.mdr, m->cpu.mar & 0xFFFE);
 }
 
-void state_30(void)
+void state_30(struct lc3machine *m)
 {
     /* TRAP (3/3) */
-    cpu.pc = cpu.mdr;
+    m->cpu.pc = m->cpu.mdr;
 }
 
-void state_31(void)
+void state_31(struct lc3machine *m)
 {
     /* LDB (3/3) */
     lc3word val;
 
-    val = ((cpu.mar & 1) ? (cpu.mdr >> 8) : cpu.mdr & 0xFF);
-    reg_w(DR(), sign_extend(val, 8));
-    setcc();
+    val = ((m->cpu.mar & 1) ? (m->cpu.mdr >> 8) : m->cpu.mdr & 0xFF);
+    reg_w(m, DR(), sign_extend(val, 8));
+    setcc(m);
 }
 
-void state_32(void)
+void state_32(struct lc3machine *m)
 {
-    /* Decode */
-    cpu.ben = (IR_11() && N()) || (IR_10() && Z()) || (IR_9() && P());
+    /* Decode; IR[11:9] and PSR[2:0] are both laid out n, z, p */
+    m->cpu.ben = ((m->cpu.ir >> 9) & cpu_psr(&m->cpu) & 7) != 0;
 }
 
-void state_33(void)
+void state_33(struct lc3machine *m)
 {
     /* Fetch (2/3) */
-    mem_read(&cpu.mdr, cpu.mar);
+    mem_read(m, &m->cpu.mdr, m->cpu.mar);
 }
 
-void state_34(void)
+void state_34(struct lc3machine *m)
 {
     /* RTI (7/9) */
     lc3word sp;
 
-    sp = reg_r(R_6);
+    sp = reg_r(m, R_6);
     sp += 2;
-    reg_w(R_6, sp);
+    reg_w(m, R_6, sp);
 }
 
-void state_35(void)
+void state_35(struct lc3machine *m)
 {
     /* Fetch (3/3) */
-    cpu.ir = cpu.mdr;
+    m->cpu.ir = m->cpu.mdr;
 }
 
-void state_36(void)
+void state_36(struct lc3machine *m)
 {
     /* RTI (2/9) */
-    mem_read(&cpu.mdr, cpu.mar);
+    mem_read(m, &m->cpu.mdr, m->cpu.mar);
 }
 
-void state_37(void)
+void state_37(struct lc3machine *m)
 {
     /* INT (3/10) */
     lc3word sp;
 
-    SET_PRIORITY(cpu.intp);
+    SET_PRIORITY(m->cpu.intp);
     SET_PRIVILEGE(PRIV_SUPER);
 
-    sp = reg_r(R_6);
+    sp = reg_r(m, R_6);
     sp -= 2;
-    reg_w(R_6, sp);
-    cpu.mar = sp;
+    reg_w(m, R_6, sp);
+    m->cpu.mar = sp;
 }
 
-void state_38(void)
+void state_38(struct lc3machine *m)
 {
     /* RTI (3/9) */
-    cpu.pc = cpu.mdr;
+    m->cpu.pc = m->cpu.mdr;
 }
 
-void state_39(void)
+void state_39(struct lc3machine *m)
 {
     /* RTI (4/9) */
     lc3word sp;
 
-    sp = reg_r(R_6);
+    sp = reg_r(m, R_6);
     sp += 2;
-    reg_w(R_6, sp);
-    cpu.mar = sp;
+    reg_w(m, R_6, sp);
+    m->cpu.mar = sp;
 }
 
-void state_40(void)
+void state_40(struct lc3machine *m)
 {
     /* RTI (5/9) */
-    mem_read(&cpu.mdr, cpu.mar);
+    mem_read(m, &m->cpu.mdr, m->cpu.mar);
 }
 
-void state_41(void)
+void state_41(struct lc3machine *m)
 {
     /* INT (4/10) */
-    mem_write(cpu.mar, cpu.mdr, 0xFFFF);
+    mem_write(m, m->cpu.mar, m->cpu.mdr, 0xFFFF);
 }
 
-void state_42(void)
+void state_42(struct lc3machine *m)
 {
     /* RTI (6/9) */
-    cpu.psr.value = cpu.mdr;
+    cpu_setpsr(&m->cpu, m->cpu.mdr);
+
+    /* The restored priority may let a pending interrupt through */
+    pic_poll(m);
 }
 
-void state_43(void)
+void state_43(struct lc3machine *m)
 {
     /* INT (5/10) */
-    cpu.mdr = cpu.pc - 2;
+    m->cpu.mdr = m->cpu.pc - 2;
 }
 
-void state_44(void)
+void state_44(struct lc3machine *m)
 {
     /* Trigger Privilege Mode Violation */
-    cpu.intv = E_PRIV;
-    cpu.mdr = cpu.psr.value;
+    m->cpu.intv = E_PRIV;
+    m->cpu.mdr = cpu_psr(&m->cpu);
 
     /* TODO: temp... */
     printf("Privilege Mode Violation!\n");
     while (1);
 }
 
-void state_45(void)
+void state_45(struct lc3machine *m)
 {
     /* INT (2/10) */
-    cpu.saved_usp = reg_r(R_6);
-    reg_w(R_6, cpu.saved_ssp);
+    m->cpu.saved_usp = reg_r(m, R_6);
+    reg_w(m, R_6, m->cpu.saved_ssp);
 }
 
-void state_46(void)
+void state_46(struct lc3machine *m)
 {
     /* (unused) */
 }
 
-void state_47(void)
+void state_47(struct lc3machine *m)
 {
     /* INT (6/10) */
     lc3word sp;
 
-    sp = reg_r(R_6);
+    sp = reg_r(m, R_6);
     sp -= 2;
-    reg_w(R_6, sp);
-    cpu.mar = sp;
+    reg_w(m, R_6, sp);
+    m->cpu.mar = sp;
 }
 
-void state_48(void)
+void state_48(struct lc3machine *m)
 {
     /* INT (7/10) */
-    mem_write(cpu.mar, cpu.mdr, 0xFFFF);
+    mem_write(m, m->cpu.mar, m->cpu.mdr, 0xFFFF);
 }
 
-void state_49(void)
+void state_49(struct lc3machine *m)
 {
     /* INT (1/10) */
-    cpu.mdr = cpu.psr.value;
+    m->cpu.mdr = cpu_psr(&m->cpu);
 }
 
-void state_50(void)
+void state_50(struct lc3machine *m)
 {
     /* INT (8/10) */
-    cpu.mar = A_IVT | (cpu.intv << 1);
+    m->cpu.mar = A_IVT | (m->cpu.intv << 1);
 }
 
-void state_51(void)
+void state_51(struct lc3machine *m)
 {
     /* RTI (8/9) */
     /* NOP */
 }
 
-void state_52(void)
+void state_52(struct lc3machine *m)
 {
     /* INT (9/10) */
-    mem_read(&cpu.mdr, cpu.mar);
+    mem_read(m, &m->cpu.mdr, m->cpu.mar);
 }
 
-void state_53(void)
+void state_53(struct lc3machine *m)
 {
     /* (unused) */
 }
 
-void state_54(void)
+void state_54(struct lc3machine *m)
 {
     /* INT (10/10) */
-    cpu.pc = cpu.mdr;
+    m->cpu.pc = m->cpu.mdr;
 
     /* Re-enable interrupts */
-    cpu.intf = 0;
+    m->cpu.intf = 0;
+    pic_poll(m);
 }
 
-void state_55(void)
+void state_55(struct lc3machine *m)
 {
     /* (unused) */
 }
 
-void state_56(void)
+void state_56(struct lc3machine *m)
 {
     /* LDI (2/5) */
-    mem_read(&cpu.mdr, cpu.mar);
+    mem_read(m, &m->cpu.mdr, m->cpu.mar);
 }
 
-void state_57(void)
+void state_57(struct lc3machine *m)
 {
     /* (unused) */
 }
 
-void state_58(void)
+void state_58(struct lc3machine *m)
 {
     /* LDI (3/5) */
-    cpu.mar = cpu.mdr;
+    m->cpu.mar = m->cpu.mdr;
 }
 
-void state_59(void)
+void state_59(struct lc3machine *m)
 {
     /* RTI (9/9) */
-    cpu.saved_ssp = reg_r(R_6);
-    reg_w(R_6, cpu.saved_usp);
+    m->cpu.saved_ssp = reg_r(m, R_6);
+    reg_w(m, R_6, m->cpu.saved_usp);
 }
 
-void state_60(void)
+void state_60(struct lc3machine *m)
 {
     /* STI (2/5) */
-    mem_read(&cpu.mdr, cpu.mar);
+    mem_read(m, &m->cpu.mdr, m->cpu.mar);
 }
 
-void state_61(void)
+void state_61(struct lc3machine *m)
 {
     /* (unused) */
 }
 
-void state_62(void)
+void state_62(struct lc3machine *m)
 {
     /* STI (3/5) */
-    cpu.mar = cpu.mdr;
+    m->cpu.mar = m->cpu.mdr;
 }
 
-void state_63(void)
+void state_63(struct lc3machine *m)
 {
     /* (unused) */
 }
+
+/* ===== Instruction-Level Engine =====
+   Each handler runs a whole predecoded instruction, doing the work of the
+   states the microcode would visit, minus the memory handshake. Memory is
+   accessed directly, so anything that would reach the I/O page is declined
+   (return 0) before any architectural state has been modified.
+*/
+
+/*
+ * Fill in a predecoded instruction cache entry.
+ */
+static void decode(struct decoded *d, lc3word ir)
+{
+    d->ir = ir;
+    d->a = (ir & 0x0E00) >> 9;
+    d->b = (ir & 0x01C0) >> 6;
+    d->c = ir & 0x0007;
+    d->imm = 0;
+
+    switch ((ir & 0xF000) >> 12) {
+        case OP_BR:
+            d->fn = op_br;
+            d->imm = sign_extend(ir & 0x01FF, 9) << 1;
+            break;
+        case OP_ADD:
+            d->fn = (ir & 0x0020) ? op_addi : op_add;
+            d->imm = sign_extend(ir & 0x001F, 5);
+            break;
+        case OP_LDB:
+            d->fn = op_ldb;
+            d->imm = sign_extend(ir & 0x003F, 6);
+            break;
+        case OP_STB:
+            d->fn = op_stb;
+            d->imm = sign_extend(ir & 0x003F, 6);
+            break;
+        case OP_JSR:
+            d->fn = (ir & 0x0800) ? op_jsr : op_jsrr;
+            d->imm = sign_extend(ir & 0x07FF, 11) << 1;
+            break;
+        case OP_AND:
+            d->fn = (ir & 0x0020) ? op_andi : op_and;
+            d->imm = sign_extend(ir & 0x001F, 5);
+            break;
+        case OP_LDW:
+            d->fn = op_ldw;
+            d->imm = sign_extend(ir & 0x003F, 6) << 1;
+            break;
+        case OP_STW:
+            d->fn = op_stw;
+            d->imm = sign_extend(ir & 0x003F, 6) << 1;
+            break;
+        case OP_RTI:
+            d->fn = op_rti;
+            break;
+        case OP_XOR:
+            d->fn = (ir & 0x0020) ? op_xori : op_xor;
+            d->imm = sign_extend(ir & 0x001F, 5);
+            break;
+        case OP_LDI:
+            d->fn = op_ldi;
+            d->imm = sign_extend(ir & 0x003F, 6) << 1;
+            break;
+        case OP_STI:
+            d->fn = op_sti;
+            d->imm = sign_extend(ir & 0x003F, 6) << 1;
+            break;
+        case OP_JMP:
+            d->fn = op_jmp;
+            break;
+        case OP_SHF:
+            d->fn = !(ir & 0x0010) ? op_lshf
+                  : (ir & 0x0020) ? op_rshfa
+                  : op_rshfl;
+            d->c = ir & 0x000F;
+            break;
+        case OP_LEA:
+            d->fn = op_lea;
+            d->imm = sign_extend(ir & 0x01FF, 9) << 1;
+            break;
+        case OP_TRAP:
+            d->fn = op_trap;
+            d->imm = (ir & 0x00FF) << 1;
+            break;
+    }
+}
+
+static int op_br(struct lc3machine *m, const struct decoded *d)
+{
+    /* PSR[2:0] and IR[11:9] are both laid out n, z, p */
+    m->cpu.ben = (cpu_psr(&m->cpu) & d->a) != 0;
+    if (m->cpu.ben) {
+        m->cpu.pc += d->imm;
+        return CYC_BR + 1;
+    }
+
+    return CYC_BR;
+}
+
+static int op_add(struct lc3machine *m, const struct decoded *d)
+{
+    lc3word result;
+
+    result = m->cpu.r[d->b] + m->cpu.r[d->c];
+    m->cpu.r[d->a] = result;
+    update_cc(m, result);
+    return CYC_ALU;
+}
+
+static int op_addi(struct lc3machine *m, const struct decoded *d)
+{
+    lc3word result;
+
+    result = m->cpu.r[d->b] + d->imm;
+    m->cpu.r[d->a] = result;
+    update_cc(m, result);
+    return CYC_ALU;
+}
+
+static int op_ldb(struct lc3machine *m, const struct decoded *d)
+{
+    lc3word val;
+
+    m->cpu.mar = m->cpu.r[d->b] + d->imm;
+    if (IS_IO(m->cpu.mar & 0xFFFE)) {
+        return 0;
+    }
+    mem_read_nodelay(m, &m->cpu.mdr, m->cpu.mar & 0xFFFE);
+    val = ((m->cpu.mar & 1) ? (m->cpu.mdr >> 8) : m->cpu.mdr & 0xFF);
+    val = sign_extend(val, 8);
+    m->cpu.r[d->a] = val;
+    update_cc(m, val);
+    return CYC_LDB;
+}
+
+static int op_stb(struct lc3machine *m, const struct decoded *d)
+{
+    m->cpu.mar = m->cpu.r[d->b] + d->imm;
+    if (IS_IO(m->cpu.mar)) {
+        return 0;
+    }
+    m->cpu.mdr = m->cpu.r[d->a] & 0x00FF;
+    if (m->cpu.mar & 1) {
+        mem_write_nodelay(m, m->cpu.mar, m->cpu.mdr << 8, 0xFF00);
+    }
+    else {
+        mem_write_nodelay(m, m->cpu.mar, m->cpu.mdr, 0x00FF);
+    }
+    return CYC_STB;
+}
+
+static int op_jsr(struct lc3machine *m, const struct decoded *d)
+{
+    m->cpu.r[R_7] = m->cpu.pc;
+    m->cpu.pc += d->imm;
+    return CYC_JSR;
+}
+
+static int op_jsrr(struct lc3machine *m, const struct decoded *d)
+{
+    /* R7 is written first, as in state 20 */
+    m->cpu.r[R_7] = m->cpu.pc;
+    m->cpu.pc = m->cpu.r[d->b];
+    return CYC_JSR;
+}
+
+static int op_and(struct lc3machine *m, const struct decoded *d)
+{
+    lc3word result;
+
+    result = m->cpu.r[d->b] & m->cpu.r[d->c];
+    m->cpu.r[d->a] = result;
+    update_cc(m, result);
+    return CYC_ALU;
+}
+
+static int op_andi(struct lc3machine *m, const struct decoded *d)
+{
+    lc3word result;
+
+    result = m->cpu.r[d->b] & d->imm;
+    m->cpu.r[d->a] = result;
+    update_cc(m, result);
+    return CYC_ALU;
+}
+
+static int op_ldw(struct lc3machine *m, const struct decoded *d)
+{
+    m->cpu.mar = m->cpu.r[d->b] + d->imm;
+    if (IS_IO(m->cpu.mar)) {
+        return 0;
+    }
+    mem_read_nodelay(m, &m->cpu.mdr, m->cpu.mar);
+    m->cpu.r[d->a] = m->cpu.mdr;
+    update_cc(m, m->cpu.mdr);
+    return CYC_LDW;
+}
+
+static int op_stw(struct lc3machine *m, const struct decoded *d)
+{
+    m->cpu.mar = m->cpu.r[d->b] + d->imm;
+    if (IS_IO(m->cpu.mar)) {
+        return 0;
+    }
+    m->cpu.mdr = m->cpu.r[d->a];
+    mem_write_nodelay(m, m->cpu.mar, m->cpu.mdr, 0xFFFF);
+    return CYC_STW;
+}
+
+static int op_rti(struct lc3machine *m, const struct decoded *d)
+{
+    /* Changes the priority level mid-instruction, which the PIC can observe */
+    return 0;
+}
+
+static int op_xor(struct lc3machine *m, const struct decoded *d)
+{
+    lc3word result;
+
+    result = m->cpu.r[d->b] ^ m->cpu.r[d->c];
+    m->cpu.r[d->a] = result;
+    update_cc(m, result);
+    return CYC_ALU;
+}
+
+static int op_xori(struct lc3machine *m, const struct decoded *d)
+{
+    lc3word result;
+
+    result = m->cpu.r[d->b] ^ d->imm;
+    m->cpu.r[d->a] = result;
+    update_cc(m, result);
+    return CYC_ALU;
+}
+
+static int op_ldi(struct lc3machine *m, const struct decoded *d)
+{
+    lc3word ptr;
+
+    m->cpu.mar = m->cpu.r[d->b] + d->imm;
+    if (IS_IO(m->cpu.mar)) {
+        return 0;
+    }
+    mem_read_nodelay(m, &ptr, m->cpu.mar);
+    if (IS_IO(ptr)) {
+        return 0;
+    }
+    m->cpu.mar = ptr;
+    mem_read_nodelay(m, &m->cpu.mdr, m->cpu.mar);
+    m->cpu.r[d->a] = m->cpu.mdr;
+    update_cc(m, m->cpu.mdr);
+    return CYC_LDI;
+}
+
+static int op_sti(struct lc3machine *m, const struct decoded *d)
+{
+    lc3word ptr;
+
+    m->cpu.mar = m->cpu.r[d->b] + d->imm;
+    if (IS_IO(m->cpu.mar)) {
+        return 0;
+    }
+    mem_read_nodelay(m, &ptr, m->cpu.mar);
+    if (IS_IO(ptr)) {
+        return 0;
+    }
+    m->cpu.mar = ptr;
+    m->cpu.mdr = m->cpu.r[d->a];
+    mem_write_nodelay(m, m->cpu.mar, m->cpu.mdr, 0xFFFF);
+    return CYC_STI;
+}
+
+static int op_jmp(struct lc3machine *m, const struct decoded *d)
+{
+    m->cpu.pc = m->cpu.r[d->b];
+    return CYC_JMP;
+}
+
+static int op_lshf(struct lc3machine *m, const struct decoded *d)
+{
+    lc3word result;
+
+    result = m->cpu.r[d->b] << d->c;
+    m->cpu.r[d->a] = result;
+    update_cc(m, result);
+    return CYC_ALU;
+}
+
+static int op_rshfl(struct lc3machine *m, const struct decoded *d)
+{
+    lc3word result;
+
+    result = m->cpu.r[d->b] >> d->c;
+    m->cpu.r[d->a] = result;
+    update_cc(m, result);
+    return CYC_ALU;
+}
+
+static int op_rshfa(struct lc3machine *m, const struct decoded *d)
+{
+    lc3word result;
+
+    result = (lc3sword) m->cpu.r[d->b] >> d->c;
+    m->cpu.r[d->a] = result;
+    update_cc(m, result);
+    return CYC_ALU;
+}
+
+static int op_lea(struct lc3machine *m, const struct decoded *d)
+{
+    lc3word result;
+
+    result = m->cpu.pc + d->imm;
+    m->cpu.r[d->a] = result;
+    update_cc(m, result);
+    return CYC_ALU;
+}
+
+static int op_trap(struct lc3machine *m, const struct decoded *d)
+{
+    int n;
+
+    if (m->traps != NULL && (n = traps_exec(m, d->imm >> 1)) > 0) {
+        return n;
+    }
+
+    m->cpu.mar = d->imm;
+    mem_read_nodelay(m, &m->cpu.mdr, m->cpu.mar);
+    m->cpu.r[R_7] = m->cpu.pc;
+    m->cpu.pc = m->cpu.mdr;
+    return CYC_TRAP;
+}
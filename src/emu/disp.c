@@ -19,71 +19,406 @@
  *   Desc: Display device driver.
  *============================================================================*/
 
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include <emu/disp.h>
+#include <emu/machine.h>
 #include <emu/pic.h>
+#include <emu/sched.h>
 
-#define RD()        (disp.dsr & DSR_RD)
-#define SET_RD(x)   (disp.dsr = (x)?(disp.dsr|DSR_RD):(disp.dsr&~DSR_RD))
+#ifndef _WIN32
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
 
-#define IE()        (disp.dsr & DSR_IE)
-#define SET_IE(x)   (disp.dsr = (x)?(disp.dsr|DSR_IE):(disp.dsr&~DSR_IE))
+#define RD()        (m->disp.dsr & DSR_RD)
+#define SET_RD(x)   (m->disp.dsr = (x)?(m->disp.dsr|DSR_RD):(m->disp.dsr&~DSR_RD))
 
-static struct lc3disp disp;
+#define IE()        (m->disp.dsr & DSR_IE)
+#define SET_IE(x)   (m->disp.dsr = (x)?(m->disp.dsr|DSR_IE):(m->disp.dsr&~DSR_IE))
 
-void disp_reset(void)
+/*
+ * Capacity of the terminal output ring. Must be a power of two.
+ */
+#define OUT_SIZE    65536
+
+/*
+ * Number of pending output bytes that causes a flush.
+ */
+#define OUT_FLUSH   4096
+
+#ifndef _WIN32
+typedef atomic_uint ring_pos;
+#define LOAD(x)     atomic_load_explicit(&(x), memory_order_acquire)
+#define STORE(x, v) atomic_store_explicit(&(x), (v), memory_order_release)
+#else
+typedef unsigned int ring_pos;
+#define LOAD(x)     (x)
+#define STORE(x, v) ((x) = (v))
+#endif
+
+/*
+ * Terminal output ring.
+ * Characters written by the display are queued here and written out in one
+ * go once OUT_FLUSH bytes are pending, once the oldest has waited for the
+ * flush interval, or when the machine asks for a flush. The bytes are
+ * written either by a writer thread or, without one, inline by the display.
+ */
+static struct {
+    int flush_ms;               /* flush interval, 0 to write every char */
+    int thread;                 /* use a writer thread if possible */
+    unsigned char buf[OUT_SIZE];
+    ring_pos head;              /* bytes queued (emulator) */
+    ring_pos tail;              /* bytes written (writer) */
+    unsigned int queued;        /* bytes queued since the writer was woken */
+    long first;                 /* time the oldest pending byte was queued */
+} out = { DISP_FLUSH_MS, 1 };
+
+#ifndef _WIN32
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+static int writer_running;              /* writer thread started */
+static atomic_int writer_idle;          /* writer waiting for output */
+static int flush_wanted;                /* flush requested, under out_lock */
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t out_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t out_drained = PTHREAD_COND_INITIALIZER;
+
+static void start_writer(void);
+static void * writer_main(void *arg);
+static void queue_async(int c);
+#endif
+
+static void update_line(struct lc3machine *m);
+static void drain(void);
+static void write_out(const unsigned char *data, size_t len);
+static long now_ms(void);
+static lc3word dsr_read(struct lc3machine *m, lc3word addr);
+static void dsr_write(struct lc3machine *m, lc3word addr, lc3word data,
+                      lc3word wmask);
+static void ddr_write(struct lc3machine *m, lc3word addr, lc3word data,
+                      lc3word wmask);
+
+
+int disp_init(struct lc3machine *m)
+{
+    if (mem_map_io(m, A_DSR, dsr_read, dsr_write) != 0
+        || mem_map_io(m, A_DDR, NULL, ddr_write) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void disp_reset(struct lc3machine *m)
 {
-    memset(&disp, 0, sizeof(struct lc3disp));
+    memset(&m->disp, 0, sizeof(struct lc3disp));
 
     SET_IE(1);
     SET_RD(1);
+    update_line(m);
 }
 
-void disp_tick(void)
+void disp_event(struct lc3machine *m)
 {
     unsigned char c;
 
-    if (disp.c > 0) {
-        disp.c--;
-    }
-
-    if (!RD() && disp.c == 0) {
-        c = disp.ddr & 0xFF;
+    if (!RD() && m->sched.now >= m->disp.done) {
+        c = m->disp.ddr & 0xFF;
         if (c != '\0')
         {
-            putc(c, stdout);
-            fflush(stdout);
+            m->io.putc(m->io.ctx, c);
         }
         SET_RD(1);
-    }
-
-    if (RD() && IE()) {
-        raise_irq(DISP_IRQ);
+        update_line(m);
     }
 }
 
-lc3word get_dsr(void)
+lc3word get_dsr(struct lc3machine *m)
 {
-    return disp.dsr;
+    return m->disp.dsr;
 }
 
-void set_dsr(lc3word value)
+void set_dsr(struct lc3machine *m, lc3word value)
 {
-    disp.dsr = value;
+    m->disp.dsr = value;
+    update_line(m);
+
+    /* Clearing RD by hand sends DDR again once the display is idle */
+    if (!RD()) {
+        sched_at(m, EV_DISP, m->disp.done);
+    }
 }
 
-lc3word get_ddr(void)
+lc3word get_ddr(struct lc3machine *m)
 {
-    return disp.ddr;
+    return m->disp.ddr;
 }
 
-void set_ddr(lc3word value)
+void set_ddr(struct lc3machine *m, lc3word value)
 {
     if (RD()) {
-        disp.ddr = value;
-        disp.c = DISP_DELAY;
+        m->disp.ddr = value;
+        m->disp.done = m->sched.now + DISP_DELAY;
         SET_RD(0);
+        update_line(m);
+        sched_at(m, EV_DISP, m->disp.done);
+    }
+}
+
+void disp_put(struct lc3machine *m, int c)
+{
+    if (!RD()) {
+        m->disp.done = m->sched.now;
+        disp_event(m);
+    }
+
+    m->io.putc(m->io.ctx, c);
+}
+
+void disp_term_setup(int flush_ms, int thread)
+{
+    disp_term_flush(NULL);
+    out.flush_ms = (flush_ms > 0) ? flush_ms : 0;
+    out.thread = thread;
+}
+
+void disp_term_putc(void *ctx, int c)
+{
+    unsigned int head;
+
+    (void) ctx;
+
+    if (out.flush_ms == 0) {
+        putc(c, stdout);
+        fflush(stdout);
+        return;
+    }
+
+#ifndef _WIN32
+    if (out.thread) {
+        pthread_once(&writer_once, start_writer);
+        if (writer_running) {
+            queue_async(c);
+            return;
+        }
+    }
+#endif
+
+    /* No writer thread; flush inline */
+    head = out.head;
+    if (head == out.tail) {
+        out.first = now_ms();
+    }
+    out.buf[head++ & (OUT_SIZE - 1)] = c;
+    out.head = head;
+
+    if (head - out.tail >= OUT_FLUSH || now_ms() - out.first >= out.flush_ms) {
+        drain();
+    }
+}
+
+void disp_term_flush(void *ctx)
+{
+    (void) ctx;
+
+#ifndef _WIN32
+    if (writer_running) {
+        pthread_mutex_lock(&out_lock);
+        while (LOAD(out.tail) != out.head) {
+            flush_wanted = 1;
+            pthread_cond_signal(&out_wake);
+            pthread_cond_wait(&out_drained, &out_lock);
+        }
+        pthread_mutex_unlock(&out_lock);
+        return;
+    }
+#endif
+
+    drain();
+}
+
+#ifndef _WIN32
+/*
+ * Start the terminal writer thread. If it cannot be started, output is
+ * flushed inline instead.
+ */
+static void start_writer(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    writer_running = (pthread_create(&thread, &attr, writer_main, NULL) == 0);
+    pthread_attr_destroy(&attr);
+}
+
+/*
+ * Terminal writer thread. Sleeps until output is queued, gives the emulator
+ * up to the flush interval to queue more, then writes it all out.
+ */
+static void * writer_main(void *arg)
+{
+    struct timespec until;
+
+    (void) arg;
+
+    for (;;) {
+        pthread_mutex_lock(&out_lock);
+        atomic_store(&writer_idle, 1);
+        while (atomic_load(&out.head) == LOAD(out.tail) && !flush_wanted) {
+            pthread_cond_wait(&out_wake, &out_lock);
+        }
+        atomic_store(&writer_idle, 0);
+
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += out.flush_ms / 1000;
+        until.tv_nsec += (out.flush_ms % 1000) * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        while (!flush_wanted && LOAD(out.head) - out.tail < OUT_FLUSH) {
+            if (pthread_cond_timedwait(&out_wake, &out_lock, &until)
+                == ETIMEDOUT) {
+                break;
+            }
+        }
+        flush_wanted = 0;
+        pthread_mutex_unlock(&out_lock);
+
+        drain();
+
+        pthread_mutex_lock(&out_lock);
+        pthread_cond_broadcast(&out_drained);
+        pthread_mutex_unlock(&out_lock);
+    }
+
+    return NULL;
+}
+
+/*
+ * Queue a character for the writer thread. Blocks while the ring is full.
+ */
+static void queue_async(int c)
+{
+    unsigned int head;
+
+    head = atomic_load_explicit(&out.head, memory_order_relaxed);
+    if (head - LOAD(out.tail) == OUT_SIZE) {
+        pthread_mutex_lock(&out_lock);
+        while (head - LOAD(out.tail) == OUT_SIZE) {
+            flush_wanted = 1;
+            pthread_cond_signal(&out_wake);
+            pthread_cond_wait(&out_drained, &out_lock);
+        }
+        pthread_mutex_unlock(&out_lock);
+    }
+
+    out.buf[head & (OUT_SIZE - 1)] = c;
+    atomic_store(&out.head, head + 1);
+
+    /* Wake the writer for the first byte, and again once enough are queued */
+    if (atomic_load(&writer_idle) || ++out.queued == OUT_FLUSH) {
+        out.queued = 0;
+        pthread_mutex_lock(&out_lock);
+        pthread_cond_signal(&out_wake);
+        pthread_mutex_unlock(&out_lock);
+    }
+}
+#endif
+
+/*
+ * I/O register handlers.
+ */
+static lc3word dsr_read(struct lc3machine *m, lc3word addr)
+{
+    (void) addr;
+    return get_dsr(m);
+}
+
+static void dsr_write(struct lc3machine *m, lc3word addr, lc3word data,
+                      lc3word wmask)
+{
+    (void) addr;
+    set_dsr(m, WRITE_BITS(get_dsr(m), data, wmask));
+}
+
+static void ddr_write(struct lc3machine *m, lc3word addr, lc3word data,
+                      lc3word wmask)
+{
+    (void) addr;
+    set_ddr(m, WRITE_BITS(get_ddr(m), data, wmask));
+}
+
+/*
+ * Request an interrupt while the display is ready and interrupts are enabled.
+ */
+static void update_line(struct lc3machine *m)
+{
+    set_irq_line(m, DISP_IRQ, RD() && IE());
+}
+
+/*
+ * Write out every queued character.
+ */
+static void drain(void)
+{
+    unsigned int head, tail;
+    unsigned int start, len;
+
+    head = LOAD(out.head);
+    tail = out.tail;
+    while (tail != head) {
+        start = tail & (OUT_SIZE - 1);
+        len = head - tail;
+        if (len > OUT_SIZE - start) {
+            len = OUT_SIZE - start;
+        }
+        write_out(out.buf + start, len);
+        tail += len;
+        STORE(out.tail, tail);
+    }
+}
+
+/*
+ * Write a block to the terminal.
+ */
+static void write_out(const unsigned char *data, size_t len)
+{
+#ifndef _WIN32
+    ssize_t r;
+
+    while (len > 0) {
+        r = write(STDOUT_FILENO, data, len);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += r;
+        len -= r;
     }
+#else
+    fwrite(data, 1, len, stdout);
+    fflush(stdout);
+#endif
+}
+
+/*
+ * Get a monotonic time in milliseconds.
+ */
+static long now_ms(void)
+{
+#ifndef _WIN32
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000L + t.tv_nsec / 1000000L;
+#else
+    return (long) GetTickCount();
+#endif
 }
@@ -0,0 +1,132 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*==============================================================================
+ *   File: src/emu/headless.c
+ * Author: Wes Hampson
+ *   Desc: Headless I/O.
+ *============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <emu/headless.h>
+#include <emu/machine.h>
+
+static int headless_getc(void *ctx);
+static void headless_putc(void *ctx, int c);
+static void headless_flush(void *ctx);
+
+void headless_attach(struct headless *h, struct lc3machine *m, FILE *in,
+                     FILE *out, uint64_t rate)
+{
+#ifndef _WIN32
+    struct stat st;
+#endif
+
+    memset(h, 0, sizeof(struct headless));
+    h->m = m;
+    h->in = in;
+    h->out = out;
+    h->rate = rate;
+
+    /* Reading a pipe may block, so show any prompt first */
+    h->pipe = 1;
+#ifndef _WIN32
+    if (in != NULL && fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode)) {
+        h->pipe = 0;
+    }
+#endif
+
+    m->io.getc = headless_getc;
+    m->io.putc = headless_putc;
+    m->io.wait = NULL;
+    m->io.flush = headless_flush;
+    m->io.ctx = h;
+}
+
+void headless_detach(struct headless *h)
+{
+    if (h->out != NULL) {
+        fflush(h->out);
+    }
+    free(h->buf);
+    h->buf = NULL;
+    h->len = 0;
+    h->cap = 0;
+}
+
+/*
+ * Keyboard hook. Hands over the next input byte once the program has read
+ * the previous one and the rate allows.
+ */
+static int headless_getc(void *ctx)
+{
+    struct headless *h = ctx;
+    int c;
+
+    if (h->in == NULL || !h->m->kbd.taken || h->m->sched.now < h->next) {
+        return -1;
+    }
+
+    headless_flush(h);
+    c = fgetc(h->in);
+    if (c == EOF) {
+        h->in = NULL;
+        return -1;
+    }
+
+    h->next = h->m->sched.now + h->rate;
+    return c;
+}
+
+/*
+ * Display hook. Writes to the output stream, or collects output in memory.
+ */
+static void headless_putc(void *ctx, int c)
+{
+    struct headless *h = ctx;
+
+    if (h->out != NULL) {
+        putc(c, h->out);
+        return;
+    }
+
+    if (h->len == h->cap) {
+        h->cap = h->cap ? 2 * h->cap : 256;
+        h->buf = realloc(h->buf, h->cap);
+        if (h->buf == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            exit(2);
+        }
+    }
+
+    h->buf[h->len++] = c;
+}
+
+/*
+ * Flush hook. Output only needs to be seen early when whatever feeds the
+ * input pipe may be waiting on it; otherwise it is flushed on detach.
+ */
+static void headless_flush(void *ctx)
+{
+    struct headless *h = ctx;
+
+    if (h->pipe && h->out != NULL) {
+        fflush(h->out);
+    }
+}
@@ -0,0 +1,96 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: src/emu/idle.c
+ * Author: Wes Hampson
+ *   Desc: Idle-loop detection.
+ *============================================================================*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include <emu/idle.h>
+#include <emu/cpu.h>
+#include <emu/machine.h>
+
+static int same_state(const struct lc3cpu *a, const struct lc3cpu *b);
+
+void idle_reset(struct lc3machine *m)
+{
+    memset(&m->idle, 0, sizeof(struct lc3idle));
+}
+
+uint64_t idle_skip(struct lc3machine *m, uint64_t budget)
+{
+    struct lc3idle *s;
+    uint64_t period;
+    uint64_t n;
+    uint64_t k;
+
+    s = &m->idle;
+    if (m->cpu.intf) {
+        /* About to take an interrupt, not to run the loop again */
+        s->armed = 0;
+        return 0;
+    }
+
+    if (!s->armed || s->head != m->cpu.pc
+        || s->writes != m->mem.writes || s->changes != m->sched.changes
+        || !same_state(&s->snap, &m->cpu)) {
+        s->armed = 1;
+        s->head = m->cpu.pc;
+        s->snap = m->cpu;
+        s->now = m->sched.now;
+        s->writes = m->mem.writes;
+        s->changes = m->sched.changes;
+        return 0;
+    }
+
+    /* Whole iterations that end before the next event and the budget */
+    period = m->sched.now - s->now;
+    n = (m->sched.next - 1 - m->sched.now) / period;
+    k = (budget - 1) / period;
+    if (k < n) {
+        n = k;
+    }
+    else if (n > 0 && m->sched.heap[0].ev == EV_KBD && m->io.wait != NULL) {
+        /* Nothing will happen until a key is pressed */
+        if (m->io.flush != NULL) {
+            m->io.flush(m->io.ctx);
+        }
+        m->io.wait(m->io.ctx, IDLE_WAIT_MS);
+    }
+
+    m->sched.now += n * period;
+    s->now = m->sched.now;
+    return n * period;
+}
+
+/*
+ * Compare the architectural and microarchitectural state of two CPUs at an
+ * instruction boundary, ignoring the cycle count.
+ */
+static int same_state(const struct lc3cpu *a, const struct lc3cpu *b)
+{
+    return memcmp(a->r, b->r, sizeof(a->r)) == 0
+        && a->pc == b->pc && a->ir == b->ir
+        && a->mar == b->mar && a->mdr == b->mdr
+        && a->saved_ssp == b->saved_ssp && a->saved_usp == b->saved_usp
+        && cpu_psr(a) == cpu_psr(b) && a->ben == b->ben
+        && a->intv == b->intv && a->intp == b->intp
+        && a->mcr == b->mcr && a->state == b->state;
+}
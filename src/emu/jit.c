@@ -0,0 +1,902 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*==============================================================================
+ *   File: src/emu/jit.c
+ * Author: Wes Hampson
+ *   Desc: Basic-block translator for the LC-3c.
+ *         A block runs from its entry point up to and including the first
+ *         control transfer (BR, JMP, JSR, TRAP), and is translated once it has
+ *         been entered HOT_THRESHOLD times. Generated code keeps the guest
+ *         state in struct lc3cpu and reads RAM directly through the page
+ *         table; stores go through mem_write_nodelay() so that shared pages
+ *         are unshared and any code they overwrite is discarded.
+ *
+ *         A block gives control back to the interpreter ("side exit") just
+ *         before any access to memory-mapped I/O, leaving the instruction to
+ *         the microcode. RTI is never translated, and blocks are only entered
+ *         with no interrupt pending. Devices are clocked by the caller once
+ *         the block returns its cycle count.
+ *============================================================================*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <emu/lc3.h>
+#include <emu/cpu.h>
+#include <emu/mem.h>
+#include <emu/jit.h>
+#include <emu/machine.h>
+#include <emu/traps.h>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+
+#include <sys/mman.h>
+
+#define CODE_SIZE       (4 << 20)   /* translation buffer size, in bytes */
+#define MAX_BLOCK       32          /* max guest instructions per block */
+#define MAX_INSN_CODE   224         /* max host bytes per guest instruction */
+#define HOT_THRESHOLD   16          /* block entries before translation */
+
+/*
+ * Code pages, used to find the blocks affected by a write.
+ */
+#define PAGE_SHIFT      8
+#define NUM_PAGES       (MEM_SIZE >> PAGE_SHIFT)
+
+/*
+ * Host registers.
+ * RBX holds the CPU state, R12 the memory page table and R13 the machine for
+ * the life of a block. RDI is scratch for page lookups.
+ */
+#define EAX             0
+#define ECX             1
+#define EDX             2
+#define ESI             6
+#define EDI             7
+
+/*
+ * Opcode extensions for the immediate ALU (0x81) and shift (0xC1) groups.
+ */
+#define G1_ADD          0
+#define G1_AND          4
+#define G1_XOR          6
+#define G1_CMP          7
+#define G2_SHL          4
+#define G2_SHR          5
+#define G2_SAR          7
+
+/*
+ * Jcc condition codes.
+ */
+#define JCC_AE          0x03
+#define JCC_Z           0x04
+#define JCC_NZ          0x05
+
+/*
+ * Guest state offsets, relative to RBX.
+ */
+#define OFF_R(n)        (offsetof(struct lc3cpu, r) + 2 * (n))
+#define OFF_PC          offsetof(struct lc3cpu, pc)
+#define OFF_IR          offsetof(struct lc3cpu, ir)
+#define OFF_MAR         offsetof(struct lc3cpu, mar)
+#define OFF_MDR         offsetof(struct lc3cpu, mdr)
+#define OFF_PSR         offsetof(struct lc3cpu, psr)
+
+/*
+ * Translated block entry point.
+ */
+typedef int (*block_fn)(struct lc3cpu *cpu, lc3word **pages,
+                        struct lc3machine *m);
+
+/*
+ * Guest instruction awaiting translation.
+ */
+struct insn {
+    lc3word addr;       /* instruction address */
+    lc3word ir;         /* instruction word */
+    int cc_live;        /* condition codes are read before being overwritten */
+};
+
+/*
+ * Out-of-line block exit, emitted after the block body.
+ */
+struct stub {
+    uint8_t *patch;     /* rel32 field of the branch to the stub */
+    lc3word pc;         /* PC to resume at */
+    lc3word ir;         /* IR to leave behind, if 'store' */
+    int cycles;         /* cycles spent before exiting */
+    int store;          /* exit follows a store that hit translated code */
+};
+
+/*
+ * Per-machine translator state.
+ */
+struct jit_state {
+    uint8_t *code_base;             /* translation buffer */
+    uint8_t *code_ptr;              /* next free byte */
+    uint8_t *blocks[MEM_DEPTH];     /* entry points, by word address */
+    uint16_t cost[MEM_DEPTH];       /* worst-case cycles, by word address */
+    uint8_t heat[MEM_DEPTH];        /* untranslated entries, by word address */
+    uint8_t code_pages[NUM_PAGES];  /* pages holding translated code */
+    int stale;                      /* translated code was overwritten */
+    struct stub stubs[3 * MAX_BLOCK];
+    int num_stubs;
+};
+
+static uint8_t * translate(struct lc3machine *m, lc3word start);
+static void flush(struct jit_state *j);
+static int store(struct lc3machine *m, unsigned int addr, unsigned int data,
+                 unsigned int wmask);
+
+static inline int sets_cc(int op);
+static inline int ends_block(lc3word ir);
+static inline int touches_mem(int op);
+static inline lc3sword sext(lc3word val, int pos);
+
+static inline void emit8(struct jit_state *j, uint8_t b);
+static inline void emit16(struct jit_state *j, uint16_t w);
+static inline void emit32(struct jit_state *j, uint32_t d);
+static inline void emit64(struct jit_state *j, uint64_t q);
+static inline void emit_ld16(struct jit_state *j, int reg, int off);
+static inline void emit_ld16s(struct jit_state *j, int reg, int off);
+static inline void emit_st16(struct jit_state *j, int reg, int off);
+static inline void emit_st16i(struct jit_state *j, int off, lc3word imm);
+static inline void emit_movi(struct jit_state *j, int reg, uint32_t imm);
+static inline void emit_mov(struct jit_state *j, int dst, int src);
+static inline void emit_alu(struct jit_state *j, int ext, int reg, int32_t imm);
+static inline void emit_shift(struct jit_state *j, int ext, int reg, int n);
+static inline void emit_ldram(struct jit_state *j, int dst, int addr);
+static inline uint8_t * emit_jcc(struct jit_state *j, int cc);
+static inline void emit_addr(struct jit_state *j, int base, int off);
+static inline void emit_setcc(struct jit_state *j);
+static inline void emit_ret(struct jit_state *j, int cycles);
+static inline void emit_exit(struct jit_state *j, lc3word pc, int cycles);
+static void emit_io_check(struct jit_state *j, int reg, lc3word pc,
+                          int cycles);
+static void emit_store(struct jit_state *j, lc3word next, lc3word ir,
+                       int cycles);
+
+/* ===== Public Functions ===== */
+
+int jit_init(struct lc3machine *m)
+{
+    struct jit_state *j;
+
+    if (m->jit == NULL) {
+        j = calloc(1, sizeof(struct jit_state));
+        if (j == NULL) {
+            return -1;
+        }
+        j->code_base = mmap(NULL, CODE_SIZE,
+                            PROT_READ | PROT_WRITE | PROT_EXEC,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (j->code_base == MAP_FAILED) {
+            free(j);
+            return -1;
+        }
+        m->jit = j;
+    }
+
+    flush(m->jit);
+    memset(m->jit->heat, 0, sizeof(m->jit->heat));
+    return 0;
+}
+
+int jit_exec(struct lc3machine *m, uint64_t room)
+{
+    struct jit_state *j;
+    block_fn fn;
+    uint8_t *code;
+    lc3word pc;
+
+    j = m->jit;
+    pc = m->cpu.pc;
+    if (j == NULL || (pc & 1) || IS_IO(pc)) {
+        return 0;
+    }
+
+    code = j->blocks[pc >> 1];
+    if (code == NULL) {
+        if (++j->heat[pc >> 1] < HOT_THRESHOLD) {
+            return 0;
+        }
+        j->heat[pc >> 1] = 0;
+
+        code = translate(m, pc);
+        if (code == NULL) {
+            return 0;
+        }
+        j->blocks[pc >> 1] = code;
+    }
+
+    if (j->cost[pc >> 1] > room) {
+        return 0;
+    }
+
+    fn = (block_fn) code;
+    return fn(&m->cpu, mem_pages(m), m);
+}
+
+void jit_invalidate(struct lc3machine *m, lc3word addr)
+{
+    struct jit_state *j;
+    unsigned int page;
+    unsigned int lo;
+    unsigned int hi;
+
+    j = m->jit;
+    page = addr >> PAGE_SHIFT;
+    if (j == NULL || !j->code_pages[page]) {
+        return;
+    }
+
+    /* Blocks starting up to one block length before the page may reach it */
+    lo = page << PAGE_SHIFT;
+    lo = (lo > 2 * MAX_BLOCK) ? lo - 2 * MAX_BLOCK : 0;
+    hi = (page + 1) << PAGE_SHIFT;
+    memset(&j->blocks[lo >> 1], 0, ((hi - lo) >> 1) * sizeof(j->blocks[0]));
+
+    j->code_pages[page] = 0;
+    j->stale = 1;
+}
+
+void jit_free(struct lc3machine *m)
+{
+    if (m->jit != NULL) {
+        munmap(m->jit->code_base, CODE_SIZE);
+        free(m->jit);
+        m->jit = NULL;
+    }
+}
+
+/* ===== Translation ===== */
+
+/*
+ * Translate the basic block starting at an address.
+ *
+ * @param start the address of the first instruction
+ * @return      a pointer to the generated code
+ *              NULL if there is nothing to translate
+ */
+static uint8_t * translate(struct lc3machine *m, lc3word start)
+{
+    struct jit_state *j = m->jit;
+    struct insn insns[MAX_BLOCK];
+    struct insn *in;
+    lc3word addr;
+    lc3word next;
+    lc3word ir;
+    uint8_t *entry;
+    uint8_t *skip;
+    int cycles;
+    int cost;
+    int ended;
+    int live;
+    int op;
+    int dr, sr1, sr2;
+    int n, i;
+
+    /* Find the end of the block */
+    n = 0;
+    cost = 0;
+    for (addr = start; !IS_IO(addr); addr += 2) {
+        mem_read_nodelay(m, &ir, addr);
+        if ((ir >> 12) == OP_RTI || traps_native(m, ir)) {
+            break;
+        }
+        insns[n].addr = addr;
+        insns[n].ir = ir;
+        cost += cpu_cost(ir);
+        if (++n == MAX_BLOCK || ends_block(ir)) {
+            break;
+        }
+    }
+    if (n == 0) {
+        return NULL;
+    }
+    j->cost[start >> 1] = cost;
+
+    /*
+     * Condition codes only need computing when something reads them: a
+     * branch, or the interpreter after any exit. Loads and stores can exit
+     * early, so they count as readers of the codes set before them.
+     */
+    live = 1;
+    for (i = n - 1; i >= 0; i--) {
+        op = insns[i].ir >> 12;
+        insns[i].cc_live = live;
+        if (sets_cc(op)) {
+            live = 0;
+        }
+        if (op == OP_BR || touches_mem(op)) {
+            live = 1;
+        }
+    }
+
+    if (j->code_ptr + (n * MAX_INSN_CODE) > j->code_base + CODE_SIZE) {
+        flush(j);
+    }
+
+    /*
+     * Prologue: push rbx; push r12; push r13;
+     *           mov rbx, rdi; mov r12, rsi; mov r13, rdx
+     */
+    entry = j->code_ptr;
+    emit8(j, 0x53);
+    emit8(j, 0x41); emit8(j, 0x54);
+    emit8(j, 0x41); emit8(j, 0x55);
+    emit8(j, 0x48); emit8(j, 0x89); emit8(j, 0xFB);
+    emit8(j, 0x49); emit8(j, 0x89); emit8(j, 0xF4);
+    emit8(j, 0x49); emit8(j, 0x89); emit8(j, 0xD5);
+
+    j->num_stubs = 0;
+    cycles = 0;
+    ended = 0;
+    for (i = 0; i < n; i++) {
+        in = &insns[i];
+        ir = in->ir;
+        next = in->addr + 2;
+        op = ir >> 12;
+        dr = (ir >> 9) & 7;
+        sr1 = (ir >> 6) & 7;
+        sr2 = ir & 7;
+
+        switch (op) {
+            case OP_BR:
+                cycles += CYC_BR;
+                if (((ir >> 9) & 7) == 0) {
+                    break;      /* never taken */
+                }
+                emit_st16i(j, OFF_IR, ir);
+                emit_st16i(j, OFF_MAR, in->addr);
+                emit_st16i(j, OFF_MDR, ir);
+                if (((ir >> 9) & 7) != 7) {
+                    /* test byte [rbx+psr], nzp */
+                    emit8(j, 0xF6); emit8(j, 0x43); emit8(j, OFF_PSR);
+                    emit8(j, (ir >> 9) & 7);
+                    skip = emit_jcc(j, JCC_Z);
+                    emit_exit(j, next + (sext(ir & 0x01FF, 9) << 1),
+                              cycles + 1);
+                    *(int32_t *) skip = (int32_t) (j->code_ptr - (skip + 4));
+                    emit_exit(j, next, cycles);
+                }
+                else {
+                    emit_exit(j, next + (sext(ir & 0x01FF, 9) << 1),
+                              cycles + 1);
+                }
+                ended = 1;
+                break;
+
+            case OP_ADD:
+            case OP_AND:
+            case OP_XOR:
+                emit_ld16(j, EAX, OFF_R(sr1));
+                if (ir & 0x0020) {
+                    emit_alu(j, (op == OP_ADD) ? G1_ADD
+                           : (op == OP_AND) ? G1_AND : G1_XOR,
+                           EAX, sext(ir & 0x001F, 5));
+                }
+                else {
+                    /* add/and/xor eax, ecx */
+                    emit_ld16(j, ECX, OFF_R(sr2));
+                    emit8(j, (op == OP_ADD) ? 0x01
+                           : (op == OP_AND) ? 0x21 : 0x31);
+                    emit8(j, 0xC8);
+                }
+                emit_st16(j, EAX, OFF_R(dr));
+                if (in->cc_live) {
+                    emit_setcc(j);
+                }
+                cycles += CYC_ALU;
+                break;
+
+            case OP_SHF:
+                if ((ir & 0x0030) == 0x0030) {
+                    emit_ld16s(j, EAX, OFF_R(sr1));
+                    emit_shift(j, G2_SAR, EAX, ir & 0x000F);
+                }
+                else {
+                    emit_ld16(j, EAX, OFF_R(sr1));
+                    emit_shift(j, (ir & 0x0010) ? G2_SHR : G2_SHL, EAX,
+                               ir & 0x000F);
+                }
+                emit_st16(j, EAX, OFF_R(dr));
+                if (in->cc_live) {
+                    emit_setcc(j);
+                }
+                cycles += CYC_ALU;
+                break;
+
+            case OP_LEA:
+                emit_movi(j, EAX,
+                          (lc3word) (next + (sext(ir & 0x01FF, 9) << 1)));
+                emit_st16(j, EAX, OFF_R(dr));
+                if (in->cc_live) {
+                    emit_setcc(j);
+                }
+                cycles += CYC_ALU;
+                break;
+
+            case OP_LDW:
+                emit_addr(j, sr1, sext(ir & 0x003F, 6) << 1);
+                emit_io_check(j, EAX, in->addr, cycles);
+                emit_st16(j, EAX, OFF_MAR);
+                emit_alu(j, G1_AND, EAX, 0xFFFE);
+                emit_ldram(j, EAX, EAX);
+                emit_st16(j, EAX, OFF_MDR);
+                emit_st16(j, EAX, OFF_R(dr));
+                if (in->cc_live) {
+                    emit_setcc(j);
+                }
+                cycles += CYC_LDW;
+                break;
+
+            case OP_LDB:
+                emit_addr(j, sr1, sext(ir & 0x003F, 6));
+                emit_st16(j, EAX, OFF_MAR);
+                emit_mov(j, ECX, EAX);
+                emit_alu(j, G1_AND, ECX, 0xFFFE);
+                emit_io_check(j, ECX, in->addr, cycles);
+                emit_ldram(j, EDX, ECX);
+                emit_st16(j, EDX, OFF_MDR);
+                /* mov ecx, eax; and ecx, 1; shl ecx, 3; shr edx, cl */
+                emit_mov(j, ECX, EAX);
+                emit_alu(j, G1_AND, ECX, 1);
+                emit_shift(j, G2_SHL, ECX, 3);
+                emit8(j, 0xD3); emit8(j, 0xEA);
+                /* movsx eax, dl */
+                emit8(j, 0x0F); emit8(j, 0xBE); emit8(j, 0xC2);
+                emit_st16(j, EAX, OFF_R(dr));
+                if (in->cc_live) {
+                    emit_setcc(j);
+                }
+                cycles += CYC_LDB;
+                break;
+
+            case OP_LDI:
+                emit_addr(j, sr1, sext(ir & 0x003F, 6) << 1);
+                emit_io_check(j, EAX, in->addr, cycles);
+                emit_alu(j, G1_AND, EAX, 0xFFFE);
+                emit_ldram(j, EAX, EAX);
+                emit_io_check(j, EAX, in->addr, cycles);
+                emit_st16(j, EAX, OFF_MAR);
+                emit_alu(j, G1_AND, EAX, 0xFFFE);
+                emit_ldram(j, EAX, EAX);
+                emit_st16(j, EAX, OFF_MDR);
+                emit_st16(j, EAX, OFF_R(dr));
+                if (in->cc_live) {
+                    emit_setcc(j);
+                }
+                cycles += CYC_LDI;
+                break;
+
+            case OP_STW:
+                emit_addr(j, sr1, sext(ir & 0x003F, 6) << 1);
+                emit_io_check(j, EAX, in->addr, cycles);
+                emit_st16(j, EAX, OFF_MAR);
+                emit_ld16(j, ESI, OFF_R(dr));
+                emit_st16(j, ESI, OFF_MDR);
+                emit_movi(j, EDX, 0xFFFF);
+                cycles += CYC_STW;
+                emit_store(j, next, ir, cycles);
+                break;
+
+            case OP_STB:
+                emit_addr(j, sr1, sext(ir & 0x003F, 6));
+                emit_io_check(j, EAX, in->addr, cycles);
+                emit_st16(j, EAX, OFF_MAR);
+                emit_ld16(j, ESI, OFF_R(dr));
+                emit_alu(j, G1_AND, ESI, 0x00FF);
+                emit_st16(j, ESI, OFF_MDR);
+                /* Shift data and mask into the addressed byte */
+                emit_mov(j, ECX, EAX);
+                emit_alu(j, G1_AND, ECX, 1);
+                emit_shift(j, G2_SHL, ECX, 3);
+                emit_movi(j, EDX, 0x00FF);
+                emit8(j, 0xD3); emit8(j, 0xE6);  /* shl esi, cl */
+                emit8(j, 0xD3); emit8(j, 0xE2);  /* shl edx, cl */
+                cycles += CYC_STB;
+                emit_store(j, next, ir, cycles);
+                break;
+
+            case OP_STI:
+                emit_addr(j, sr1, sext(ir & 0x003F, 6) << 1);
+                emit_io_check(j, EAX, in->addr, cycles);
+                emit_alu(j, G1_AND, EAX, 0xFFFE);
+                emit_ldram(j, EAX, EAX);
+                emit_io_check(j, EAX, in->addr, cycles);
+                emit_st16(j, EAX, OFF_MAR);
+                emit_ld16(j, ESI, OFF_R(dr));
+                emit_st16(j, ESI, OFF_MDR);
+                emit_movi(j, EDX, 0xFFFF);
+                cycles += CYC_STI;
+                emit_store(j, next, ir, cycles);
+                break;
+
+            case OP_JSR:
+                emit_st16i(j, OFF_IR, ir);
+                emit_st16i(j, OFF_MAR, in->addr);
+                emit_st16i(j, OFF_MDR, ir);
+                emit_st16i(j, OFF_R(R_7), next);
+                cycles += CYC_JSR;
+                if (ir & 0x0800) {
+                    emit_exit(j, next + (sext(ir & 0x07FF, 11) << 1), cycles);
+                }
+                else {
+                    /* R7 is written first, as in state 20 */
+                    emit_ld16(j, EAX, OFF_R(sr1));
+                    emit_st16(j, EAX, OFF_PC);
+                    emit_ret(j, cycles);
+                }
+                ended = 1;
+                break;
+
+            case OP_JMP:
+                emit_st16i(j, OFF_IR, ir);
+                emit_st16i(j, OFF_MAR, in->addr);
+                emit_st16i(j, OFF_MDR, ir);
+                emit_ld16(j, EAX, OFF_R(sr1));
+                emit_st16(j, EAX, OFF_PC);
+                emit_ret(j, cycles + CYC_JMP);
+                ended = 1;
+                break;
+
+            case OP_TRAP:
+                emit_st16i(j, OFF_IR, ir);
+                emit_st16i(j, OFF_MAR, (ir & 0x00FF) << 1);
+                /* mov rdi, [r12+page*8]; movzx eax, word [rdi+offset] */
+                emit8(j, 0x49); emit8(j, 0x8B); emit8(j, 0x7C); emit8(j, 0x24);
+                emit8(j, (((ir & 0x00FF) << 1) >> MEM_PAGE_SHIFT) * 8);
+                emit8(j, 0x0F); emit8(j, 0xB7); emit8(j, 0x87);
+                emit32(j, ((ir & 0x00FF) << 1) & MEM_PAGE_MASK);
+                emit_st16(j, EAX, OFF_MDR);
+                emit_st16i(j, OFF_R(R_7), next);
+                emit_st16(j, EAX, OFF_PC);
+                emit_ret(j, cycles + CYC_TRAP);
+                ended = 1;
+                break;
+        }
+    }
+
+    /* Fell off the end of a block cut short */
+    if (!ended) {
+        in = &insns[n - 1];
+        op = in->ir >> 12;
+        emit_st16i(j, OFF_IR, in->ir);
+        if (!touches_mem(op)) {
+            emit_st16i(j, OFF_MAR, in->addr);
+            emit_st16i(j, OFF_MDR, in->ir);
+        }
+        emit_exit(j, in->addr + 2, cycles);
+    }
+
+    for (i = 0; i < j->num_stubs; i++) {
+        *(int32_t *) j->stubs[i].patch =
+            (int32_t) (j->code_ptr - (j->stubs[i].patch + 4));
+        if (j->stubs[i].store) {
+            emit_st16i(j, OFF_IR, j->stubs[i].ir);
+        }
+        emit_exit(j, j->stubs[i].pc, j->stubs[i].cycles);
+    }
+
+    for (i = start >> PAGE_SHIFT; i <= (insns[n - 1].addr >> PAGE_SHIFT); i++) {
+        j->code_pages[i] = 1;
+    }
+
+    return entry;
+}
+
+/*
+ * Discard all translated code.
+ */
+static void flush(struct jit_state *j)
+{
+    j->code_ptr = j->code_base;
+    memset(j->blocks, 0, sizeof(j->blocks));
+    memset(j->code_pages, 0, sizeof(j->code_pages));
+}
+
+/*
+ * Store helper called from translated code.
+ *
+ * @return      nonzero if the store overwrote translated code
+ */
+static int store(struct lc3machine *m, unsigned int addr, unsigned int data,
+                 unsigned int wmask)
+{
+    m->jit->stale = 0;
+    mem_write_nodelay(m, addr, data, wmask);
+    return m->jit->stale;
+}
+
+static inline int sets_cc(int op)
+{
+    return op == OP_ADD || op == OP_AND || op == OP_XOR || op == OP_SHF
+        || op == OP_LEA || op == OP_LDB || op == OP_LDW || op == OP_LDI;
+}
+
+static inline int ends_block(lc3word ir)
+{
+    switch (ir >> 12) {
+        case OP_BR:
+            return (ir & 0x0E00) != 0;
+        case OP_JSR:
+        case OP_JMP:
+        case OP_TRAP:
+            return 1;
+    }
+    return 0;
+}
+
+static inline int touches_mem(int op)
+{
+    return op == OP_LDB || op == OP_STB || op == OP_LDW || op == OP_STW
+        || op == OP_LDI || op == OP_STI;
+}
+
+static inline lc3sword sext(lc3word val, int pos)
+{
+    lc3word mask;
+
+    mask = 1 << (pos - 1);
+    return (lc3sword) ((val ^ mask) - mask);
+}
+
+/* ===== Code Emission ===== */
+
+static inline void emit8(struct jit_state *j, uint8_t b)
+{
+    *j->code_ptr++ = b;
+}
+
+static inline void emit16(struct jit_state *j, uint16_t w)
+{
+    memcpy(j->code_ptr, &w, 2);
+    j->code_ptr += 2;
+}
+
+static inline void emit32(struct jit_state *j, uint32_t d)
+{
+    memcpy(j->code_ptr, &d, 4);
+    j->code_ptr += 4;
+}
+
+static inline void emit64(struct jit_state *j, uint64_t q)
+{
+    memcpy(j->code_ptr, &q, 8);
+    j->code_ptr += 8;
+}
+
+/*
+ * movzx reg, word [rbx+off]
+ */
+static inline void emit_ld16(struct jit_state *j, int reg, int off)
+{
+    emit8(j, 0x0F); emit8(j, 0xB7); emit8(j, 0x43 | (reg << 3)); emit8(j, off);
+}
+
+/*
+ * movsx reg, word [rbx+off]
+ */
+static inline void emit_ld16s(struct jit_state *j, int reg, int off)
+{
+    emit8(j, 0x0F); emit8(j, 0xBF); emit8(j, 0x43 | (reg << 3)); emit8(j, off);
+}
+
+/*
+ * mov word [rbx+off], reg
+ */
+static inline void emit_st16(struct jit_state *j, int reg, int off)
+{
+    emit8(j, 0x66); emit8(j, 0x89); emit8(j, 0x43 | (reg << 3)); emit8(j, off);
+}
+
+/*
+ * mov word [rbx+off], imm
+ */
+static inline void emit_st16i(struct jit_state *j, int off, lc3word imm)
+{
+    emit8(j, 0x66); emit8(j, 0xC7); emit8(j, 0x43); emit8(j, off);
+    emit16(j, imm);
+}
+
+/*
+ * mov reg, imm
+ */
+static inline void emit_movi(struct jit_state *j, int reg, uint32_t imm)
+{
+    emit8(j, 0xB8 + reg); emit32(j, imm);
+}
+
+/*
+ * mov dst, src
+ */
+static inline void emit_mov(struct jit_state *j, int dst, int src)
+{
+    emit8(j, 0x89); emit8(j, 0xC0 | (src << 3) | dst);
+}
+
+/*
+ * add/and/xor/cmp reg, imm
+ */
+static inline void emit_alu(struct jit_state *j, int ext, int reg, int32_t imm)
+{
+    emit8(j, 0x81); emit8(j, 0xC0 | (ext << 3) | reg); emit32(j, imm);
+}
+
+/*
+ * shl/shr/sar reg, n
+ */
+static inline void emit_shift(struct jit_state *j, int ext, int reg, int n)
+{
+    emit8(j, 0xC1); emit8(j, 0xC0 | (ext << 3) | reg); emit8(j, n);
+}
+
+/*
+ * Load the RAM word at 'addr' (EAX, ECX or EDX) through the page table.
+ * Clobbers RDI, and 'addr' if it is also 'dst'.
+ *
+ * mov edi, addr; shr edi, MEM_PAGE_SHIFT; mov rdi, [r12+rdi*8];
+ * movzx dst, addr8; movzx dst, word [rdi+dst]
+ */
+static inline void emit_ldram(struct jit_state *j, int dst, int addr)
+{
+    emit_mov(j, EDI, addr);
+    emit_shift(j, G2_SHR, EDI, MEM_PAGE_SHIFT);
+    emit8(j, 0x49); emit8(j, 0x8B); emit8(j, 0x3C); emit8(j, 0xFC);
+    emit8(j, 0x0F); emit8(j, 0xB6); emit8(j, 0xC0 | (dst << 3) | addr);
+    emit8(j, 0x0F); emit8(j, 0xB7);
+    emit8(j, 0x04 | (dst << 3)); emit8(j, (dst << 3) | EDI);
+}
+
+/*
+ * jcc rel32
+ *
+ * @return      a pointer to the displacement, for patching
+ */
+static inline uint8_t * emit_jcc(struct jit_state *j, int cc)
+{
+    uint8_t *rel;
+
+    emit8(j, 0x0F); emit8(j, 0x80 | cc);
+    rel = j->code_ptr;
+    emit32(j, 0);
+    return rel;
+}
+
+/*
+ * eax = (R[base] + off) & 0xFFFF
+ */
+static inline void emit_addr(struct jit_state *j, int base, int off)
+{
+    emit_ld16(j, EAX, OFF_R(base));
+    if (off != 0) {
+        emit_alu(j, G1_ADD, EAX, off);
+        emit8(j, 0x0F); emit8(j, 0xB7); emit8(j, 0xC0);  /* movzx eax, ax */
+    }
+}
+
+/*
+ * Set the condition codes from ax.
+ */
+static inline void emit_setcc(struct jit_state *j)
+{
+    emit_movi(j, EDX, 0x01);                         /* p */
+    emit_movi(j, ECX, 0x02);                         /* z */
+    emit8(j, 0x66); emit8(j, 0x85); emit8(j, 0xC0);  /* test ax, ax */
+    emit8(j, 0x0F); emit8(j, 0x44); emit8(j, 0xD1);  /* cmovz edx, ecx */
+    emit_movi(j, ECX, 0x04);                         /* n */
+    emit8(j, 0x0F); emit8(j, 0x48); emit8(j, 0xD1);  /* cmovs edx, ecx */
+    emit_ld16(j, ECX, OFF_PSR);
+    emit_alu(j, G1_AND, ECX, 0xFFF8);
+    emit8(j, 0x09); emit8(j, 0xD1);                  /* or ecx, edx */
+    emit_st16(j, ECX, OFF_PSR);
+}
+
+/*
+ * Return from the block: mov eax, cycles; pop r13; pop r12; pop rbx; ret
+ */
+static inline void emit_ret(struct jit_state *j, int cycles)
+{
+    emit_movi(j, EAX, cycles);
+    emit8(j, 0x41); emit8(j, 0x5D);
+    emit8(j, 0x41); emit8(j, 0x5C);
+    emit8(j, 0x5B);
+    emit8(j, 0xC3);
+}
+
+/*
+ * Set the PC and return from the block.
+ */
+static inline void emit_exit(struct jit_state *j, lc3word pc, int cycles)
+{
+    emit_st16i(j, OFF_PC, pc);
+    emit_ret(j, cycles);
+}
+
+/*
+ * Side-exit to the interpreter if an address is in the I/O page, leaving the
+ * instruction at 'pc' unexecuted.
+ */
+static void emit_io_check(struct jit_state *j, int reg, lc3word pc,
+                          int cycles)
+{
+    struct stub *s;
+
+    emit_alu(j, G1_CMP, reg, A_IO);
+
+    s = &j->stubs[j->num_stubs++];
+    s->patch = emit_jcc(j, JCC_AE);
+    s->pc = pc;
+    s->cycles = cycles;
+    s->store = 0;
+}
+
+/*
+ * Call the store helper with the address in eax, data in esi and write mask
+ * in edx, then leave the block if it overwrote translated code.
+ */
+static void emit_store(struct jit_state *j, lc3word next, lc3word ir,
+                       int cycles)
+{
+    struct stub *s;
+
+    emit_mov(j, ECX, EDX);
+    emit_mov(j, EDX, ESI);
+    emit_mov(j, ESI, EAX);
+    emit8(j, 0x4C); emit8(j, 0x89); emit8(j, 0xEF);  /* mov rdi, r13 */
+    emit8(j, 0x48); emit8(j, 0xB8);                  /* mov rax, store */
+    emit64(j, (uint64_t) (uintptr_t) store);
+    emit8(j, 0xFF); emit8(j, 0xD0);                  /* call rax */
+    emit8(j, 0x85); emit8(j, 0xC0);                  /* test eax, eax */
+
+    s = &j->stubs[j->num_stubs++];
+    s->patch = emit_jcc(j, JCC_NZ);
+    s->pc = next;
+    s->ir = ir;
+    s->cycles = cycles;
+    s->store = 1;
+}
+
+#else
+
+int jit_init(struct lc3machine *m)
+{
+    (void) m;
+    return -1;
+}
+
+int jit_exec(struct lc3machine *m, uint64_t room)
+{
+    (void) m;
+    (void) room;
+    return 0;
+}
+
+void jit_invalidate(struct lc3machine *m, lc3word addr)
+{
+    (void) m;
+    (void) addr;
+}
+
+void jit_free(struct lc3machine *m)
+{
+    (void) m;
+}
+
+#endif /* __x86_64__ */
@@ -19,70 +19,298 @@
  *   Desc: Keyboard input device driver.
  *============================================================================*/
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <lc3tools.h>
 #include <emu/kbd.h>
+#include <emu/disp.h>
+#include <emu/machine.h>
 #include <emu/pic.h>
+#include <emu/sched.h>
 
-#define RD()        (kbd.kbsr & KBSR_RD)
-#define SET_RD(x)   (kbd.kbsr = (x)?(kbd.kbsr|KBSR_RD):(kbd.kbsr&~KBSR_RD))
+#ifndef _WIN32
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
+
+#define RD()        (m->kbd.kbsr & KBSR_RD)
+#define SET_RD(x)   (m->kbd.kbsr = (x)?(m->kbd.kbsr|KBSR_RD):(m->kbd.kbsr&~KBSR_RD))
 
-#define IE()        (kbd.kbsr & KBSR_IE)
-#define SET_IE(x)   (kbd.kbsr = (x)?(kbd.kbsr|KBSR_IE):(kbd.kbsr&~KBSR_IE))
+#define IE()        (m->kbd.kbsr & KBSR_IE)
+#define SET_IE(x)   (m->kbd.kbsr = (x)?(m->kbd.kbsr|KBSR_IE):(m->kbd.kbsr&~KBSR_IE))
 
-static struct lc3kbd kbd;
 
+/*
+ * Capacity of the terminal input ring. Must be a power of two.
+ */
+#define RING_SIZE   256
+
+#ifndef _WIN32
+/*
+ * Terminal input ring.
+ * A reader thread blocks on STDIN and pushes each byte it reads; the
+ * keyboard hook pops them, so polling for a key costs two atomic loads
+ * instead of a system call. The ring has one producer and one consumer,
+ * so the terminal hooks must only be used by one machine at a time.
+ */
+static struct {
+    pthread_once_t once;
+    int running;                /* reader thread started */
+    unsigned char buf[RING_SIZE];
+    atomic_uint head;           /* bytes pushed (producer) */
+    atomic_uint tail;           /* bytes popped (consumer) */
+    pthread_mutex_t lock;       /* for waiting on an empty ring */
+    pthread_cond_t ready;       /* signalled after each push */
+} ring = {
+    PTHREAD_ONCE_INIT, 0, { 0 }, 0, 0,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER
+};
+
+static void start_reader(void);
+static void * reader_main(void *arg);
+#endif
+
+static void update_line(struct lc3machine *m);
 static int kbd_hit(void);
 static int read_char(void);
+static lc3word kbsr_read(struct lc3machine *m, lc3word addr);
+static void kbsr_write(struct lc3machine *m, lc3word addr, lc3word data,
+                       lc3word wmask);
+static lc3word kbdr_read(struct lc3machine *m, lc3word addr);
 
-void kbd_reset(void)
+int kbd_init(struct lc3machine *m)
 {
-    memset(&kbd, 0, sizeof(struct lc3kbd));
+    if (mem_map_io(m, A_KBSR, kbsr_read, kbsr_write) != 0
+        || mem_map_io(m, A_KBDR, kbdr_read, NULL) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void kbd_reset(struct lc3machine *m)
+{
+    memset(&m->kbd, 0, sizeof(struct lc3kbd));
 
     SET_IE(1);
     SET_RD(0);
+    m->kbd.taken = 1;
+    update_line(m);
+    sched_soon(m, EV_KBD);
 }
 
-void kbd_tick(void)
+void kbd_event(struct lc3machine *m)
 {
-    unsigned char c;
+    int c;
+
+    c = m->io.getc(m->io.ctx);
+    if (c >= 0) {
+        m->kbd.kbdr = c & 0xFF;
+        m->kbd.taken = 0;
+        SET_RD(1);
+        update_line(m);
+
+        /* Show any prompt before the program reacts to the key */
+        if (m->io.flush != NULL) {
+            m->io.flush(m->io.ctx);
+        }
+    }
 
-    if (kbd_hit()) {
+    sched_at(m, EV_KBD, m->sched.now + KBD_POLL_CYCLES);
+}
+
+lc3word get_kbsr(struct lc3machine *m)
+{
+    return m->kbd.kbsr;
+}
+
+void set_kbsr(struct lc3machine *m, lc3word value)
+{
+    m->kbd.kbsr = value;
+    update_line(m);
+}
+
+lc3word get_kbdr(struct lc3machine *m)
+{
+    /* The next key can be taken as soon as this one has been read */
+    m->kbd.taken = 1;
+    sched_soon(m, EV_KBD);
+    return m->kbd.kbdr;
+}
+
+void set_kbdr(struct lc3machine *m, lc3word value)
+{
+    m->kbd.kbdr = value;
+}
+
+int kbd_term_getc(void *ctx)
+{
+    int c;
+#ifndef _WIN32
+    unsigned int tail;
+#endif
+
+    (void) ctx;
+
+#ifndef _WIN32
+    pthread_once(&ring.once, start_reader);
+    if (ring.running) {
+        tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+        if (tail == atomic_load_explicit(&ring.head, memory_order_acquire)) {
+            return -1;
+        }
+        c = ring.buf[tail & (RING_SIZE - 1)];
+        atomic_store_explicit(&ring.tail, tail + 1, memory_order_release);
+    }
+    else
+#endif
+    {
+        /* No reader thread; poll the terminal */
+        if (!kbd_hit()) {
+            return -1;
+        }
         c = read_char();
-        if (c == 3) {
-            printf("CTRL+C pressed!\r\n");
-            exit(127);
+    }
+
+    if (c == 3) {
+        disp_term_flush(NULL);
+        printf("CTRL+C pressed!\r\n");
+        exit(127);
+    }
+
+    return c;
+}
+
+void kbd_term_wait(void *ctx, int ms)
+{
+#ifndef _WIN32
+    struct timespec until;
+    struct timeval tv;
+    fd_set fds;
+
+    (void) ctx;
+
+    pthread_once(&ring.once, start_reader);
+    if (ring.running) {
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += ms / 1000;
+        until.tv_nsec += (ms % 1000) * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
         }
-        kbd.kbdr = c;
-        SET_RD(1);
+
+        pthread_mutex_lock(&ring.lock);
+        while (atomic_load(&ring.head) == atomic_load(&ring.tail)) {
+            if (pthread_cond_timedwait(&ring.ready, &ring.lock, &until)
+                == ETIMEDOUT) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&ring.lock);
+        return;
     }
 
-    if (RD() && IE()) {
-        raise_irq(KBD_IRQ);
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000L;
+    FD_ZERO(&fds);
+    FD_SET(STDIN_FILENO, &fds);
+
+    select(1, &fds, NULL, NULL, &tv);
+#else
+    (void) ctx;
+
+    WaitForSingleObject(GetStdHandle(STD_INPUT_HANDLE), ms);
+#endif
+}
+
+#ifndef _WIN32
+/*
+ * Start the terminal reader thread. If it cannot be started, the hooks poll
+ * the terminal instead.
+ */
+static void start_reader(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ring.running = (pthread_create(&thread, &attr, reader_main, NULL) == 0);
+    pthread_attr_destroy(&attr);
+}
+
+/*
+ * Terminal reader thread. Runs until STDIN is closed.
+ */
+static void * reader_main(void *arg)
+{
+    struct timespec pause = { 0L, 1000000L };
+    unsigned char c;
+    unsigned int head;
+    ssize_t r;
+
+    (void) arg;
+
+    for (;;) {
+        r = read(STDIN_FILENO, &c, sizeof(unsigned char));
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r != 1) {
+            break;
+        }
+
+        /* Wait for the emulator to take some input if the ring is full */
+        head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+        while (head - atomic_load_explicit(&ring.tail, memory_order_acquire)
+               == RING_SIZE) {
+            nanosleep(&pause, NULL);
+        }
+
+        ring.buf[head & (RING_SIZE - 1)] = c;
+        atomic_store_explicit(&ring.head, head + 1, memory_order_release);
+
+        pthread_mutex_lock(&ring.lock);
+        pthread_cond_signal(&ring.ready);
+        pthread_mutex_unlock(&ring.lock);
     }
+
+    return NULL;
 }
+#endif
 
-lc3word get_kbsr(void)
+/*
+ * I/O register handlers.
+ */
+static lc3word kbsr_read(struct lc3machine *m, lc3word addr)
 {
-    return kbd.kbsr;
+    (void) addr;
+    return get_kbsr(m);
 }
 
-void set_kbsr(lc3word value)
+static void kbsr_write(struct lc3machine *m, lc3word addr, lc3word data,
+                       lc3word wmask)
 {
-    kbd.kbsr = value;
+    (void) addr;
+    set_kbsr(m, WRITE_BITS(get_kbsr(m), data, wmask));
 }
 
-lc3word get_kbdr(void)
+static lc3word kbdr_read(struct lc3machine *m, lc3word addr)
 {
-    return kbd.kbdr;
+    (void) addr;
+    return get_kbdr(m);
 }
 
-void set_kbdr(lc3word value)
+/*
+ * Request an interrupt while a key is waiting and interrupts are enabled.
+ */
+static void update_line(struct lc3machine *m)
 {
-    kbd.kbdr = value;
+    set_irq_line(m, KBD_IRQ, RD() && IE());
 }
 
 static int kbd_hit(void)
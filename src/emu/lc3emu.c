@@ -0,0 +1,300 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: src/emu/lc3emu.c
+ * Author: Wes Hampson
+ *   Desc: liblc3emu interface.
+ *============================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <lc3emu.h>
+#include <emu/lc3.h>
+#include <emu/cpu.h>
+#include <emu/mem.h>
+#include <emu/jit.h>
+#include <emu/aot.h>
+#include <emu/machine.h>
+#include <emu/os.h>
+#include <emu/traps.h>
+
+/*
+ * Library machine state.
+ */
+struct lc3emu {
+    struct lc3machine *m;       /* the machine */
+    enum lc3engine engine;      /* engine that runs it */
+    unsigned char *in;          /* queued keyboard input */
+    size_t in_pos;              /* next byte to deliver */
+    size_t in_len;
+    size_t in_cap;
+    char *out;                  /* display output, or NULL to discard */
+    size_t out_size;
+    size_t out_len;             /* bytes displayed, including dropped ones */
+};
+
+static int emu_getc(void *ctx);
+static void emu_putc(void *ctx, int c);
+
+/* ===== Public Functions ===== */
+
+int lc3emu_version(void)
+{
+    return LC3EMU_API_VERSION;
+}
+
+struct lc3emu * lc3emu_create(void)
+{
+    struct lc3emu *e;
+
+    e = calloc(1, sizeof(struct lc3emu));
+    if (e == NULL) {
+        return NULL;
+    }
+
+    e->m = machine_create();
+    if (e->m == NULL) {
+        free(e);
+        return NULL;
+    }
+    e->engine = ENGINE_MICRO;
+
+    e->m->io.getc = emu_getc;
+    e->m->io.putc = emu_putc;
+    e->m->io.wait = NULL;
+    e->m->io.flush = NULL;
+    e->m->io.ctx = e;
+
+    os_load(e->m);
+    return e;
+}
+
+void lc3emu_destroy(struct lc3emu *e)
+{
+    if (e == NULL) {
+        return;
+    }
+
+    machine_destroy(e->m);
+    free(e->in);
+    free(e);
+}
+
+int lc3emu_set_engine(struct lc3emu *e, enum lc3emu_engine engine)
+{
+    switch (engine) {
+        case LC3EMU_MICRO:
+            e->engine = ENGINE_MICRO;
+            return 0;
+        case LC3EMU_FAST:
+            e->engine = ENGINE_FAST;
+            return 0;
+        case LC3EMU_JIT:
+            if (jit_init(e->m) != 0) {
+                return -1;
+            }
+            e->engine = ENGINE_JIT;
+            return 0;
+        case LC3EMU_AOT:
+            if (e->m->aot == NULL) {
+                return -1;
+            }
+            e->engine = ENGINE_AOT;
+            return 0;
+        case LC3EMU_SIMD:
+            e->engine = ENGINE_SIMD;
+            return 0;
+    }
+
+    return -1;
+}
+
+int lc3emu_load_aot(struct lc3emu *e, const char *path)
+{
+    if (aot_load(e->m, path) != 0) {
+        return -1;
+    }
+
+    e->engine = ENGINE_AOT;
+    return 0;
+}
+
+int lc3emu_native_traps(struct lc3emu *e, int cost)
+{
+    if (cost <= 0) {
+        traps_free(e->m);
+        return 0;
+    }
+
+    return traps_enable(e->m, cost);
+}
+
+int lc3emu_set_memory(struct lc3emu *e, unsigned int kib)
+{
+    return mem_limit(e->m, kib);
+}
+
+int lc3emu_load(struct lc3emu *e, const char *path)
+{
+    lc3word origin;
+
+    if (machine_load(e->m, path, &origin) != 0) {
+        return -1;
+    }
+
+    cpu_setreg(e->m, R_PC, origin);
+    return 0;
+}
+
+int lc3emu_input(struct lc3emu *e, const void *data, size_t len)
+{
+    unsigned char *in;
+    size_t cap;
+
+    /* Drop what has been delivered before growing the queue */
+    if (e->in_pos > 0) {
+        memmove(e->in, e->in + e->in_pos, e->in_len - e->in_pos);
+        e->in_len -= e->in_pos;
+        e->in_pos = 0;
+    }
+
+    if (e->in_len + len > e->in_cap) {
+        cap = e->in_cap ? e->in_cap : 256;
+        while (cap < e->in_len + len) {
+            cap *= 2;
+        }
+        in = realloc(e->in, cap);
+        if (in == NULL) {
+            return -1;
+        }
+        e->in = in;
+        e->in_cap = cap;
+    }
+
+    memcpy(e->in + e->in_len, data, len);
+    e->in_len += len;
+    return 0;
+}
+
+void lc3emu_set_output(struct lc3emu *e, char *buf, size_t size)
+{
+    e->out = buf;
+    e->out_size = (buf != NULL) ? size : 0;
+    e->out_len = 0;
+}
+
+size_t lc3emu_output_len(const struct lc3emu *e)
+{
+    return e->out_len;
+}
+
+enum lc3emu_status lc3emu_run_for(struct lc3emu *e, uint64_t cycles)
+{
+    cpu_run(e->m, e->engine, cycles);
+    return (get_mcr(e->m) & MCR_CE) ? LC3EMU_BUDGET : LC3EMU_HALTED;
+}
+
+enum lc3emu_status lc3emu_run_until(struct lc3emu *e, uint16_t pc,
+                                    uint64_t cycles)
+{
+    struct lc3machine *m;
+    enum lc3engine engine;
+    uint64_t count;
+
+    /* Step an instruction at a time; the microcoded engine can only take
+       single cycles, and every other engine gives the same results as the
+       fast one */
+    m = e->m;
+    engine = (e->engine == ENGINE_MICRO) ? ENGINE_MICRO : ENGINE_FAST;
+    count = 0;
+    while (count < cycles && (get_mcr(m) & MCR_CE)) {
+        count += cpu_run(m, engine, 1);
+        if (IS_FETCH(m->cpu.state) && m->cpu.pc == pc
+            && !m->cpu.intf) {
+            return LC3EMU_BREAK;
+        }
+    }
+
+    return (get_mcr(m) & MCR_CE) ? LC3EMU_BUDGET : LC3EMU_HALTED;
+}
+
+uint64_t lc3emu_cycles(const struct lc3emu *e)
+{
+    return e->m->cpu.cycles;
+}
+
+uint16_t lc3emu_get_reg(struct lc3emu *e, enum lc3emu_reg reg)
+{
+    /* enum lc3emu_reg follows the order of enum lc3reg */
+    return cpu_getreg(e->m, (enum lc3reg) reg);
+}
+
+void lc3emu_set_reg(struct lc3emu *e, enum lc3emu_reg reg, uint16_t value)
+{
+    cpu_setreg(e->m, (enum lc3reg) reg, value);
+}
+
+void lc3emu_read_mem(struct lc3emu *e, uint16_t addr, uint16_t *buf,
+                     size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        mem_read_untimed(e->m, &buf[i], (lc3word) (addr + (i << 1)));
+    }
+}
+
+void lc3emu_write_mem(struct lc3emu *e, uint16_t addr, const uint16_t *buf,
+                      size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        mem_write_untimed(e->m, (lc3word) (addr + (i << 1)), buf[i], 0xFFFF);
+    }
+}
+
+/* ===== Private Functions ===== */
+
+/*
+ * Keyboard hook. Hands over the next queued byte once the program has read
+ * the previous one.
+ */
+static int emu_getc(void *ctx)
+{
+    struct lc3emu *e = ctx;
+
+    if (e->in_pos == e->in_len || !e->m->kbd.taken) {
+        return -1;
+    }
+
+    return e->in[e->in_pos++];
+}
+
+/*
+ * Display hook. Appends to the caller's buffer while there is room.
+ */
+static void emu_putc(void *ctx, int c)
+{
+    struct lc3emu *e = ctx;
+
+    if (e->out_len < e->out_size) {
+        e->out[e->out_len] = (char) c;
+    }
+    e->out_len++;
+}
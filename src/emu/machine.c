@@ -0,0 +1,187 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: src/emu/machine.c
+ * Author: Wes Hampson
+ *   Desc: A complete LC-3c machine: CPU, memory, devices, and engine state.
+ *============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lc3tools.h>
+
+#include <emu/machine.h>
+#include <emu/cpu.h>
+#include <emu/jit.h>
+#include <emu/aot.h>
+#include <emu/traps.h>
+#include <emu/prof.h>
+
+static void copy_state(struct lc3machine *f, struct lc3machine *m);
+
+/* ===== Public Functions ===== */
+
+struct lc3machine * machine_create(void)
+{
+    struct lc3machine *m;
+
+    m = calloc(1, sizeof(struct lc3machine));
+    if (m == NULL) {
+        return NULL;
+    }
+    mem_init(m);
+    if (cpu_init(m) != 0 || pic_init(m) != 0 || kbd_init(m) != 0
+        || disp_init(m) != 0) {
+        machine_destroy(m);
+        return NULL;
+    }
+
+    m->io.getc = kbd_term_getc;
+    m->io.putc = disp_term_putc;
+    m->io.wait = kbd_term_wait;
+    m->io.flush = disp_term_flush;
+    m->io.ctx = NULL;
+
+    machine_reset(m);
+    return m;
+}
+
+void machine_destroy(struct lc3machine *m)
+{
+    if (m == NULL) {
+        return;
+    }
+
+    jit_free(m);
+    aot_unload(m);
+    traps_free(m);
+    prof_free(m);
+    mem_free(m);
+    free(m->dcache);
+    free(m);
+}
+
+struct lc3machine * machine_fork(struct lc3machine *m)
+{
+    struct lc3machine *f;
+
+    f = calloc(1, sizeof(struct lc3machine));
+    if (f == NULL) {
+        return NULL;
+    }
+
+    if (m->traps != NULL) {
+        f->traps = malloc(sizeof(struct lc3traps));
+        if (f->traps == NULL) {
+            free(f);
+            return NULL;
+        }
+        memcpy(f->traps, m->traps, sizeof(struct lc3traps));
+    }
+
+    /* Set up the fork's own engine caches, then take the CPU state */
+    cpu_reset(f);
+    copy_state(f, m);
+    if (mem_share(f, m) != 0) {
+        machine_destroy(f);
+        return NULL;
+    }
+    return f;
+}
+
+void machine_rewind(struct lc3machine *f, struct lc3machine *m)
+{
+    copy_state(f, m);
+    mem_rewind(f, m);
+
+    /* Where the JIT stops on a budget depends on what it has translated, so
+       it starts cold, as on a new fork */
+    if (f->jit != NULL) {
+        jit_init(f);
+    }
+}
+
+void machine_reset(struct lc3machine *m)
+{
+    /* The PIC goes first, as the devices drive its request lines */
+    sched_reset(m);
+    idle_reset(m);
+    pic_reset(m);
+    mem_reset(m);
+    kbd_reset(m);
+    disp_reset(m);
+    cpu_reset(m);
+}
+
+void machine_fill(struct lc3machine *m, lc3word addr, const lc3word *data,
+                  int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        mem_write_nodelay(m, addr + (i << 1), data[i], 0xFFFF);
+    }
+}
+
+int machine_load(struct lc3machine *m, const char *path, lc3word *origin)
+{
+    lc3word *words;
+    int count;
+
+    words = malloc(OBJ_MAX_WORDS * sizeof(lc3word));
+    if (words == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+
+    count = read_object(path, origin, words);
+    if (count > 0 && (!mem_backed(m, *origin)
+                      || !mem_backed(m, *origin + 2 * (count - 1)))) {
+        fprintf(stderr, "error: '%s' does not fit in memory\n", path);
+        count = -1;
+    }
+    if (count >= 0) {
+        machine_fill(m, *origin, words, count);
+    }
+
+    free(words);
+    return (count < 0) ? -1 : 0;
+}
+
+/* ===== Private Functions ===== */
+
+/*
+ * Copy the CPU, memory control, device and I/O hook state of one machine to
+ * another. Memory contents are left to the caller.
+ */
+static void copy_state(struct lc3machine *f, struct lc3machine *m)
+{
+    f->cpu = m->cpu;
+    f->mem.done = m->mem.done;
+    f->mem.writes = m->mem.writes;
+    f->mem.r_en = m->mem.r_en;
+    f->mem.w_en = m->mem.w_en;
+    f->mem.ram_pages = m->mem.ram_pages;
+    f->pic = m->pic;
+    f->kbd = m->kbd;
+    f->disp = m->disp;
+    f->sched = m->sched;
+    f->idle = m->idle;
+    f->io = m->io;
+}
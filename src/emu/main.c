@@ -31,71 +31,50 @@
 #include <emu/kbd.h>
 #include <emu/disp.h>
 #include <emu/pic.h>
-
-/* Instruction encodings */
-#define _NOP                0
-#define _AND(dr,sr1,sr2)    (OP_AND<<12|dr<<9|sr1<<6|sr2&7)
-#define _ANDi(dr,sr1,imm)   (OP_AND<<12|dr<<9|sr1<<6|0x20|imm&0x1F)
-#define _ADD(dr,sr1,sr2)    (OP_ADD<<12|dr<<9|sr1<<6|sr2&7)
-#define _ADDi(dr,sr1,imm)   (OP_ADD<<12|dr<<9|sr1<<6|0x20|imm&0x1F)
-#define _NOT(dr,sr)         (OP_XOR<<12|dr<<9|sr<<6|0x3F)
-#define _XOR(dr,sr1,sr2)    (OP_XOR<<12|dr<<9|sr1<<6|sr2&7)
-#define _XORi(dr,sr1,imm)   (OP_XOR<<12|dr<<9|sr1<<6|0x20|imm&0x1F)
-#define _LSHF(dr,sr,imm)    (OP_SHF<<12|dr<<9|sr<<6|imm&0xF)
-#define _RSHFL(dr,sr,imm)   (OP_SHF<<12|dr<<9|sr<<6|0x10|imm&0xF)
-#define _RSHFA(dr,sr,imm)   (OP_SHF<<12|dr<<9|sr<<6|0x30|imm&0xF)
-#define _BRn(pcoff)         (OP_BR<<12|0x800|pcoff&0x1FF)
-#define _BRz(pcoff)         (OP_BR<<12|0x400|pcoff&0x1FF)
-#define _BRp(pcoff)         (OP_BR<<12|0x200|pcoff&0x1FF)
-#define _BRnz(pcoff)        (OP_BR<<12|0xC00|pcoff&0x1FF)
-#define _BRnp(pcoff)        (OP_BR<<12|0xA00|pcoff&0x1FF)
-#define _BRzp(pcoff)        (OP_BR<<12|0x600|pcoff&0x1FF)
-#define _BRnzp(pcoff)       (OP_BR<<12|0xE00|pcoff&0x1FF)
-#define _TRAP(vec)          (OP_TRAP<<12|vec)
-#define _JSR(off)           (OP_JSR<<12|0x800|off)
-#define _JSRR(br)           (OP_JSR<<12|br<<6)
-#define _JMP(br)            (OP_JMP<<12|br<<6)
-#define _RET()              (OP_JMP<<12|0x1C0)
-#define _RTI()              (OP_RTI<<12)
-#define _LEA(dr,pcoff)      (OP_LEA<<12|dr<<9|pcoff&0x1FF)
-#define _LDB(dr,br,off)     (OP_LDB<<12|dr<<9|br<<6|off&0x3F)
-#define _LDW(dr,br,off)     (OP_LDW<<12|dr<<9|br<<6|off&0x3F)
-#define _LDI(dr,br,off)     (OP_LDI<<12|dr<<9|br<<6|off&0x3F)
-#define _STB(sr,br,off)     (OP_STB<<12|sr<<9|br<<6|off&0x3F)
-#define _STW(sr,br,off)     (OP_STW<<12|sr<<9|br<<6|off&0x3F)
-#define _STI(sr,br,off)     (OP_STI<<12|sr<<9|br<<6|off&0x3F)
-#define _PUSH(sr)           _ADDi(R6, R6, -2),  _STW(sr, R6, 0)
-#define _POP(dr)            _LDW(dr, R6, 0),    _ADDi(R6, R6, 2)
-
-/* Register names */
-#define R0  (R_0)
-#define R1  (R_1)
-#define R2  (R_2)
-#define R3  (R_3)
-#define R4  (R_4)
-#define R5  (R_5)
-#define R6  (R_6)
-#define R7  (R_7)
+#include <emu/jit.h>
+#include <emu/aot.h>
+#include <emu/machine.h>
+#include <emu/os.h>
+#include <emu/batch.h>
+#include <emu/simd.h>
+#include <emu/headless.h>
+#include <emu/traps.h>
+#include <emu/snapshot.h>
+#include <emu/cache.h>
+#include <emu/prof.h>
+#include <emu/sample.h>
 
 /**
  * TODO:
  * POSSIBLE COMMAND-LINE OPTIONS
  * Usage: lc3emu [options] executable
- *   --memory <KiB>   available memory (default 64 KiB, max 64 KiB)
- *   --help
  *   --version
  */
 
-static inline void dev_tick(void);
-
-static void write_word(lc3word addr, lc3word data);
-static void fill_mem(lc3word addr, const lc3word *data, int n);
-
 static void usage(const char *prog_name);
+static void help(const char *prog_name);
+static int run_headless(enum lc3engine engine, const char *input,
+                        const char *output, uint64_t key_rate,
+                        uint64_t max_cycles);
+static void run(enum lc3engine engine, uint64_t max_cycles);
 
 static void enter_raw_mode(void);
 static void leave_raw_mode(void);
 static void register_hooks(void);
+static void dump_machine(void);
+static void flush_output(void);
+static void print_mem_stats(FILE *f);
+static void write_profile(void);
+static void write_samples(void);
+
+static struct lc3machine *machine;
+static const char *save_path;
+static const char *profile_path;
+static const char *stacks_path;
+static const char *sample_path;
+static struct lc3sampler sampler;
+static uint64_t checkpoint;
+static int mem_stats_wanted;
 
 #ifndef _WIN32
 static struct termios orig_termios;
@@ -103,139 +82,461 @@ static struct termios orig_termios;
 static DWORD fdwSaveOldMode;
 #endif
 
-#define OS_ADDR         0x0400
-#define DISP_ISR        0x0500
-#define KBD_ISR         0x0600
-
-const lc3word os_code[] =
+static const char * const ENGINE_NAMES[NUM_ENGINES] =
 {
-    /* == Operating System Code == */
-    /* Disable interrupts from the display device, then spin forever. */
-
-    /* Code */
-    _LEA(R0, 5),
-    _LDW(R2, R0, 3),    /* r2 = mask                            */
-    _LDW(R3, R0, 2),    /* r3 = cmd                             */
-    _STI(R2, R0, 1),    /* *icdr_addr = r2                      */
-    _STI(R3, R0, 0),    /* *iccr_addr = r3                      */
-    _BRnzp(-1),
-
-    /* Data */
-    A_ICCR,             /* iccr_addr */
-    A_ICDR,             /* icdr_addr */
-    PIC_CMD_IMR_W,      /* cmd: write PIC mask register         */
-    (1 << DISP_IRQ)     /* mask: display device IRQ bit         */
+    "micro",    /* ENGINE_MICRO */
+    "fast",     /* ENGINE_FAST */
+    "jit",      /* ENGINE_JIT */
+    "aot",      /* ENGINE_AOT */
+    "simd"      /* ENGINE_SIMD */
 };
 
-const lc3word isr3_code[] =
+int main(int argc, char *argv[])
 {
-    /* == Display Device ISR Code == */
-    /* Continually write NUL. This interrupt will keep firing as long as the
-       display device is ready to take a character. To prevent it from eating
-       up CPU cycles, keep writing NUL until we get a chance to mask interrupts
-       from the display device.
-    */
-
-    /* Code */
-    _PUSH(R0),
-    _PUSH(R1),
-    _LEA(R0, 7),
-    _LDW(R1, R0, 1),    /* r1 = nul                             */
-    _STI(R1, R0, 0),    /* *ddr_addr = r1                       */
-    _POP(R1),
-    _POP(R0),
-    _RTI(),
-
-    /* Data */
-    A_DDR,              /* ddr_addr                             */
-    0x0000,             /* nul                                  */
-};
+    enum lc3engine engine;
+    const char *image;
+    const char *module;
+    const char *manifest;
+    const char *results;
+    const char *serve;
+    const char *cache_dir;
+    const char *snapshot;
+    const lc3word *words;
+    unsigned int size;
+    lc3word origin;
+    const char *input;
+    const char *output;
+    uint64_t key_rate;
+    uint64_t max_cycles;
+    uint64_t cache_size;
+    struct lc3cache *cache;
+    int engine_set;
+    int headless;
+    unsigned int memory;
+    int trap_cost;
+    uint64_t interval;
+    int flush_ms;
+    int writer;
+    int i, n;
+
+    engine = ENGINE_MICRO;
+    engine_set = 0;
+    image = NULL;
+    module = NULL;
+    manifest = NULL;
+    results = "-";
+    serve = NULL;
+    cache_dir = NULL;
+    cache_size = CACHE_SIZE;
+    snapshot = NULL;
+    input = "-";
+    output = "-";
+    key_rate = 0;
+    max_cycles = UINT64_MAX;
+    headless = 0;
+    memory = 0;
+    trap_cost = 0;
+    interval = SAMPLE_INTERVAL;
+    flush_ms = DISP_FLUSH_MS;
+    writer = 1;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            help(argv[0]);
+            return 0;
+        }
+        else if (strncmp(argv[i], "--engine=", 9) == 0) {
+            for (n = 0; n < NUM_ENGINES; n++) {
+                if (strcmp(argv[i] + 9, ENGINE_NAMES[n]) == 0) {
+                    break;
+                }
+            }
+            if (n == NUM_ENGINES) {
+                fprintf(stderr, "error: unknown engine '%s'\n", argv[i] + 9);
+                return 1;
+            }
+            engine = (enum lc3engine) n;
+            engine_set = 1;
+        }
+        else if (strncmp(argv[i], "--aot=", 6) == 0) {
+            module = argv[i] + 6;
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            manifest = argv[++i];
+        }
+        else if (strcmp(argv[i], "--results") == 0 && i + 1 < argc) {
+            results = argv[++i];
+        }
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+            cache_size = strtoull(argv[++i], NULL, 0) << 20;
+            if (cache_size == 0) {
+                fprintf(stderr, "error: --cache-size must be at least "
+                                "1 MiB\n");
+                return 1;
+            }
+        }
+        else if (strncmp(argv[i], "--flush=", 8) == 0) {
+            flush_ms = atoi(argv[i] + 8);
+        }
+        else if (strcmp(argv[i], "--no-writer") == 0) {
+            writer = 0;
+        }
+        else if (strcmp(argv[i], "--native-traps") == 0) {
+            trap_cost = TRAP_COST;
+        }
+        else if (strncmp(argv[i], "--native-traps=", 15) == 0) {
+            trap_cost = atoi(argv[i] + 15);
+        }
+        else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) {
+            memory = (unsigned int) strtoul(argv[++i], NULL, 0);
+            if (memory == 0 || memory > (MEM_SIZE >> 10)) {
+                fprintf(stderr, "error: --memory must be 1 to %d KiB\n",
+                        MEM_SIZE >> 10);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--profile-stacks") == 0 && i + 1 < argc) {
+            stacks_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) {
+            sample_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--sample-interval") == 0 && i + 1 < argc) {
+            interval = strtoull(argv[++i], NULL, 0);
+            if (interval == 0) {
+                fprintf(stderr, "error: --sample-interval must be at least "
+                                "1 cycle\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--mem-stats") == 0) {
+            mem_stats_wanted = 1;
+        }
+        else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot = argv[++i];
+        }
+        else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc) {
+            save_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            checkpoint = strtoull(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "--headless") == 0) {
+            headless = 1;
+        }
+        else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            input = argv[++i];
+            headless = 1;
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+            headless = 1;
+        }
+        else if (strcmp(argv[i], "--key-rate") == 0 && i + 1 < argc) {
+            key_rate = strtoull(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "--max-cycles") == 0 && i + 1 < argc) {
+            max_cycles = strtoull(argv[++i], NULL, 0);
+        }
+        else if (argv[i][0] == '-' || image != NULL) {
+            usage(argv[0]);
+            return 1;
+        }
+        else {
+            image = argv[i];
+        }
+    }
 
-const lc3word isr4_code[] =
-{
-    /* == Keyboard ISR Code == */
-    /* Clears the 'ready' bit in KBSR, then displays the character typed by
-       writing the value of KBDR to DDR. */
-
-    /* Code */
-    _PUSH(R0),
-    _PUSH(R1),
-    _PUSH(R2),
-    _LEA(R0, 13),
-    _LDI(R1, R0, 0),        /* kbsr = *kbsr_addr                */
-    _LDW(R2, R0, 1),        /* mask = kbsr_mask                 */
-    _AND(R1, R1, R2),       /* kbsr &= mask                     */
-    _STI(R1, R0, 0),        /* *kbsr_addr = kbsr                */
-    _LDI(R1, R0, 2),        /* char c = *kbdr_addr              */
-    _STI(R1, R0, 3),        /* *ddr_addr = c;                   */
-    _POP(R2),
-    _POP(R1),
-    _POP(R0),
-    _RTI(),
-
-    /* Data */
-    A_KBSR,                 /* kbsr_addr                        */
-    0x7FFF,                 /* kbsr_mask                        */
-    A_KBDR,                 /* kbdr_addr                        */
-    A_DDR                   /* ddr_addr                         */
-};
+    /* A translated module implies the engine that runs it */
+    if (module != NULL && !engine_set) {
+        engine = ENGINE_AOT;
+    }
+    if (engine == ENGINE_AOT && module == NULL) {
+        fprintf(stderr, "error: --engine=aot needs a module (--aot=<file>)\n");
+        return 1;
+    }
+    if (checkpoint > 0 && save_path == NULL) {
+        fprintf(stderr, "error: --checkpoint needs a file "
+                        "(--save-snapshot <file>)\n");
+        return 1;
+    }
 
-int main(int argc, char *argv[])
-{
-    register_hooks();
-    enter_raw_mode();
+    if ((profile_path != NULL || stacks_path != NULL || sample_path != NULL)
+        && (serve != NULL || manifest != NULL)) {
+        fprintf(stderr, "error: %s needs a single program\n",
+                (profile_path != NULL) ? "--profile"
+                : (stacks_path != NULL) ? "--profile-stacks" : "--sample");
+        return 1;
+    }
+    if (cache_dir != NULL && serve == NULL && manifest == NULL) {
+        fprintf(stderr, "error: --cache needs --batch or --serve\n");
+        return 1;
+    }
+    cache = NULL;
+    if (cache_dir != NULL) {
+        cache = cache_open(cache_dir, cache_size);
+        if (cache == NULL) {
+            return 2;
+        }
+    }
 
-    /* Reset machine state */
-    mem_reset();
-    kbd_reset();
-    disp_reset();
-    pic_reset();
-    cpu_reset();
+    if (serve != NULL) {
+        if (image != NULL || manifest != NULL || save_path != NULL) {
+            usage(argv[0]);
+            return 1;
+        }
+        return batch_serve(serve, engine, module, snapshot, memory,
+                           trap_cost, cache, 0);
+    }
+    if (manifest != NULL) {
+        if (image != NULL || save_path != NULL) {
+            usage(argv[0]);
+            return 1;
+        }
+        n = batch_run(manifest, results, engine, module, snapshot, memory,
+                      trap_cost, cache, 0);
+        cache_close(cache);
+        if (mem_stats_wanted) {
+            print_mem_stats(stderr);
+        }
+        return n;
+    }
+    machine = machine_create();
+    if (machine == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        return 2;
+    }
 
-    /* Initialize IVT */
-    write_word(A_IVT | ((IRQ_BASE | DISP_IRQ) << 1), DISP_ISR);
-    write_word(A_IVT | ((IRQ_BASE | KBD_IRQ) << 1), KBD_ISR);
+    if (memory != 0) {
+        mem_limit(machine, memory);
+    }
 
-    /* Write OS and ISR code to RAM */
-    fill_mem(OS_ADDR, os_code, sizeof(os_code) / sizeof(lc3word));
-    fill_mem(DISP_ISR, isr3_code, sizeof(isr3_code) / sizeof(lc3word));
-    fill_mem(KBD_ISR, isr4_code, sizeof(isr4_code) / sizeof(lc3word));
+    if (trap_cost > 0 && traps_enable(machine, trap_cost) != 0) {
+        fprintf(stderr, "error: out of memory\n");
+        return 2;
+    }
 
-    /* Go! */
-    while (get_mcr() & MCR_CE) {
-        dev_tick();
-        cpu_tick();
+    if (module != NULL && aot_load(machine, module) != 0) {
+        return 2;
+    }
+
+    if (engine == ENGINE_JIT && jit_init(machine) != 0) {
+        fprintf(stderr, "warning: jit not supported on this host, "
+                        "using fast engine\n");
+        engine = ENGINE_FAST;
+    }
+
+    /* A snapshot replaces the OS and anything else loaded when it was saved */
+    if (snapshot != NULL) {
+        if (snapshot_load(machine, snapshot) != 0) {
+            return 2;
+        }
+    }
+    else {
+        os_load(machine);
+    }
+
+    /* Load the user program, if any, and start there instead of the OS */
+    if (image != NULL) {
+        if (machine_load(machine, image, &origin) != 0) {
+            return 2;
+        }
+        cpu_setreg(machine, R_PC, origin);
+    }
+    else if (snapshot == NULL
+        && (words = aot_image(machine, &origin, &size)) != NULL) {
+        machine_fill(machine, origin, words, size);
+        cpu_setreg(machine, R_PC, origin);
     }
 
-    return 0;
+    if (profile_path != NULL || stacks_path != NULL) {
+        if (prof_enable(machine) != 0) {
+            fprintf(stderr, "error: out of memory\n");
+            return 2;
+        }
+        atexit(write_profile);
+    }
+    if (sample_path != NULL) {
+        if (sampler_init(&sampler, interval) != 0) {
+            fprintf(stderr, "error: out of memory\n");
+            return 2;
+        }
+        atexit(write_samples);
+    }
+
+    if (headless) {
+        return run_headless(engine, input, output, key_rate, max_cycles);
+    }
+
+    disp_term_setup(flush_ms, writer);
+    register_hooks();
+    enter_raw_mode();
+
+    /* Go! */
+    run(engine, max_cycles);
+
+    /* Out of cycles before the program halted */
+    return (get_mcr(machine) & MCR_CE) ? 3 : 0;
 }
 
-static inline void dev_tick(void)
+static void usage(const char *prog_name)
 {
-    mem_tick();
-    kbd_tick();
-    disp_tick();
-    pic_tick();
+    printf("Usage: %s [options] executable\n", prog_name);
+    printf("Run '%s --help' for options.\n", prog_name);
 }
 
-static void write_word(lc3word addr, lc3word data)
+static void help(const char *prog_name)
 {
-    mem_write_nodelay(addr, data, 0xFFFF);
+    printf("Usage: %s [options] [executable]\n", prog_name);
+    printf("Options:\n");
+    printf("  --engine=<name>  execution engine (default micro)\n");
+    printf("                     micro  microcoded, one state per cycle\n");
+    printf("                     fast   one instruction per dispatch\n");
+    printf("                     jit    hot code translated to x86-64\n");
+    printf("                     aot    code translated by lc3aot\n");
+    printf("                     simd   --batch jobs run %d at a time in\n",
+           SIMD_LANES);
+    printf("                            lockstep, one per vector lane\n");
+    printf("  --aot=<file>     load a module built by lc3aot; implies\n");
+    printf("                     --engine=aot, and runs the image it was\n");
+    printf("                     built from if no executable is given\n");
+    printf("  --batch <file>   run every job in a manifest (one 'image input\n");
+    printf("                     cycles' line per job) across all cores\n");
+    printf("  --results <file> where --batch writes results (default stdout)\n");
+    printf("  --serve <socket> run jobs sent to a Unix domain socket, one\n");
+    printf("                     connection per core at a time\n");
+    printf("  --cache <dir>    with --batch or --serve, reuse the results\n");
+    printf("                     of identical jobs, kept in a directory\n");
+    printf("                     any number of processes may share\n");
+    printf("  --cache-size <MiB>\n");
+    printf("                   size limit of the cache, least recently used\n");
+    printf("                     results evicted first (default %llu MiB)\n",
+           CACHE_SIZE >> 20);
+    printf("  --flush=<ms>     longest output stays buffered (default %d ms);\n",
+           DISP_FLUSH_MS);
+    printf("                     0 writes each character when displayed\n");
+    printf("  --no-writer      write output from the emulator thread, not\n");
+    printf("                     a background writer thread\n");
+    printf("  --native-traps[=<n>]\n");
+    printf("                   run the GETC, OUT, PUTS, PUTSP and HALT traps\n");
+    printf("                     (x20-x22, x24, x25) on the host, charging n\n");
+    printf("                     cycles each (default %d)\n", TRAP_COST);
+    printf("  --memory <KiB>   RAM from address 0 (default %d KiB); above it,\n",
+           MEM_SIZE >> 10);
+    printf("                     reads return 0 and writes are lost\n");
+    printf("  --mem-stats      report memory use on exit\n");
+    printf("  --profile <file> count cycles and instructions by guest\n");
+    printf("                     address and function, and write them on\n");
+    printf("                     exit; profiled runs use the micro engine\n");
+    printf("  --profile-stacks <file>\n");
+    printf("                   write cycles by call stack on exit, in the\n");
+    printf("                     collapsed form flame graph tools read\n");
+    printf("  --sample <file>  sample the PC every so many cycles, on any\n");
+    printf("                     engine, and write a histogram on exit\n");
+    printf("  --sample-interval <n>\n");
+    printf("                   mean cycles between samples (default %d)\n",
+           SAMPLE_INTERVAL);
+    printf("  --snapshot <file>\n");
+    printf("                   start from a saved machine instead of booting\n");
+    printf("                     the OS; with --batch, every job does\n");
+    printf("  --save-snapshot <file>\n");
+    printf("                   save the machine when the run ends\n");
+    printf("  --checkpoint <n> also save it every n cycles while running\n");
+    printf("  --headless       run without a terminal: keys come from --input,\n");
+    printf("                     display goes to --output, registers to\n");
+    printf("                     stderr\n");
+    printf("  --input <file>   keyboard input for --headless (default stdin)\n");
+    printf("  --output <file>  display output for --headless (default stdout)\n");
+    printf("  --key-rate <n>   with --headless, deliver keys at least n cycles\n");
+    printf("                     apart (default 0: as soon as each is read)\n");
+    printf("  --max-cycles <n> stop after n cycles; exits with status 3 if the\n");
+    printf("                     program has not halted\n");
+    printf("  --help           show this message\n");
 }
 
-static void fill_mem(lc3word addr, const lc3word *data, int n)
+/*
+ * Run the machine with headless I/O and no terminal setup.
+ */
+static int run_headless(enum lc3engine engine, const char *input,
+                        const char *output, uint64_t key_rate,
+                        uint64_t max_cycles)
 {
-    int i;
+    struct headless io;
+    FILE *in, *out;
+
+    in = stdin;
+    if (strcmp(input, "-") != 0 && (in = fopen(input, "rb")) == NULL) {
+        fprintf(stderr, "error: failed to open '%s'\n", input);
+        return 2;
+    }
 
-    for (i = 0; i < n; i++) {
-        mem_write_nodelay(addr + (i << 1), data[i], 0xFFFF);
+    out = stdout;
+    if (strcmp(output, "-") != 0 && (out = fopen(output, "wb")) == NULL) {
+        fprintf(stderr, "error: failed to open '%s'\n", output);
+        return 2;
     }
+    setvbuf(out, NULL, _IOFBF, 1 << 16);
+
+    headless_attach(&io, machine, in, out, key_rate);
+    run(engine, max_cycles);
+    headless_detach(&io);
+
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    cpu_fdumpregs(machine, stderr);
+    if (mem_stats_wanted) {
+        print_mem_stats(stderr);
+    }
+    return (get_mcr(machine) & MCR_CE) ? 3 : 0;
 }
 
-static void usage(const char *prog_name)
+/*
+ * Run the machine until it halts or 'max_cycles' are spent. With
+ * --save-snapshot, the machine is saved every 'checkpoint' cycles (if set)
+ * and once more at the end. With --sample, the run stops for each sample.
+ */
+static void run(enum lc3engine engine, uint64_t max_cycles)
 {
-    printf("Usage: %s [options] executable\n", prog_name);
-    printf("Run '%s --help' for options.\n", prog_name);
+    uint64_t to_save;
+    uint64_t to_sample;
+    uint64_t n;
+    int done;
+
+    to_save = (checkpoint > 0) ? checkpoint : UINT64_MAX;
+    to_sample = (sample_path != NULL) ? sampler_next(&sampler) : UINT64_MAX;
+    do {
+        n = max_cycles;
+        n = (to_save < n) ? to_save : n;
+        n = (to_sample < n) ? to_sample : n;
+        n = cpu_run(machine, engine, n);
+        max_cycles -= (n < max_cycles) ? n : max_cycles;
+        to_save -= (n < to_save) ? n : to_save;
+        to_sample -= (n < to_sample) ? n : to_sample;
+        done = max_cycles == 0 || !(get_mcr(machine) & MCR_CE);
+
+        if (to_sample == 0) {
+            sampler_take(&sampler, machine);
+            to_sample = sampler_next(&sampler);
+        }
+        if (save_path != NULL && (to_save == 0 || done)) {
+            snapshot_save(machine, save_path);
+            to_save = (checkpoint > 0) ? checkpoint : UINT64_MAX;
+        }
+    } while (!done);
 }
 
 static void enter_raw_mode(void)
@@ -287,5 +588,83 @@ static void leave_raw_mode(void)
 static void register_hooks()
 {
     atexit(leave_raw_mode);
-    atexit(cpu_dumpregs);
+    atexit(dump_machine);
+    atexit(flush_output);
+}
+
+static void dump_machine(void)
+{
+    cpu_dumpregs(machine);
+    if (mem_stats_wanted) {
+        print_mem_stats(stdout);
+    }
+}
+
+/*
+ * Report the pages the machine has written or, after a batch, the most pages
+ * allocated at once by all jobs.
+ */
+static void print_mem_stats(FILE *f)
+{
+    struct lc3memstats s;
+    int64_t peak;
+
+    if (machine != NULL) {
+        mem_stats(machine, &s);
+        fprintf(f, "Memory: %d pages written (%d bytes), %d shared\r\n",
+                s.pages, s.pages * MEM_PAGE_SIZE, s.shared);
+    }
+    else {
+        mem_allocated(&peak);
+        fprintf(f, "Memory: at most %lld pages (%lld bytes) in use\r\n",
+                (long long) peak, (long long) peak * MEM_PAGE_SIZE);
+    }
+}
+
+/*
+ * Write the profile reports asked for.
+ */
+static void write_profile(void)
+{
+    FILE *f;
+
+    if (profile_path != NULL) {
+        if ((f = fopen(profile_path, "w")) == NULL) {
+            fprintf(stderr, "error: failed to open '%s'\n", profile_path);
+        }
+        else {
+            prof_write_flat(machine, f);
+            fclose(f);
+        }
+    }
+    if (stacks_path != NULL) {
+        if ((f = fopen(stacks_path, "w")) == NULL) {
+            fprintf(stderr, "error: failed to open '%s'\n", stacks_path);
+        }
+        else {
+            prof_write_stacks(machine, f);
+            fclose(f);
+        }
+    }
+}
+
+/*
+ * Write the sample histogram.
+ */
+static void write_samples(void)
+{
+    FILE *f;
+
+    if ((f = fopen(sample_path, "w")) == NULL) {
+        fprintf(stderr, "error: failed to open '%s'\n", sample_path);
+        return;
+    }
+    sampler_write(&sampler, f);
+    fclose(f);
+    sampler_free(&sampler);
+}
+
+static void flush_output(void)
+{
+    disp_term_flush(NULL);
 }
@@ -21,132 +21,417 @@
  *         manipulating the write mask.
  *============================================================================*/
 
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
 
 #include <emu/mem.h>
+#include <emu/machine.h>
 #include <emu/cpu.h>
-#include <emu/kbd.h>
-#include <emu/disp.h>
-#include <emu/pic.h>
 
 /*
- * Overwrite the bits of a value based on a write mask.
- *
- * @param src   data with bits to overwrite
- * @param data  data with bits to be written
- * @param wmask write mask
+ * Register handlers per page.
  */
-#define WRITE_BITS(src,data,wmask)  ((src & ~wmask) | (data & wmask))
+#define IO_REGS     (MEM_PAGE_SIZE / 2)
 
-static inline void do_read(lc3word *data, lc3word addr);
-static inline void do_write(lc3word addr, lc3word data, lc3word wmask);
+/*
+ * A page of RAM. Machines hold pointers to 'd'; 'refs' counts them.
+ */
+struct lc3page {
+    atomic_int refs;                /* machines sharing the page */
+    lc3word d[MEM_PAGE_SIZE / 2];   /* data */
+};
 
-static struct lc3mem m;
+/*
+ * Every page that has never been written. It is not reference-counted, and
+ * its count stays 0, so any write to it takes the copy-on-write path.
+ */
+static struct lc3page zero_page;
 
-void mem_reset(void)
+/*
+ * Pages allocated by all machines, now and at most.
+ */
+static atomic_llong live_pages;
+static atomic_llong peak_pages;
+
+/*
+ * Get the page holding a data pointer.
+ */
+#define PAGE_OF(data) ((struct lc3page *) ((char *) (data) \
+                                           - offsetof(struct lc3page, d)))
+
+static lc3word * new_page(const lc3word *src);
+static void put_page(lc3word *d);
+static lc3word * unshare(struct lc3machine *m, int n);
+static inline const struct lc3mmio * find_io(struct lc3machine *m,
+                                             lc3word addr);
+static inline void do_read(struct lc3machine *m, lc3word *data, lc3word addr);
+static inline void do_write(struct lc3machine *m, lc3word addr, lc3word data,
+                            lc3word wmask);
+
+void mem_reset(struct lc3machine *m)
+{
+    m->mem.done = 0;
+    m->mem.r_en = 0;
+    m->mem.w_en = 0;
+}
+
+int mem_ready(struct lc3machine *m)
 {
-    m.c = 0;
-    m.r_en = 0;
-    m.w_en = 0;
+    return m->sched.now >= m->mem.done;
+}
+
+int mem_read(struct lc3machine *m, lc3word *data, lc3word addr)
+{
+    const struct lc3mmio *io;
+
+    if (!m->mem.r_en) {
+        m->mem.r_en = 1;
+        m->mem.done = m->sched.now + MEM_DELAY;
+    }
+    else if (mem_ready(m)) {
+        m->mem.r_en = 0;
+        io = find_io(m, addr);
+        if (io != NULL && io->read != NULL) {
+            *data = io->read(m, addr);
+        }
+        else {
+            do_read(m, data, addr);
+        }
+    }
+
+    return !m->mem.r_en;
+}
+
+int mem_write(struct lc3machine *m, lc3word addr, lc3word data, lc3word wmask)
+{
+    const struct lc3mmio *io;
+
+    if (!m->mem.w_en) {
+        m->mem.w_en = 1;
+        m->mem.done = m->sched.now + MEM_DELAY;
+    }
+    else if (mem_ready(m)) {
+        m->mem.w_en = 0;
+        m->mem.writes++;
+        io = find_io(m, addr);
+        if (io != NULL && io->write != NULL) {
+            io->write(m, addr, data, wmask);
+        }
+        else {
+            do_write(m, addr, data, wmask);
+        }
+    }
+
+    return !m->mem.w_en;
 }
 
-void mem_tick(void)
+void mem_read_nodelay(struct lc3machine *m, lc3word *data, lc3word addr)
 {
-    if (m.c > 0) {
-        m.c--;
+    do_read(m, data, addr);
+}
+
+void mem_write_nodelay(struct lc3machine *m, lc3word addr, lc3word data,
+                       lc3word wmask)
+{
+    m->mem.writes++;
+    do_write(m, addr, data, wmask);
+}
+
+void mem_read_untimed(struct lc3machine *m, lc3word *data, lc3word addr)
+{
+    const struct lc3mmio *io;
+
+    io = find_io(m, addr);
+    if (io != NULL && io->read != NULL) {
+        *data = io->read(m, addr);
+    }
+    else {
+        do_read(m, data, addr);
+    }
+}
+
+void mem_write_untimed(struct lc3machine *m, lc3word addr, lc3word data,
+                       lc3word wmask)
+{
+    const struct lc3mmio *io;
+
+    m->mem.writes++;
+    io = find_io(m, addr);
+    if (io != NULL && io->write != NULL) {
+        io->write(m, addr, data, wmask);
+    }
+    else {
+        do_write(m, addr, data, wmask);
+    }
+}
+
+void mem_init(struct lc3machine *m)
+{
+    int i;
+
+    m->mem.ram_pages = MEM_RAM_PAGES;
+    for (i = 0; i < MEM_PAGES; i++) {
+        m->mem.page[i] = zero_page.d;
+    }
+}
+
+void mem_free(struct lc3machine *m)
+{
+    int i;
+
+    for (i = 0; i < MEM_PAGES; i++) {
+        put_page(m->mem.page[i]);
+        m->mem.page[i] = zero_page.d;
+        free(m->mem.io[i]);
+        m->mem.io[i] = NULL;
+    }
+}
+
+int mem_share(struct lc3machine *m, struct lc3machine *from)
+{
+    int i;
+
+    for (i = 0; i < MEM_PAGES; i++) {
+        if (from->mem.page[i] != zero_page.d) {
+            atomic_fetch_add_explicit(&PAGE_OF(from->mem.page[i])->refs, 1,
+                                      memory_order_relaxed);
+        }
+        m->mem.page[i] = from->mem.page[i];
+    }
+
+    for (i = 0; i < MEM_PAGES; i++) {
+        if (from->mem.io[i] == NULL) {
+            continue;
+        }
+        m->mem.io[i] = malloc(IO_REGS * sizeof(struct lc3mmio));
+        if (m->mem.io[i] == NULL) {
+            return -1;
+        }
+        memcpy(m->mem.io[i], from->mem.io[i],
+               IO_REGS * sizeof(struct lc3mmio));
     }
+    return 0;
 }
 
-int mem_ready(void)
+void mem_rewind(struct lc3machine *m, struct lc3machine *from)
 {
-    return m.c == 0;
+    int i;
+    int a;
+
+    for (i = 0; i < MEM_PAGES; i++) {
+        if (m->mem.page[i] == from->mem.page[i]) {
+            continue;
+        }
+        put_page(m->mem.page[i]);
+        if (from->mem.page[i] != zero_page.d) {
+            atomic_fetch_add_explicit(&PAGE_OF(from->mem.page[i])->refs, 1,
+                                      memory_order_relaxed);
+        }
+        m->mem.page[i] = from->mem.page[i];
+        for (a = i << MEM_PAGE_SHIFT; a < (i + 1) << MEM_PAGE_SHIFT; a += 2) {
+            cpu_invalidate(m, (lc3word) a);
+        }
+    }
 }
 
-int mem_read(lc3word *data, lc3word addr)
+int mem_map_io(struct lc3machine *m, lc3word addr, lc3io_read_fn read,
+               lc3io_write_fn write)
 {
-    if (!m.r_en) {
-        m.r_en = 1;
-        m.c = MEM_DELAY;
+    struct lc3mmio **io;
+
+    if (addr < A_IO || (addr & 1)) {
+        return -1;
     }
-    else if (m.c == 0) {
-        m.r_en = 0;
-        switch (addr) {
-            case A_KBSR:
-                *data = get_kbsr();
-                break;
-            case A_KBDR:
-                *data = get_kbdr();
-                break;
-            case A_DSR:
-                *data = get_dsr();
-                break;
-            case A_ICDR:
-                *data = get_icdr();
-                break;
-            case A_MCR:
-                *data = get_mcr();
-                break;
-            default:
-                do_read(data, addr);
-                break;
+
+    io = &m->mem.io[addr >> MEM_PAGE_SHIFT];
+    if (*io == NULL) {
+        *io = calloc(IO_REGS, sizeof(struct lc3mmio));
+        if (*io == NULL) {
+            return -1;
         }
     }
 
-    return !m.r_en;
+    (*io)[(addr & MEM_PAGE_MASK) >> 1].read = read;
+    (*io)[(addr & MEM_PAGE_MASK) >> 1].write = write;
+    return 0;
 }
 
-int mem_write(lc3word addr, lc3word data, lc3word wmask)
+int mem_limit(struct lc3machine *m, unsigned int kib)
 {
-    if (!m.w_en) {
-        m.w_en = 1;
-        m.c = MEM_DELAY;
+    int i;
+    int a;
+
+    if (kib == 0 || kib > (MEM_SIZE >> 10)) {
+        return -1;
+    }
+
+    m->mem.ram_pages = (int) ((kib << 10) >> MEM_PAGE_SHIFT);
+    if (m->mem.ram_pages > MEM_RAM_PAGES) {
+        m->mem.ram_pages = MEM_RAM_PAGES;
     }
-    else if (m.c == 0) {
-        m.w_en = 0;
-        switch (addr) {
-            case A_KBSR:
-                set_kbsr(WRITE_BITS(get_kbsr(), data, wmask));
-                break;
-            case A_DSR:
-                set_dsr(WRITE_BITS(get_dsr(), data, wmask));
-                break;
-            case A_DDR:
-                set_ddr(WRITE_BITS(get_ddr(), data, wmask));
-                break;
-            case A_ICCR:
-                set_iccr(WRITE_BITS(get_iccr(), data, wmask));
-                break;
-            case A_ICDR:
-                set_icdr(WRITE_BITS(get_icdr(), data, wmask));
-                break;
-            case A_MCR:
-                set_mcr(WRITE_BITS(get_mcr(), data, wmask));
-                break;
-            default:
-                do_write(addr, data, wmask);
-                break;
+    for (i = m->mem.ram_pages; i < MEM_RAM_PAGES; i++) {
+        if (m->mem.page[i] == zero_page.d) {
+            continue;
+        }
+        put_page(m->mem.page[i]);
+        m->mem.page[i] = zero_page.d;
+        for (a = i << MEM_PAGE_SHIFT; a < (i + 1) << MEM_PAGE_SHIFT; a += 2) {
+            cpu_invalidate(m, (lc3word) a);
         }
     }
+    return 0;
+}
+
+int mem_backed(struct lc3machine *m, lc3word addr)
+{
+    int n;
 
-    return !m.w_en;
+    n = addr >> MEM_PAGE_SHIFT;
+    return n < m->mem.ram_pages || n >= MEM_RAM_PAGES;
 }
 
-void mem_read_nodelay(lc3word *data, lc3word addr)
+void mem_stats(struct lc3machine *m, struct lc3memstats *s)
 {
-    do_read(data, addr);
+    int i;
+
+    s->pages = 0;
+    s->shared = 0;
+    for (i = 0; i < MEM_PAGES; i++) {
+        if (m->mem.page[i] == zero_page.d) {
+            continue;
+        }
+        s->pages++;
+        if (atomic_load(&PAGE_OF(m->mem.page[i])->refs) > 1) {
+            s->shared++;
+        }
+    }
+}
+
+int64_t mem_allocated(int64_t *peak)
+{
+    if (peak != NULL) {
+        *peak = atomic_load(&peak_pages);
+    }
+    return atomic_load(&live_pages);
+}
+
+lc3word ** mem_pages(struct lc3machine *m)
+{
+    return m->mem.page;
 }
 
-void mem_write_nodelay(lc3word addr, lc3word data, lc3word wmask)
+/*
+ * Find the handlers for an address.
+ *
+ * @return      the handlers
+ *              NULL if 'addr' is in a RAM page
+ */
+static inline const struct lc3mmio * find_io(struct lc3machine *m,
+                                             lc3word addr)
 {
-    do_write(addr, data, wmask);
+    const struct lc3mmio *io;
+
+    io = m->mem.io[addr >> MEM_PAGE_SHIFT];
+    return (io != NULL) ? &io[(addr & MEM_PAGE_MASK) >> 1] : NULL;
 }
 
-static inline void do_read(lc3word *data, lc3word addr)
+static inline void do_read(struct lc3machine *m, lc3word *data, lc3word addr)
 {
-    *data = m.d[addr >> 1];
+    *data = mem_word(&m->mem, addr);
 }
 
-static inline void do_write(lc3word addr, lc3word data, lc3word wmask)
+static inline void do_write(struct lc3machine *m, lc3word addr, lc3word data,
+                            lc3word wmask)
 {
-    m.d[addr >> 1] = WRITE_BITS(m.d[addr >> 1], data, wmask);
+    lc3word *d;
+    int n;
+
+    n = addr >> MEM_PAGE_SHIFT;
+    d = m->mem.page[n];
+    if (atomic_load_explicit(&PAGE_OF(d)->refs, memory_order_acquire) != 1) {
+        d = unshare(m, n);
+        if (d == NULL) {
+            return;
+        }
+    }
+
+    n = (addr & MEM_PAGE_MASK) >> 1;
+    d[n] = WRITE_BITS(d[n], data, wmask);
+    cpu_invalidate(m, addr);
+}
+
+/*
+ * Allocate a page.
+ *
+ * @param src   the data to copy into it
+ * @return      the page's data
+ *              NULL if out of memory
+ */
+static lc3word * new_page(const lc3word *src)
+{
+    struct lc3page *p;
+    long long n;
+    long long peak;
+
+    p = malloc(sizeof(struct lc3page));
+    if (p == NULL) {
+        return NULL;
+    }
+
+    atomic_init(&p->refs, 1);
+    memcpy(p->d, src, sizeof(p->d));
+
+    n = atomic_fetch_add_explicit(&live_pages, 1, memory_order_relaxed) + 1;
+    peak = atomic_load_explicit(&peak_pages, memory_order_relaxed);
+    while (n > peak
+           && !atomic_compare_exchange_weak(&peak_pages, &peak, n)) {
+        continue;
+    }
+    return p->d;
+}
+
+/*
+ * Drop a reference to a page, freeing it once no machine holds it.
+ */
+static void put_page(lc3word *d)
+{
+    struct lc3page *p;
+
+    p = PAGE_OF(d);
+    if (p == &zero_page) {
+        return;
+    }
+    if (atomic_fetch_sub_explicit(&p->refs, 1, memory_order_acq_rel) == 1) {
+        atomic_fetch_sub_explicit(&live_pages, 1, memory_order_relaxed);
+        free(p);
+    }
+}
+
+/*
+ * Give a machine its own copy of a shared or zero page before writing to it.
+ *
+ * @param n     the page number
+ * @return      the page's new data
+ *              NULL if the page is above the RAM limit
+ */
+static lc3word * unshare(struct lc3machine *m, int n)
+{
+    lc3word *d;
+
+    if (n >= m->mem.ram_pages && n < MEM_RAM_PAGES) {
+        return NULL;
+    }
+
+    d = new_page(m->mem.page[n]);
+    if (d == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        exit(2);
+    }
+
+    put_page(m->mem.page[n]);
+    m->mem.page[n] = d;
+    return d;
 }
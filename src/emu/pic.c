@@ -24,22 +24,48 @@
 #include <string.h>
 
 #include <emu/pic.h>
+#include <emu/machine.h>
 #include <emu/cpu.h>
+#include <emu/sched.h>
 
 #define SET_BIT(val,pos)    (val|=(1 <<(pos)))
 #define CLEAR_BIT(val,pos)  (val&=~(1 <<(pos)))
 #define IS_BIT_SET(val,pos) ((val&(1<<(pos)))!=0)
 
-static struct lc3pic pic;
+/*
+ * Requests the CPU would take at its current priority level.
+ */
+#define DELIVERABLE()       \
+    (m->pic.irr & (uint8_t) (0xFE << m->cpu.psr.priority))
 
-void pic_reset(void)
+static inline int highest_bit(uint8_t val);
+static void iccr_write(struct lc3machine *m, lc3word addr, lc3word data,
+                       lc3word wmask);
+static lc3word icdr_read(struct lc3machine *m, lc3word addr);
+static void icdr_write(struct lc3machine *m, lc3word addr, lc3word data,
+                       lc3word wmask);
+
+int pic_init(struct lc3machine *m)
+{
+    if (mem_map_io(m, A_ICCR, NULL, iccr_write) != 0
+        || mem_map_io(m, A_ICDR, icdr_read, icdr_write) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void pic_reset(struct lc3machine *m)
 {
-    memset(&pic, 0, sizeof(struct lc3pic));
+    memset(&m->pic, 0, sizeof(struct lc3pic));
 }
 
-void pic_tick(void)
+void pic_event(struct lc3machine *m)
 {
-    int curr_prio;
+    uint8_t ready;
+    int prio;
+
+    /* Latch requests from the devices holding their lines high */
+    m->pic.irr |= m->pic.lines & ~m->pic.isr & ~m->pic.imr;
 
     /* Check for pending interrupts.
        If a pending interrupt is detected, INTP is set to the interrupt's
@@ -48,90 +74,155 @@ void pic_tick(void)
        process's priority will be acknowledged. The interrupt priority is
        encoded in the IRQ bitmask:
            IR7..IR0 <=> PL7..PL0
-       A higher PL number indicates higher priority. */
-
-    curr_prio = 7;
-    while (!cpu_intf() && curr_prio >= 0) {
-        if (curr_prio > cpu_prio() && IS_BIT_SET(pic.irr, curr_prio)) {
-            CLEAR_BIT(pic.irr, curr_prio);
-            SET_BIT(pic.isr, curr_prio);
-            cpu_interrupt(IRQ_BASE | curr_prio, curr_prio);
-        }
-        curr_prio--;
+       A higher PL number indicates higher priority, so the request to take is
+       the highest set bit of the deliverable mask. */
+
+    ready = DELIVERABLE();
+    if (!m->cpu.intf && ready != 0) {
+        prio = highest_bit(ready);
+        CLEAR_BIT(m->pic.irr, prio);
+        SET_BIT(m->pic.isr, prio);
+        cpu_interrupt(m, IRQ_BASE | prio, prio);
     }
 
     /* Process any commands that may have come through */
-    switch (pic.iccr) {
+    if (m->pic.iccr == 0) {
+        return;
+    }
+    switch (m->pic.iccr) {
         case PIC_CMD_IRR_R:
-            pic.icdr = pic.irr;
-            pic.iccr = 0;
+            m->pic.icdr = m->pic.irr;
+            m->pic.iccr = 0;
             break;
         case PIC_CMD_ISR_R:
-            pic.icdr = pic.isr;
-            pic.iccr = 0;
+            m->pic.icdr = m->pic.isr;
+            m->pic.iccr = 0;
             break;
         case PIC_CMD_IMR_R:
-            pic.icdr = pic.imr;
-            pic.iccr = 0;
+            m->pic.icdr = m->pic.imr;
+            m->pic.iccr = 0;
             break;
         case PIC_CMD_IMR_W:
-            pic.imr = pic.icdr & 0xFF;
-            pic.iccr = 0;
+            m->pic.imr = m->pic.icdr & 0xFF;
+            m->pic.iccr = 0;
+            sched_at(m, EV_PIC, m->sched.now + 1);
             break;
         default:
             break;
     }
 }
 
-void raise_irq(int num)
+void pic_poll(struct lc3machine *m)
+{
+    sched_soon(m, EV_PIC);
+}
+
+void raise_irq(struct lc3machine *m, int num)
 {
     num &= 7;
-    if (!IS_BIT_SET(pic.isr, num) && !IS_BIT_SET(pic.imr, num)) {
-        SET_BIT(pic.irr, num);
+    if (!IS_BIT_SET(m->pic.isr, num) && !IS_BIT_SET(m->pic.imr, num)) {
+        SET_BIT(m->pic.irr, num);
+        sched_soon(m, EV_PIC);
     }
 }
 
-void finish_irq(int num)
+void set_irq_line(struct lc3machine *m, int num, int level)
 {
-    CLEAR_BIT(pic.isr, num & 7);
+    num &= 7;
+    if (!level) {
+        CLEAR_BIT(m->pic.lines, num);
+    }
+    else if (!IS_BIT_SET(m->pic.lines, num)) {
+        SET_BIT(m->pic.lines, num);
+        sched_soon(m, EV_PIC);
+    }
 }
 
-uint8_t get_irr(void)
+void finish_irq(struct lc3machine *m, int num)
 {
-    return pic.irr;
+    CLEAR_BIT(m->pic.isr, num & 7);
+    sched_soon(m, EV_PIC);
 }
 
-uint8_t get_isr(void)
+uint8_t get_irr(struct lc3machine *m)
 {
-    return pic.isr;
+    return m->pic.irr;
 }
 
-uint8_t get_imr(void)
+uint8_t get_isr(struct lc3machine *m)
 {
-    return pic.imr;
+    return m->pic.isr;
 }
 
-void set_imr(uint8_t mask)
+uint8_t get_imr(struct lc3machine *m)
 {
-    pic.imr = mask;
+    return m->pic.imr;
 }
 
-lc3word get_iccr(void)
+void set_imr(struct lc3machine *m, uint8_t mask)
 {
-    return pic.iccr;
+    m->pic.imr = mask;
+    sched_soon(m, EV_PIC);
 }
 
-void set_iccr(lc3word cmd)
+lc3word get_iccr(struct lc3machine *m)
 {
-    pic.iccr = cmd;
+    return m->pic.iccr;
 }
 
-lc3word get_icdr(void)
+void set_iccr(struct lc3machine *m, lc3word cmd)
 {
-    return pic.icdr;
+    m->pic.iccr = cmd;
+    sched_soon(m, EV_PIC);
 }
 
-void set_icdr(lc3word data)
+lc3word get_icdr(struct lc3machine *m)
 {
-    pic.icdr = data;
+    return m->pic.icdr;
+}
+
+void set_icdr(struct lc3machine *m, lc3word data)
+{
+    m->pic.icdr = data;
+}
+
+/*
+ * I/O register handlers.
+ */
+static void iccr_write(struct lc3machine *m, lc3word addr, lc3word data,
+                       lc3word wmask)
+{
+    (void) addr;
+    set_iccr(m, WRITE_BITS(get_iccr(m), data, wmask));
+}
+
+static lc3word icdr_read(struct lc3machine *m, lc3word addr)
+{
+    (void) addr;
+    return get_icdr(m);
+}
+
+static void icdr_write(struct lc3machine *m, lc3word addr, lc3word data,
+                       lc3word wmask)
+{
+    (void) addr;
+    set_icdr(m, WRITE_BITS(get_icdr(m), data, wmask));
+}
+
+/*
+ * Get the position of the most significant set bit of a nonzero value.
+ */
+static inline int highest_bit(uint8_t val)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return 31 - __builtin_clz(val);
+#else
+    int pos;
+
+    pos = 0;
+    while (val >>= 1) {
+        pos++;
+    }
+    return pos;
+#endif
 }
@@ -0,0 +1,281 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: src/emu/prof.c
+ * Author: Wes Hampson
+ *   Desc: Guest execution profiler: shadow call stack, calling-context tree
+ *         and reports. The run loop that drives it is in cpu.c.
+ *============================================================================*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <emu/lc3.h>
+#include <emu/mem.h>
+#include <emu/machine.h>
+#include <emu/prof.h>
+
+/*
+ * A line of the flat profile.
+ */
+struct entry {
+    lc3word addr;
+    uint64_t cycles;
+    uint64_t count;     /* instructions, or calls */
+};
+
+static int new_node(struct lc3prof *p, int parent, lc3word func);
+static int by_cycles(const void *a, const void *b);
+static uint64_t total_cycles(const struct lc3prof *p);
+
+/* ===== Public Functions ===== */
+
+int prof_enable(struct lc3machine *m)
+{
+    struct lc3prof *p;
+
+    p = calloc(1, sizeof(struct lc3prof));
+    if (p == NULL) {
+        return -1;
+    }
+    if (new_node(p, -1, m->cpu.pc) != 0) {
+        free(p);
+        return -1;
+    }
+
+    prof_free(m);
+    m->prof = p;
+    return 0;
+}
+
+void prof_free(struct lc3machine *m)
+{
+    if (m->prof == NULL) {
+        return;
+    }
+
+    free(m->prof->nodes);
+    free(m->prof);
+    m->prof = NULL;
+}
+
+void prof_call(struct lc3prof *p, lc3word func, lc3word ret)
+{
+    int n;
+
+    if (p->depth == PROF_DEPTH) {
+        p->lost++;
+        return;
+    }
+
+    for (n = p->nodes[p->node].child; n >= 0; n = p->nodes[n].next) {
+        if (p->nodes[n].func == func) {
+            break;
+        }
+    }
+    if (n < 0) {
+        if (new_node(p, p->node, func) != 0) {
+            p->lost++;
+            return;
+        }
+        n = p->num_nodes - 1;
+    }
+
+    p->stack[p->depth].ret = ret;
+    p->stack[p->depth].node = p->node;
+    p->depth++;
+    p->node = n;
+    p->nodes[n].calls++;
+}
+
+void prof_return(struct lc3prof *p, lc3word addr)
+{
+    int i;
+
+    for (i = p->depth - 1; i >= 0; i--) {
+        if (p->stack[i].ret == addr) {
+            p->node = p->stack[i].node;
+            p->depth = i;
+            return;
+        }
+    }
+}
+
+void prof_write_flat(struct lc3machine *m, FILE *f)
+{
+    struct lc3prof *p;
+    struct entry *e;
+    uint64_t total;
+    uint64_t insns;
+    lc3word word;
+    int n;
+    int i;
+
+    p = m->prof;
+    e = calloc(MEM_DEPTH, sizeof(struct entry));
+    if (e == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        return;
+    }
+
+    total = total_cycles(p);
+    insns = 0;
+    for (i = 0; i < MEM_DEPTH; i++) {
+        insns += p->insns[i];
+    }
+    fprintf(f, "Profile: %llu instructions, %llu cycles\n",
+            (unsigned long long) insns, (unsigned long long) total);
+    if (p->lost > 0) {
+        fprintf(f, "(%llu calls past the deepest stack, charged to their "
+                   "callers)\n", (unsigned long long) p->lost);
+    }
+
+    /* Functions, from every context each is entered in */
+    for (i = 0; i < MEM_DEPTH; i++) {
+        e[i].addr = i << 1;
+    }
+    for (i = 0; i < p->num_nodes; i++) {
+        e[p->nodes[i].func >> 1].cycles += p->nodes[i].cycles;
+        e[p->nodes[i].func >> 1].count += p->nodes[i].calls;
+    }
+    qsort(e, MEM_DEPTH, sizeof(struct entry), by_cycles);
+
+    fprintf(f, "\nBy function (cycles not in callees):\n");
+    fprintf(f, "%14s %7s %12s  %s\n", "cycles", "%", "calls", "function");
+    for (n = 0; n < MEM_DEPTH && e[n].cycles > 0; n++) {
+        fprintf(f, "%14llu %6.2f%% %12llu  x%04X\n",
+                (unsigned long long) e[n].cycles,
+                100.0 * e[n].cycles / total,
+                (unsigned long long) e[n].count, e[n].addr);
+    }
+
+    /* Addresses */
+    for (i = 0; i < MEM_DEPTH; i++) {
+        e[i].addr = i << 1;
+        e[i].cycles = p->cycles[i];
+        e[i].count = p->insns[i];
+    }
+    qsort(e, MEM_DEPTH, sizeof(struct entry), by_cycles);
+
+    fprintf(f, "\nBy address:\n");
+    fprintf(f, "%14s %7s %12s  %-7s %s\n",
+            "cycles", "%", "insns", "address", "word");
+    for (n = 0; n < MEM_DEPTH && e[n].cycles > 0; n++) {
+        word = mem_word(&m->mem, e[n].addr);
+        fprintf(f, "%14llu %6.2f%% %12llu  x%04X   x%04X\n",
+                (unsigned long long) e[n].cycles,
+                100.0 * e[n].cycles / total,
+                (unsigned long long) e[n].count, e[n].addr, word);
+    }
+
+    free(e);
+}
+
+void prof_write_stacks(struct lc3machine *m, FILE *f)
+{
+    struct lc3prof *p;
+    lc3word path[PROF_DEPTH + 1];
+    int depth;
+    int n;
+    int i;
+
+    p = m->prof;
+    for (i = 0; i < p->num_nodes; i++) {
+        if (p->nodes[i].cycles == 0) {
+            continue;
+        }
+
+        depth = 0;
+        for (n = i; n >= 0; n = p->nodes[n].parent) {
+            path[depth++] = p->nodes[n].func;
+        }
+        while (depth-- > 0) {
+            fprintf(f, "x%04X%c", path[depth], depth ? ';' : ' ');
+        }
+        fprintf(f, "%llu\n", (unsigned long long) p->nodes[i].cycles);
+    }
+}
+
+/* ===== Private Functions ===== */
+
+/*
+ * Add a context, as the first callee of its caller.
+ *
+ * @param parent    the caller's context, or -1 for the root
+ * @param func      the entry point
+ * @return          0 on success
+ *                  -1 if out of memory
+ */
+static int new_node(struct lc3prof *p, int parent, lc3word func)
+{
+    struct prof_node *nodes;
+    struct prof_node *n;
+    int cap;
+
+    if (p->num_nodes == p->cap_nodes) {
+        cap = p->cap_nodes ? 2 * p->cap_nodes : 64;
+        nodes = realloc(p->nodes, cap * sizeof(struct prof_node));
+        if (nodes == NULL) {
+            return -1;
+        }
+        p->nodes = nodes;
+        p->cap_nodes = cap;
+    }
+
+    n = &p->nodes[p->num_nodes];
+    memset(n, 0, sizeof(struct prof_node));
+    n->func = func;
+    n->parent = parent;
+    n->child = -1;
+    n->next = -1;
+    if (parent >= 0) {
+        n->next = p->nodes[parent].child;
+        p->nodes[parent].child = p->num_nodes;
+    }
+    p->num_nodes++;
+
+    return 0;
+}
+
+/*
+ * Order flat profile lines busiest first, then by address.
+ */
+static int by_cycles(const void *a, const void *b)
+{
+    const struct entry *x = a;
+    const struct entry *y = b;
+
+    if (x->cycles != y->cycles) {
+        return (x->cycles > y->cycles) ? -1 : 1;
+    }
+    return (int) x->addr - (int) y->addr;
+}
+
+static uint64_t total_cycles(const struct lc3prof *p)
+{
+    uint64_t total;
+    int i;
+
+    total = 0;
+    for (i = 0; i < MEM_DEPTH; i++) {
+        total += p->cycles[i];
+    }
+
+    return total;
+}
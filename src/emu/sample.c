@@ -0,0 +1,246 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: src/emu/sample.c
+ * Author: Wes Hampson
+ *   Desc: Sampling profiler. The run loop in main.c decides when to sample;
+ *         this records the samples and writes the histogram.
+ *============================================================================*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <emu/lc3.h>
+#include <emu/cpu.h>
+#include <emu/machine.h>
+#include <emu/prof.h>
+#include <emu/sample.h>
+
+/*
+ * A histogram line: a sample standing for all those with the same key.
+ */
+struct row {
+    struct lc3sample s;
+    size_t n;
+};
+
+static void histogram(struct lc3sampler *s, FILE *f,
+                      int (*cmp)(const void *, const void *), int context);
+static int by_place(const void *a, const void *b);
+static int by_func(const void *a, const void *b);
+static int by_r7(const void *a, const void *b);
+static int by_count(const void *a, const void *b);
+
+/* ===== Public Functions ===== */
+
+int sampler_init(struct lc3sampler *s, uint64_t interval)
+{
+    memset(s, 0, sizeof(struct lc3sampler));
+    s->buf = malloc(SAMPLE_MAX * sizeof(struct lc3sample));
+    if (s->buf == NULL) {
+        return -1;
+    }
+    s->interval = interval;
+    s->seed = 0x9E3779B9;
+
+    return 0;
+}
+
+void sampler_free(struct lc3sampler *s)
+{
+    free(s->buf);
+    s->buf = NULL;
+    s->count = 0;
+}
+
+uint64_t sampler_next(struct lc3sampler *s)
+{
+    uint64_t n;
+
+    /* xorshift32 */
+    s->seed ^= s->seed << 13;
+    s->seed ^= s->seed >> 17;
+    s->seed ^= s->seed << 5;
+
+    n = s->interval / 2 + s->seed % (s->interval + 1);
+    return n ? n : 1;
+}
+
+void sampler_take(struct lc3sampler *s, struct lc3machine *m)
+{
+    struct lc3sample *e;
+    lc3word pc;
+    size_t i;
+
+    /* Full: keep every other sample, and take them half as often */
+    if (s->count == SAMPLE_MAX) {
+        for (i = 0; i < SAMPLE_MAX / 2; i++) {
+            s->buf[i] = s->buf[2 * i];
+        }
+        s->count = SAMPLE_MAX / 2;
+        s->interval *= 2;
+    }
+
+    /* Mid-instruction, the PC has already moved past the instruction (or to
+       its target); every engine records where the instruction started. In
+       either fetch state, the PC is the instruction about to run */
+    pc = m->cpu.pc;
+    if (!IS_FETCH(m->cpu.state)) {
+        pc = m->idle.last;
+    }
+
+    e = &s->buf[s->count++];
+    e->pc = pc;
+    e->r7 = m->cpu.r[R_7];
+    e->func = pc;
+    e->priv = m->cpu.psr.privilege;
+    e->prio = m->cpu.psr.priority;
+    if (m->prof != NULL) {
+        e->func = m->prof->nodes[m->prof->node].func;
+        s->contexts = 1;
+    }
+}
+
+void sampler_write(struct lc3sampler *s, FILE *f)
+{
+    fprintf(f, "Samples: %zu, about one per %llu cycles\n", s->count,
+            (unsigned long long) s->interval);
+    if (s->count == 0) {
+        return;
+    }
+
+    fprintf(f, "\nBy address:\n");
+    fprintf(f, "%10s %7s  %-7s %-4s %4s\n",
+            "samples", "%", "address", "mode", "prio");
+    histogram(s, f, by_place, 0);
+
+    if (s->contexts) {
+        fprintf(f, "\nBy function (innermost on the call stack):\n");
+        fprintf(f, "%10s %7s  %s\n", "samples", "%", "function");
+        histogram(s, f, by_func, 1);
+    }
+    else {
+        fprintf(f, "\nBy R7 (return address of the latest call):\n");
+        fprintf(f, "%10s %7s  %s\n", "samples", "%", "R7");
+        histogram(s, f, by_r7, 1);
+    }
+}
+
+/* ===== Private Functions ===== */
+
+/*
+ * Count the samples that share a key and print one line per key, most
+ * samples first.
+ *
+ * @param cmp       orders samples by the key
+ * @param context   print the function or R7 column, not the address ones
+ */
+static void histogram(struct lc3sampler *s, FILE *f,
+                      int (*cmp)(const void *, const void *), int context)
+{
+    struct lc3sample *sorted;
+    struct row *rows;
+    lc3word key;
+    size_t num_rows;
+    size_t i;
+
+    sorted = malloc(s->count * sizeof(struct lc3sample));
+    rows = malloc(s->count * sizeof(struct row));
+    if (sorted == NULL || rows == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        free(sorted);
+        free(rows);
+        return;
+    }
+
+    memcpy(sorted, s->buf, s->count * sizeof(struct lc3sample));
+    qsort(sorted, s->count, sizeof(struct lc3sample), cmp);
+    num_rows = 0;
+    for (i = 0; i < s->count; i++) {
+        if (num_rows == 0 || cmp(&rows[num_rows - 1].s, &sorted[i]) != 0) {
+            rows[num_rows].s = sorted[i];
+            rows[num_rows].n = 0;
+            num_rows++;
+        }
+        rows[num_rows - 1].n++;
+    }
+    qsort(rows, num_rows, sizeof(struct row), by_count);
+
+    for (i = 0; i < num_rows; i++) {
+        fprintf(f, "%10zu %6.2f%%  ", rows[i].n, 100.0 * rows[i].n / s->count);
+        if (context) {
+            key = (cmp == by_r7) ? rows[i].s.r7 : rows[i].s.func;
+            fprintf(f, "x%04X\n", key);
+        }
+        else {
+            fprintf(f, "x%04X   %-4s %4d\n", rows[i].s.pc,
+                    rows[i].s.priv ? "user" : "sup", rows[i].s.prio);
+        }
+    }
+
+    free(sorted);
+    free(rows);
+}
+
+/*
+ * Order samples by address, then privilege and priority.
+ */
+static int by_place(const void *a, const void *b)
+{
+    const struct lc3sample *x = a;
+    const struct lc3sample *y = b;
+
+    if (x->pc != y->pc) {
+        return (int) x->pc - (int) y->pc;
+    }
+    if (x->priv != y->priv) {
+        return (int) x->priv - (int) y->priv;
+    }
+    return (int) x->prio - (int) y->prio;
+}
+
+static int by_func(const void *a, const void *b)
+{
+    const struct lc3sample *x = a;
+    const struct lc3sample *y = b;
+
+    return (int) x->func - (int) y->func;
+}
+
+static int by_r7(const void *a, const void *b)
+{
+    const struct lc3sample *x = a;
+    const struct lc3sample *y = b;
+
+    return (int) x->r7 - (int) y->r7;
+}
+
+/*
+ * Order histogram lines most samples first, then by key.
+ */
+static int by_count(const void *a, const void *b)
+{
+    const struct row *x = a;
+    const struct row *y = b;
+
+    if (x->n != y->n) {
+        return (x->n > y->n) ? -1 : 1;
+    }
+    return by_place(&x->s, &y->s);
+}
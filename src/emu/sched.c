@@ -0,0 +1,180 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: src/emu/sched.c
+ * Author: Wes Hampson
+ *   Desc: Device event scheduler.
+ *============================================================================*/
+
+#include <stdint.h>
+
+#include <emu/sched.h>
+#include <emu/machine.h>
+#include <emu/kbd.h>
+#include <emu/disp.h>
+#include <emu/pic.h>
+
+/*
+ * Event handlers, by source.
+ */
+static void (* const handlers[NUM_EVENTS])(struct lc3machine *) = {
+    kbd_event,      /* EV_KBD */
+    disp_event,     /* EV_DISP */
+    pic_event       /* EV_PIC */
+};
+
+static void sift_up(struct lc3sched *s, int i);
+static void sift_down(struct lc3sched *s, int i);
+static inline int before(const struct lc3timer *a, const struct lc3timer *b);
+static inline void place(struct lc3sched *s, int i, struct lc3timer t);
+
+void sched_reset(struct lc3machine *m)
+{
+    int i;
+
+    m->sched.now = 0;
+    m->sched.next = UINT64_MAX;
+    m->sched.changes = 0;
+    m->sched.busy = 0;
+    m->sched.size = 0;
+    for (i = 0; i < NUM_EVENTS; i++) {
+        m->sched.pos[i] = -1;
+    }
+}
+
+void sched_at(struct lc3machine *m, enum lc3event ev, uint64_t when)
+{
+    struct lc3sched *s;
+    struct lc3timer t;
+    uint64_t first;
+    int i;
+
+    s = &m->sched;
+    s->changes++;
+    first = s->now + !s->busy;
+    t.when = (when < first) ? first : when;
+    t.ev = ev;
+
+    i = s->pos[ev];
+    if (i < 0) {
+        i = s->size++;
+        place(s, i, t);
+        sift_up(s, i);
+    }
+    else if (before(&t, &s->heap[i])) {
+        place(s, i, t);
+        sift_up(s, i);
+    }
+    else {
+        place(s, i, t);
+        sift_down(s, i);
+    }
+
+    s->next = s->heap[0].when;
+}
+
+void sched_soon(struct lc3machine *m, enum lc3event ev)
+{
+    sched_at(m, ev, m->sched.now + !m->sched.busy);
+}
+
+void sched_advance(struct lc3machine *m, uint64_t n)
+{
+    struct lc3sched *s;
+    uint64_t until;
+    int ev;
+
+    s = &m->sched;
+    until = s->now + n;
+    while (s->next <= until) {
+        /* Pop the earliest event, then run it at its own cycle */
+        ev = s->heap[0].ev;
+        s->pos[ev] = -1;
+        if (--s->size > 0) {
+            place(s, 0, s->heap[s->size]);
+            sift_down(s, 0);
+        }
+        s->now = s->next;
+        s->next = (s->size > 0) ? s->heap[0].when : UINT64_MAX;
+
+        s->changes++;
+        s->busy = 1;
+        handlers[ev](m);
+        s->busy = 0;
+    }
+    s->now = until;
+}
+
+/* ===== Heap ===== */
+
+static void sift_up(struct lc3sched *s, int i)
+{
+    struct lc3timer t;
+    int parent;
+
+    t = s->heap[i];
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!before(&t, &s->heap[parent])) {
+            break;
+        }
+        place(s, i, s->heap[parent]);
+        i = parent;
+    }
+    place(s, i, t);
+}
+
+static void sift_down(struct lc3sched *s, int i)
+{
+    struct lc3timer t;
+    int child;
+
+    t = s->heap[i];
+    for (;;) {
+        child = 2 * i + 1;
+        if (child >= s->size) {
+            break;
+        }
+        if (child + 1 < s->size && before(&s->heap[child + 1],
+                                          &s->heap[child])) {
+            child++;
+        }
+        if (!before(&s->heap[child], &t)) {
+            break;
+        }
+        place(s, i, s->heap[child]);
+        i = child;
+    }
+    place(s, i, t);
+}
+
+/*
+ * Order events by cycle, then by source.
+ */
+static inline int before(const struct lc3timer *a, const struct lc3timer *b)
+{
+    return a->when < b->when || (a->when == b->when && a->ev < b->ev);
+}
+
+/*
+ * Store an event in a heap slot.
+ */
+static inline void place(struct lc3sched *s, int i, struct lc3timer t)
+{
+    s->heap[i] = t;
+    s->pos[t.ev] = i;
+}
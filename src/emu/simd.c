@@ -0,0 +1,647 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: src/emu/simd.c
+ * Author: Wes Hampson
+ *   Desc: Lockstep engine for the LC-3c.
+ *         The general purpose registers, PC, IR, MAR, MDR, PSR and BEN of up
+ *         to SIMD_LANES machines are held structure-of-arrays style, one
+ *         vector per register, one lane per machine. Each step picks the PC
+ *         most lanes are at and runs the instruction there on all of them
+ *         under a lane mask; ALU, LEA and control flow are vector operations,
+ *         and loads and stores go to each lane's own memory.
+ *
+ *         Everything the instruction-level engine hands to the microcode
+ *         (interrupts, RTI, memory-mapped I/O) is run for that lane alone
+ *         with cpu_step(), and so is an instruction that differs between
+ *         lanes at the same PC. A lane left waiting for SPLIT_AFTER steps in
+ *         a row has diverged for good and is finished on the fast engine.
+ *
+ *         Each lane clocks its own devices and skips its own idle loops
+ *         exactly as the fast engine would, so a machine ends in the same
+ *         state whichever lane it ran in.
+ *============================================================================*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include <emu/lc3.h>
+#include <emu/cpu.h>
+#include <emu/mem.h>
+#include <emu/machine.h>
+#include <emu/sched.h>
+#include <emu/idle.h>
+#include <emu/simd.h>
+#include <emu/traps.h>
+
+#ifdef __GNUC__
+
+/*
+ * Steps a lane may wait for the others to reach its PC before it is split
+ * off and run on its own.
+ */
+#define SPLIT_AFTER     1024
+
+/*
+ * One 16-bit register of every lane, and a lane mask (all ones or all zeros
+ * per lane). Built as 256-bit AVX2 operations where the target has them, and
+ * pairs of 128-bit SSE2 operations otherwise.
+ */
+typedef uint16_t vec __attribute__((vector_size(2 * SIMD_LANES)));
+typedef int16_t vmask __attribute__((vector_size(2 * SIMD_LANES)));
+
+/*
+ * Vector of a repeated scalar.
+ */
+#define SPLAT(x)            (zero + (lc3word) (x))
+
+/*
+ * Take 'new' in the lanes selected by 'mask' and 'old' elsewhere.
+ */
+#define BLEND(old,new,mask) (((old) & ~(vec) (mask)) | ((new) & (vec) (mask)))
+
+/*
+ * Condition codes (PSR[2:0]) for each lane's value.
+ */
+#define NZP(v)              ((vec) (((((vmask) (v)) < 0) & 4)           \
+                                  | (((v) == 0) & 2)                    \
+                                  | (((vmask) (v) > 0) & 1)))
+
+/*
+ * Lane group.
+ * A lane "in vectors" is at the start of an instruction and its registers
+ * live in the vectors; any other lane is partway through an instruction on
+ * the microcode and its registers live in its machine.
+ */
+struct group {
+    vec r[GPREGS];
+    vec pc;
+    vec ir;
+    vec mar;
+    vec mdr;
+    vec psr;
+    vec ben;
+
+    struct lc3machine *m[SIMD_LANES];   /* machine, NULL if the lane is free */
+    int job[SIMD_LANES];                /* machine's index in 'machines' */
+    int in_vec[SIMD_LANES];             /* registers live in the vectors */
+    unsigned int wait[SIMD_LANES];      /* steps spent waiting in a row */
+
+    struct lc3machine **machines;       /* caller's machines */
+    const uint64_t *max;                /* cycle budgets */
+    uint64_t *count;                    /* cycles run */
+    int num_machines;
+    int next;                           /* next machine to start */
+};
+
+static const vec zero;
+
+static void step(struct group *g);
+static int pick(struct group *g, lc3word *pc);
+static int drop_io(struct group *g, lc3word ir, int l);
+static void lane_start(struct group *g, int l);
+static void lane_retire(struct group *g, int l);
+static void lane_split(struct group *g, int l);
+static void lane_idle(struct group *g, int l);
+static void lane_scalar(struct group *g, int l);
+static void lane_done(struct group *g, int l, int n);
+static void lane_load(struct group *g, int l);
+static void lane_save(struct group *g, int l);
+
+static inline lc3sword sext(lc3word val, int pos);
+
+/* ===== Public Functions ===== */
+
+void simd_run(struct lc3machine **m, const uint64_t *max, uint64_t *count,
+              int n)
+{
+    struct group g;
+    int live;
+    int l;
+
+    memset(&g, 0, sizeof(struct group));
+    g.machines = m;
+    g.max = max;
+    g.count = count;
+    g.num_machines = n;
+    g.next = 0;
+    for (l = 0; l < SIMD_LANES; l++) {
+        lane_start(&g, l);
+    }
+
+    for (;;) {
+        /* Lanes partway through an instruction finish it on the microcode */
+        live = 0;
+        for (l = 0; l < SIMD_LANES; l++) {
+            while (g.m[l] != NULL && !g.in_vec[l]) {
+                sched_advance(g.m[l], 1);
+                lane_scalar(&g, l);
+            }
+            live |= (g.m[l] != NULL);
+        }
+        if (!live) {
+            break;
+        }
+
+        step(&g);
+    }
+}
+
+/* ===== Lockstep Execution ===== */
+
+/*
+ * Run one instruction on every lane at the most common PC.
+ */
+static void step(struct group *g)
+{
+    struct lc3machine *m;
+    int sel[SIMD_LANES];
+    int cycles;
+    int ns;
+    int n;
+    int op;
+    int a, b, c;
+    int i, l;
+    lc3word pc;
+    lc3word next;
+    lc3word ir;
+    lc3word imm;
+    lc3word val;
+    lc3word ptr;
+    vmask vm;
+    vmask bm;
+    vec res;
+
+    if (!pick(g, &pc)) {
+        return;
+    }
+
+    /*
+     * First clock cycle of the instruction. A lane whose device raised an
+     * interrupt, or whose instruction word differs from the first lane's,
+     * runs alone.
+     */
+    ns = 0;
+    ir = 0;
+    for (l = 0; l < SIMD_LANES; l++) {
+        if (g->m[l] == NULL || !g->in_vec[l] || g->pc[l] != pc) {
+            continue;
+        }
+        m = g->m[l];
+        g->wait[l] = 0;
+        if (pc <= m->idle.last) {
+            lane_idle(g, l);
+        }
+        m->idle.last = pc;
+        sched_advance(m, 1);
+        if (ns == 0) {
+            ir = mem_word(&m->mem, pc);
+        }
+        if (m->cpu.intf || IS_IO(pc) || mem_word(&m->mem, pc) != ir
+            || (ir >> 12) == OP_RTI || traps_native(m, ir)
+            || drop_io(g, ir, l)) {
+            lane_scalar(g, l);
+            continue;
+        }
+        sel[ns++] = l;
+    }
+    if (ns == 0) {
+        return;
+    }
+
+    vm = (vmask) zero;
+    for (i = 0; i < ns; i++) {
+        vm[sel[i]] = -1;
+    }
+
+    /* Fetch (states 18, 33, 35) */
+    next = pc + 2;
+    g->mar = BLEND(g->mar, SPLAT(pc), vm);
+    g->pc = BLEND(g->pc, SPLAT(next), vm);
+    g->mdr = BLEND(g->mdr, SPLAT(ir), vm);
+    g->ir = BLEND(g->ir, SPLAT(ir), vm);
+
+    /* Execute */
+    op = ir >> 12;
+    a = (ir >> 9) & 7;
+    b = (ir >> 6) & 7;
+    c = ir & 7;
+    cycles = CYC_ALU;
+    switch (op) {
+        case OP_BR:
+            /* PSR[2:0] and IR[11:9] are both laid out n, z, p */
+            bm = (vmask) ((g->psr & (lc3word) a) != 0) & vm;
+            g->ben = BLEND(g->ben, (vec) bm & 1, vm);
+            imm = sext(ir & 0x01FF, 9) << 1;
+            g->pc = BLEND(g->pc, SPLAT(next + imm), bm);
+            cycles = CYC_BR;
+            break;
+
+        case OP_ADD:
+        case OP_AND:
+        case OP_XOR:
+            if (ir & 0x0020) {
+                imm = sext(ir & 0x001F, 5);
+                res = (op == OP_ADD) ? g->r[b] + imm
+                    : (op == OP_AND) ? (g->r[b] & imm) : (g->r[b] ^ imm);
+            }
+            else {
+                res = (op == OP_ADD) ? g->r[b] + g->r[c]
+                    : (op == OP_AND) ? (g->r[b] & g->r[c])
+                    : (g->r[b] ^ g->r[c]);
+            }
+            g->r[a] = BLEND(g->r[a], res, vm);
+            g->psr = BLEND(g->psr, (g->psr & 0xFFF8) | NZP(res), vm);
+            break;
+
+        case OP_SHF:
+            if (!(ir & 0x0010)) {
+                res = g->r[b] << (ir & 0x000F);
+            }
+            else if (ir & 0x0020) {
+                res = (vec) ((vmask) g->r[b] >> (ir & 0x000F));
+            }
+            else {
+                res = g->r[b] >> (ir & 0x000F);
+            }
+            g->r[a] = BLEND(g->r[a], res, vm);
+            g->psr = BLEND(g->psr, (g->psr & 0xFFF8) | NZP(res), vm);
+            break;
+
+        case OP_LEA:
+            res = SPLAT(next + (sext(ir & 0x01FF, 9) << 1));
+            g->r[a] = BLEND(g->r[a], res, vm);
+            g->psr = BLEND(g->psr, (g->psr & 0xFFF8) | NZP(res), vm);
+            break;
+
+        case OP_JSR:
+            /* R7 is written first, as in state 20 */
+            g->r[R_7] = BLEND(g->r[R_7], SPLAT(next), vm);
+            if (ir & 0x0800) {
+                g->pc = BLEND(g->pc,
+                              SPLAT(next + (sext(ir & 0x07FF, 11) << 1)), vm);
+            }
+            else {
+                g->pc = BLEND(g->pc, g->r[b], vm);
+            }
+            cycles = CYC_JSR;
+            break;
+
+        case OP_JMP:
+            g->pc = BLEND(g->pc, g->r[b], vm);
+            cycles = CYC_JMP;
+            break;
+
+        case OP_TRAP:
+            g->mar = BLEND(g->mar, SPLAT((ir & 0x00FF) << 1), vm);
+            for (i = 0; i < ns; i++) {
+                l = sel[i];
+                g->mdr[l] = mem_word(&g->m[l]->mem, (ir & 0x00FF) << 1);
+            }
+            g->r[R_7] = BLEND(g->r[R_7], SPLAT(next), vm);
+            g->pc = BLEND(g->pc, g->mdr, vm);
+            cycles = CYC_TRAP;
+            break;
+
+        case OP_LDW:
+        case OP_LDB:
+        case OP_LDI:
+            imm = sext(ir & 0x003F, 6) << (op != OP_LDB);
+            g->mar = BLEND(g->mar, g->r[b] + imm, vm);
+            for (i = 0; i < ns; i++) {
+                l = sel[i];
+                if (op == OP_LDI) {
+                    g->mar[l] = mem_word(&g->m[l]->mem, g->mar[l]);
+                }
+                g->mdr[l] = mem_word(&g->m[l]->mem, g->mar[l]);
+            }
+            if (op == OP_LDB) {
+                /* Select the addressed byte and sign-extend it */
+                bm = (vmask) ((g->mar & 1) != 0);
+                res = BLEND(g->mdr & 0xFF, g->mdr >> 8, bm);
+                res = (vec) ((vmask) (res << 8) >> 8);
+            }
+            else {
+                res = g->mdr;
+            }
+            g->r[a] = BLEND(g->r[a], res, vm);
+            g->psr = BLEND(g->psr, (g->psr & 0xFFF8) | NZP(res), vm);
+            cycles = (op == OP_LDW) ? CYC_LDW
+                   : (op == OP_LDB) ? CYC_LDB : CYC_LDI;
+            break;
+
+        case OP_STW:
+        case OP_STB:
+        case OP_STI:
+            imm = sext(ir & 0x003F, 6) << (op != OP_STB);
+            g->mar = BLEND(g->mar, g->r[b] + imm, vm);
+            g->mdr = BLEND(g->mdr, (op == OP_STB) ? (g->r[a] & 0x00FF)
+                                                  : g->r[a], vm);
+            for (i = 0; i < ns; i++) {
+                l = sel[i];
+                m = g->m[l];
+                if (op == OP_STI) {
+                    g->mar[l] = mem_word(&m->mem, g->mar[l]);
+                }
+                val = g->mdr[l];
+                ptr = g->mar[l];
+                if (op != OP_STB) {
+                    mem_write_nodelay(m, ptr, val, 0xFFFF);
+                }
+                else if (ptr & 1) {
+                    mem_write_nodelay(m, ptr, val << 8, 0xFF00);
+                }
+                else {
+                    mem_write_nodelay(m, ptr, val, 0x00FF);
+                }
+            }
+            cycles = (op == OP_STW) ? CYC_STW
+                   : (op == OP_STB) ? CYC_STB : CYC_STI;
+            break;
+    }
+
+    /* Remaining clock cycles */
+    for (i = 0; i < ns; i++) {
+        l = sel[i];
+        n = cycles + ((op == OP_BR) ? g->ben[l] : 0);
+        g->m[l]->cpu.cycles += n;
+        lane_done(g, l, n);
+    }
+}
+
+/*
+ * Choose the PC to run next: the one most lanes are at, the lowest on a tie.
+ * Lanes left waiting too long are split off.
+ *
+ * @param pc    a pointer to store the PC
+ * @return      0 if no lane is ready
+ */
+static int pick(struct group *g, lc3word *pc)
+{
+    int best;
+    int votes;
+    int n;
+    int i, l;
+
+    best = -1;
+    votes = 0;
+    for (l = 0; l < SIMD_LANES; l++) {
+        if (g->m[l] == NULL || !g->in_vec[l]) {
+            continue;
+        }
+        if (best >= 0 && g->pc[l] == g->pc[best]) {
+            continue;
+        }
+
+        /* Lanes before this one with the same PC have already counted it */
+        n = 0;
+        for (i = l; i < SIMD_LANES; i++) {
+            n += (g->m[i] != NULL && g->in_vec[i] && g->pc[i] == g->pc[l]);
+        }
+        if (n > votes || (n == votes && g->pc[l] < g->pc[best])) {
+            best = l;
+            votes = n;
+        }
+        if (votes > SIMD_LANES - l - 1) {
+            break;      /* no other PC can win */
+        }
+    }
+    if (best < 0) {
+        return 0;
+    }
+
+    *pc = g->pc[best];
+    for (l = 0; l < SIMD_LANES; l++) {
+        if (g->m[l] != NULL && g->in_vec[l] && g->pc[l] != *pc
+            && ++g->wait[l] >= SPLIT_AFTER) {
+            lane_split(g, l);
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Test whether a load or store would touch memory-mapped I/O in a lane,
+ * which leaves the instruction to the microcode.
+ */
+static int drop_io(struct group *g, lc3word ir, int l)
+{
+    lc3word addr;
+    int op;
+
+    op = ir >> 12;
+    switch (op) {
+        case OP_LDB:
+        case OP_STB:
+            addr = g->r[(ir >> 6) & 7][l] + sext(ir & 0x003F, 6);
+            return IS_IO(addr & ((op == OP_LDB) ? 0xFFFE : 0xFFFF));
+        case OP_LDW:
+        case OP_STW:
+            addr = g->r[(ir >> 6) & 7][l] + (sext(ir & 0x003F, 6) << 1);
+            return IS_IO(addr);
+        case OP_LDI:
+        case OP_STI:
+            addr = g->r[(ir >> 6) & 7][l] + (sext(ir & 0x003F, 6) << 1);
+            return IS_IO(addr) || IS_IO(mem_word(&g->m[l]->mem, addr));
+    }
+
+    return 0;
+}
+
+/* ===== Lanes ===== */
+
+/*
+ * Put the next machine that can run into a lane, or leave it free.
+ */
+static void lane_start(struct group *g, int l)
+{
+    struct lc3machine *m;
+    int j;
+
+    g->m[l] = NULL;
+    while (g->next < g->num_machines) {
+        j = g->next++;
+        m = g->machines[j];
+        g->count[j] = 0;
+        if (g->max[j] == 0 || !(get_mcr(m) & MCR_CE)) {
+            continue;
+        }
+
+        g->m[l] = m;
+        g->job[l] = j;
+        g->wait[l] = 0;
+        g->in_vec[l] = (m->cpu.state == INITIAL_STATE);
+        if (g->in_vec[l]) {
+            lane_load(g, l);
+        }
+        return;
+    }
+}
+
+/*
+ * Hand a lane's machine back to the caller and start the next one.
+ */
+static void lane_retire(struct group *g, int l)
+{
+    if (g->in_vec[l]) {
+        lane_save(g, l);
+    }
+    lane_start(g, l);
+}
+
+/*
+ * Finish a lane's machine on the fast engine.
+ */
+static void lane_split(struct group *g, int l)
+{
+    int j;
+
+    if (g->in_vec[l]) {
+        lane_save(g, l);
+        g->in_vec[l] = 0;
+    }
+
+    j = g->job[l];
+    if (g->count[j] < g->max[j]) {
+        g->count[j] += cpu_run(g->m[l], ENGINE_FAST, g->max[j] - g->count[j]);
+    }
+    lane_retire(g, l);
+}
+
+/*
+ * Skip ahead if a lane's machine is idle, on arriving at a loop head.
+ */
+static void lane_idle(struct group *g, int l)
+{
+    struct lc3machine *m;
+    uint64_t skip;
+    int j;
+
+    m = g->m[l];
+    j = g->job[l];
+    lane_save(g, l);
+    skip = idle_skip(m, g->max[j] - g->count[j]);
+    m->cpu.cycles += skip;
+    g->count[j] += skip;
+}
+
+/*
+ * Run one step of a lane on its own, after its first clock cycle.
+ */
+static void lane_scalar(struct group *g, int l)
+{
+    struct lc3machine *m;
+    int n;
+
+    m = g->m[l];
+    if (g->in_vec[l]) {
+        lane_save(g, l);
+    }
+
+    n = cpu_step(m);
+    g->in_vec[l] = (m->cpu.state == INITIAL_STATE);
+    if (g->in_vec[l]) {
+        lane_load(g, l);
+    }
+    lane_done(g, l, n);
+}
+
+/*
+ * Account for an instruction that took 'n' clock cycles in a lane, the first
+ * of which has already clocked the devices. The CPU's own cycle counter is
+ * left to the caller.
+ */
+static void lane_done(struct group *g, int l, int n)
+{
+    struct lc3machine *m;
+    int j;
+
+    m = g->m[l];
+    j = g->job[l];
+    g->count[j] += n;
+    sched_advance(m, n - 1);
+
+    if (g->count[j] >= g->max[j] || !(get_mcr(m) & MCR_CE)) {
+        lane_retire(g, l);
+    }
+}
+
+/*
+ * Move a machine's registers into its lane.
+ */
+static void lane_load(struct group *g, int l)
+{
+    struct lc3cpu *cpu;
+    int i;
+
+    cpu = &g->m[l]->cpu;
+    for (i = 0; i < GPREGS; i++) {
+        g->r[i][l] = cpu->r[i];
+    }
+    g->pc[l] = cpu->pc;
+    g->ir[l] = cpu->ir;
+    g->mar[l] = cpu->mar;
+    g->mdr[l] = cpu->mdr;
+    g->psr[l] = cpu_psr(cpu);
+    g->ben[l] = cpu->ben;
+}
+
+/*
+ * Move a lane's registers back into its machine.
+ */
+static void lane_save(struct group *g, int l)
+{
+    struct lc3cpu *cpu;
+    int i;
+
+    cpu = &g->m[l]->cpu;
+    for (i = 0; i < GPREGS; i++) {
+        cpu->r[i] = g->r[i][l];
+    }
+    cpu->pc = g->pc[l];
+    cpu->ir = g->ir[l];
+    cpu->mar = g->mar[l];
+    cpu->mdr = g->mdr[l];
+    cpu_setpsr(cpu, g->psr[l]);
+    cpu->ben = g->ben[l];
+}
+
+static inline lc3sword sext(lc3word val, int pos)
+{
+    lc3word mask;
+
+    mask = 1 << (pos - 1);
+    return (lc3sword) ((val ^ mask) - mask);
+}
+
+#else
+
+/*
+ * Without vector extensions, run the machines one after another.
+ */
+void simd_run(struct lc3machine **m, const uint64_t *max, uint64_t *count,
+              int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        count[i] = cpu_run(m[i], ENGINE_FAST, max[i]);
+    }
+}
+
+#endif /* __GNUC__ */
@@ -0,0 +1,461 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: src/emu/snapshot.c
+ * Author: Wes Hampson
+ *   Desc: Machine snapshots. State is stored in fixed-width fields, so the
+ *         layout does not depend on how the compiler packs the machine's own
+ *         structures; only the byte order is the host's.
+ *============================================================================*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <emu/lc3.h>
+#include <emu/cpu.h>
+#include <emu/mem.h>
+#include <emu/machine.h>
+#include <emu/snapshot.h>
+
+#define SNAP_MAGIC      "LC3SNAP"
+#define SNAP_ORDER      0x01020304
+#define SNAP_VERSION    1           /* bump on any change to the layout */
+#define SNAP_SIZE       (SNAP_PAGE + MEM_SIZE)
+#define NUM_STATES      64          /* microcode states */
+
+/*
+ * Header page contents. Fields are ordered widest first so that no padding
+ * falls between them.
+ */
+struct snap_header {
+    char magic[8];                  /* SNAP_MAGIC */
+    uint32_t order;                 /* SNAP_ORDER, in the writer's order */
+    uint32_t version;               /* SNAP_VERSION */
+    uint32_t page;                  /* offset of the memory image */
+    uint32_t mem_size;              /* size of the memory image */
+
+    uint64_t cycles;                /* CPU */
+    uint64_t mem_done;              /* memory */
+    uint64_t mem_writes;
+    uint64_t disp_done;             /* display */
+    uint64_t now;                   /* scheduler */
+    uint64_t next;
+    uint64_t changes;
+    uint64_t when[NUM_EVENTS];      /* pending events, in heap order */
+    int32_t ev[NUM_EVENTS];
+    int32_t pos[NUM_EVENTS];
+    int32_t busy;
+    int32_t size;
+
+    int32_t ben;                    /* CPU */
+    int32_t intf;
+    int32_t state;
+    int32_t r_en;                   /* memory */
+    int32_t w_en;
+    int32_t taken;                  /* keyboard */
+
+    uint16_t r[GPREGS];             /* CPU */
+    uint16_t pc;
+    uint16_t ir;
+    uint16_t mar;
+    uint16_t mdr;
+    uint16_t saved_ssp;
+    uint16_t saved_usp;
+    uint16_t psr;
+    uint16_t mcr;
+    uint16_t iccr;                  /* PIC */
+    uint16_t icdr;
+    uint16_t kbsr;                  /* keyboard */
+    uint16_t kbdr;
+    uint16_t dsr;                   /* display */
+    uint16_t ddr;
+
+    uint8_t intv;                   /* CPU */
+    uint8_t intp;
+    uint8_t irr;                    /* PIC */
+    uint8_t isr;
+    uint8_t imr;
+    uint8_t lines;
+};
+
+/* The header must fit in the page ahead of the memory image */
+typedef char header_fits[(sizeof(struct snap_header) <= SNAP_PAGE) ? 1 : -1];
+
+struct lc3snap {
+    const unsigned char *data;      /* the whole file, SNAP_SIZE bytes */
+    const struct snap_header *hdr;  /* header page */
+    const lc3word *mem;             /* memory image */
+};
+
+static void save_header(struct lc3machine *m, struct snap_header *h);
+static int check_header(const struct snap_header *h, const char *path);
+static unsigned char * map_file(const char *path);
+static void unmap_file(const unsigned char *data);
+
+/* ===== Public Functions ===== */
+
+int snapshot_save(struct lc3machine *m, const char *path)
+{
+    unsigned char *page;
+    char *tmp;
+    FILE *f;
+    int ok;
+    int i;
+
+    page = calloc(1, SNAP_PAGE);
+    tmp = malloc(strlen(path) + 5);
+    if (page == NULL || tmp == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        free(page);
+        free(tmp);
+        return -1;
+    }
+    save_header(m, (struct snap_header *) page);
+    sprintf(tmp, "%s.tmp", path);
+
+    f = fopen(tmp, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "error: failed to open '%s'\n", tmp);
+        free(page);
+        free(tmp);
+        return -1;
+    }
+
+    ok = fwrite(page, 1, SNAP_PAGE, f) == SNAP_PAGE;
+    for (i = 0; ok && i < MEM_PAGES; i++) {
+        ok = fwrite(mem_pages(m)[i], 1, MEM_PAGE_SIZE, f) == MEM_PAGE_SIZE;
+    }
+    ok = (fclose(f) == 0) && ok;
+#ifdef _WIN32
+    if (ok) {
+        remove(path);
+    }
+#endif
+    if (!ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "error: failed to write '%s'\n", path);
+        remove(tmp);
+        ok = 0;
+    }
+
+    free(page);
+    free(tmp);
+    return ok ? 0 : -1;
+}
+
+struct lc3snap * snapshot_open(const char *path)
+{
+    struct lc3snap *s;
+    unsigned char *data;
+
+    data = map_file(path);
+    if (data == NULL) {
+        return NULL;
+    }
+
+    s = malloc(sizeof(struct lc3snap));
+    if (s == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        unmap_file(data);
+        return NULL;
+    }
+    s->data = data;
+    s->hdr = (const struct snap_header *) data;
+    s->mem = (const lc3word *) (data + SNAP_PAGE);
+
+    if (check_header(s->hdr, path) != 0) {
+        snapshot_close(s);
+        return NULL;
+    }
+    return s;
+}
+
+void snapshot_restore(struct lc3machine *m, const struct lc3snap *s)
+{
+    const struct snap_header *h;
+    int i;
+
+    h = s->hdr;
+    for (i = 0; i < MEM_DEPTH; i++) {
+        if (mem_word(&m->mem, (lc3word) (i << 1)) != s->mem[i]) {
+            mem_write_nodelay(m, (lc3word) (i << 1), s->mem[i], 0xFFFF);
+        }
+    }
+
+    for (i = 0; i < GPREGS; i++) {
+        m->cpu.r[i] = h->r[i];
+    }
+    m->cpu.pc = h->pc;
+    m->cpu.ir = h->ir;
+    m->cpu.mar = h->mar;
+    m->cpu.mdr = h->mdr;
+    m->cpu.saved_ssp = h->saved_ssp;
+    m->cpu.saved_usp = h->saved_usp;
+    cpu_setpsr(&m->cpu, h->psr);
+    m->cpu.ben = h->ben;
+    m->cpu.intf = h->intf;
+    m->cpu.intv = h->intv;
+    m->cpu.intp = h->intp;
+    m->cpu.state = h->state;
+    m->cpu.mcr = h->mcr;
+    m->cpu.cycles = h->cycles;
+
+    m->mem.done = h->mem_done;
+    m->mem.writes = h->mem_writes;
+    m->mem.r_en = h->r_en;
+    m->mem.w_en = h->w_en;
+
+    m->pic.irr = h->irr;
+    m->pic.isr = h->isr;
+    m->pic.imr = h->imr;
+    m->pic.lines = h->lines;
+    m->pic.iccr = h->iccr;
+    m->pic.icdr = h->icdr;
+
+    m->kbd.kbsr = h->kbsr;
+    m->kbd.kbdr = h->kbdr;
+    m->kbd.taken = h->taken;
+
+    m->disp.dsr = h->dsr;
+    m->disp.ddr = h->ddr;
+    m->disp.done = h->disp_done;
+
+    m->sched.now = h->now;
+    m->sched.next = h->next;
+    m->sched.changes = h->changes;
+    m->sched.busy = h->busy;
+    m->sched.size = h->size;
+    for (i = 0; i < NUM_EVENTS; i++) {
+        m->sched.heap[i].when = h->when[i];
+        m->sched.heap[i].ev = h->ev[i];
+        m->sched.pos[i] = h->pos[i];
+    }
+
+    /* The idle detector's watch was taken on the old timeline */
+    idle_reset(m);
+}
+
+void snapshot_close(struct lc3snap *s)
+{
+    if (s == NULL) {
+        return;
+    }
+
+    unmap_file(s->data);
+    free(s);
+}
+
+int snapshot_load(struct lc3machine *m, const char *path)
+{
+    struct lc3snap *s;
+
+    s = snapshot_open(path);
+    if (s == NULL) {
+        return -1;
+    }
+
+    snapshot_restore(m, s);
+    snapshot_close(s);
+    return 0;
+}
+
+/* ===== Private Functions ===== */
+
+/*
+ * Copy a machine's state into a zeroed header.
+ */
+static void save_header(struct lc3machine *m, struct snap_header *h)
+{
+    int i;
+
+    memcpy(h->magic, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+    h->order = SNAP_ORDER;
+    h->version = SNAP_VERSION;
+    h->page = SNAP_PAGE;
+    h->mem_size = MEM_SIZE;
+
+    for (i = 0; i < GPREGS; i++) {
+        h->r[i] = m->cpu.r[i];
+    }
+    h->pc = m->cpu.pc;
+    h->ir = m->cpu.ir;
+    h->mar = m->cpu.mar;
+    h->mdr = m->cpu.mdr;
+    h->saved_ssp = m->cpu.saved_ssp;
+    h->saved_usp = m->cpu.saved_usp;
+    h->psr = cpu_psr(&m->cpu);
+    h->ben = m->cpu.ben;
+    h->intf = m->cpu.intf;
+    h->intv = m->cpu.intv;
+    h->intp = m->cpu.intp;
+    h->state = m->cpu.state;
+    h->mcr = m->cpu.mcr;
+    h->cycles = m->cpu.cycles;
+
+    h->mem_done = m->mem.done;
+    h->mem_writes = m->mem.writes;
+    h->r_en = m->mem.r_en;
+    h->w_en = m->mem.w_en;
+
+    h->irr = m->pic.irr;
+    h->isr = m->pic.isr;
+    h->imr = m->pic.imr;
+    h->lines = m->pic.lines;
+    h->iccr = m->pic.iccr;
+    h->icdr = m->pic.icdr;
+
+    h->kbsr = m->kbd.kbsr;
+    h->kbdr = m->kbd.kbdr;
+    h->taken = m->kbd.taken;
+
+    h->dsr = m->disp.dsr;
+    h->ddr = m->disp.ddr;
+    h->disp_done = m->disp.done;
+
+    h->now = m->sched.now;
+    h->next = m->sched.next;
+    h->changes = m->sched.changes;
+    h->busy = m->sched.busy;
+    h->size = m->sched.size;
+    for (i = 0; i < NUM_EVENTS; i++) {
+        h->when[i] = m->sched.heap[i].when;
+        h->ev[i] = m->sched.heap[i].ev;
+        h->pos[i] = m->sched.pos[i];
+    }
+}
+
+/*
+ * Check that a header was written by a compatible build and that its state
+ * is in range, so a damaged file cannot send the machine out of bounds.
+ * Errors are reported on stderr.
+ *
+ * @return      0 if the snapshot can be restored
+ *              -1 otherwise
+ */
+static int check_header(const struct snap_header *h, const char *path)
+{
+    int i;
+
+    if (memcmp(h->magic, SNAP_MAGIC, sizeof(SNAP_MAGIC)) != 0) {
+        fprintf(stderr, "error: '%s' is not a snapshot\n", path);
+        return -1;
+    }
+    if (h->order != SNAP_ORDER || h->version != SNAP_VERSION
+        || h->page != SNAP_PAGE || h->mem_size != MEM_SIZE) {
+        fprintf(stderr, "error: '%s' was saved by an incompatible build\n",
+                path);
+        return -1;
+    }
+
+    if (h->state < 0 || h->state >= NUM_STATES
+        || h->size < 0 || h->size > NUM_EVENTS) {
+        goto bad;
+    }
+    for (i = 0; i < NUM_EVENTS; i++) {
+        if (h->pos[i] < -1 || h->pos[i] >= h->size) {
+            goto bad;
+        }
+        if (i < h->size && (h->ev[i] < 0 || h->ev[i] >= NUM_EVENTS)) {
+            goto bad;
+        }
+    }
+    return 0;
+
+bad:
+    fprintf(stderr, "error: '%s' is damaged\n", path);
+    return -1;
+}
+
+#ifndef _WIN32
+
+/*
+ * Map a snapshot file read-only. Pages are only read in as restores touch
+ * them. Errors are reported on stderr.
+ *
+ * @return      the file contents, SNAP_SIZE bytes
+ *              NULL on error
+ */
+static unsigned char * map_file(const char *path)
+{
+    struct stat st;
+    void *data;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "error: failed to open '%s'\n", path);
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size != SNAP_SIZE) {
+        fprintf(stderr, "error: '%s' is not a snapshot\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    data = mmap(NULL, SNAP_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "error: failed to map '%s'\n", path);
+        return NULL;
+    }
+    return data;
+}
+
+static void unmap_file(const unsigned char *data)
+{
+    munmap((void *) data, SNAP_SIZE);
+}
+
+#else
+
+static unsigned char * map_file(const char *path)
+{
+    unsigned char *data;
+    FILE *f;
+    size_t n;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "error: failed to open '%s'\n", path);
+        return NULL;
+    }
+
+    data = malloc(SNAP_SIZE + 1);
+    n = (data != NULL) ? fread(data, 1, SNAP_SIZE + 1, f) : 0;
+    fclose(f);
+    if (n != SNAP_SIZE) {
+        fprintf(stderr, "error: '%s' is not a snapshot\n", path);
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+static void unmap_file(const unsigned char *data)
+{
+    free((void *) data);
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,166 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*==============================================================================
+ *   File: src/emu/traps.c
+ * Author: Wes Hampson
+ *   Desc: Native trap service routines.
+ *============================================================================*/
+
+#include <stdlib.h>
+
+#include <emu/traps.h>
+#include <emu/cpu.h>
+#include <emu/mem.h>
+#include <emu/kbd.h>
+#include <emu/disp.h>
+#include <emu/machine.h>
+
+static int trap_getc(struct lc3machine *m);
+static int trap_out(struct lc3machine *m);
+static int trap_puts(struct lc3machine *m);
+static int trap_putsp(struct lc3machine *m);
+static int trap_halt(struct lc3machine *m);
+
+int traps_enable(struct lc3machine *m, int cost)
+{
+    if (m->traps == NULL) {
+        m->traps = calloc(1, sizeof(struct lc3traps));
+        if (m->traps == NULL) {
+            return -1;
+        }
+    }
+
+    /* The microcode has already spent FETCH_CYCLES when it reaches state 15 */
+    m->traps->cost = (cost > FETCH_CYCLES) ? cost : FETCH_CYCLES + 1;
+    m->traps->fn[TRAP_GETC] = trap_getc;
+    m->traps->fn[TRAP_OUT] = trap_out;
+    m->traps->fn[TRAP_PUTS] = trap_puts;
+    m->traps->fn[TRAP_PUTSP] = trap_putsp;
+    m->traps->fn[TRAP_HALT] = trap_halt;
+    return 0;
+}
+
+void traps_set(struct lc3machine *m, lc3byte vec, lc3trap_fn fn)
+{
+    m->traps->fn[vec] = fn;
+}
+
+void traps_free(struct lc3machine *m)
+{
+    free(m->traps);
+    m->traps = NULL;
+}
+
+int traps_native(struct lc3machine *m, lc3word ir)
+{
+    return m->traps != NULL && (ir >> 12) == OP_TRAP
+        && m->traps->fn[ir & 0x00FF] != NULL;
+}
+
+int traps_exec(struct lc3machine *m, lc3byte vec)
+{
+    lc3trap_fn fn;
+
+    fn = m->traps->fn[vec];
+    if (fn == NULL) {
+        return 0;
+    }
+
+    /* TRAP (states 15, 28), then the routine, then RET */
+    m->cpu.mar = vec << 1;
+    m->cpu.r[R_7] = m->cpu.pc;
+    if (!fn(m)) {
+        m->cpu.pc -= 2;
+    }
+
+    return m->traps->cost;
+}
+
+/*
+ * GETC: wait for a key and put it in R0. Like the keyboard ISR, clears the
+ * ready bit before reading KBDR.
+ */
+static int trap_getc(struct lc3machine *m)
+{
+    if (!(get_kbsr(m) & KBSR_RD)) {
+        return 0;
+    }
+
+    set_kbsr(m, get_kbsr(m) & ~KBSR_RD);
+    m->cpu.r[R_0] = get_kbdr(m) & 0xFF;
+    return 1;
+}
+
+/*
+ * OUT: display the character in R0.
+ */
+static int trap_out(struct lc3machine *m)
+{
+    disp_put(m, m->cpu.r[R_0] & 0xFF);
+    return 1;
+}
+
+/*
+ * PUTS: display the NUL-terminated string at R0, one character per word.
+ */
+static int trap_puts(struct lc3machine *m)
+{
+    lc3word addr;
+    lc3word data;
+
+    for (addr = m->cpu.r[R_0] & 0xFFFE; !IS_IO(addr); addr += 2) {
+        mem_read_nodelay(m, &data, addr);
+        if ((data & 0xFF) == 0) {
+            break;
+        }
+        disp_put(m, data & 0xFF);
+    }
+
+    return 1;
+}
+
+/*
+ * PUTSP: display the NUL-terminated string at R0, two characters per word,
+ * low byte first.
+ */
+static int trap_putsp(struct lc3machine *m)
+{
+    lc3word addr;
+    lc3word data;
+
+    for (addr = m->cpu.r[R_0] & 0xFFFE; !IS_IO(addr); addr += 2) {
+        mem_read_nodelay(m, &data, addr);
+        if ((data & 0xFF) == 0) {
+            break;
+        }
+        disp_put(m, data & 0xFF);
+        if ((data >> 8) == 0) {
+            break;
+        }
+        disp_put(m, data >> 8);
+    }
+
+    return 1;
+}
+
+/*
+ * HALT: stop the clock.
+ */
+static int trap_halt(struct lc3machine *m)
+{
+    set_mcr(m, get_mcr(m) & ~MCR_CE);
+    return 1;
+}
@@ -0,0 +1,71 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*==============================================================================
+ *   File: src/lib/obj.c
+ * Author: Wes Hampson
+ *   Desc: Object image functions for the lc3tools common library.
+ *============================================================================*/
+
+#include <stdio.h>
+#include <lc3tools.h>
+
+/*
+ * Read an object image into a buffer.
+ */
+int read_object(const char *path, uint16_t *origin, uint16_t *words)
+{
+    FILE *f;
+    unsigned char hdr[16];
+    unsigned char buf[2];
+    uint64_t org, size;
+    int count;
+    int i;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "error: failed to open image '%s'\n", path);
+        return -1;
+    }
+
+    if (fread(hdr, sizeof(hdr), 1, f) != 1) {
+        fprintf(stderr, "error: '%s' is not an object image\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    org = 0;
+    size = 0;
+    for (i = 7; i >= 0; i--) {
+        org = (org << 8) | hdr[i];
+        size = (size << 8) | hdr[8 + i];
+    }
+
+    if (org > 0xFFFF || org + size > 2 * OBJ_MAX_WORDS) {
+        fprintf(stderr, "error: image '%s' does not fit in memory\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    *origin = (uint16_t) org;
+    count = 0;
+    while (size >= 2 && fread(buf, sizeof(buf), 1, f) == 1) {
+        words[count++] = buf[0] | (buf[1] << 8);
+        size -= 2;
+    }
+
+    fclose(f);
+    return count;
+}
@@ -0,0 +1,210 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: test/emu/api.c
+ * Author: Wes Hampson
+ *   Desc: liblc3emu interface regression test.
+ *         Each case runs a small program on every engine available and checks
+ *         what the library reports against the microcoded engine.
+ *============================================================================*/
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <lc3emu.h>
+
+#define ORIGIN          0x3000
+#define RUN_CYCLES      100000
+#define VISITS          3
+#define KBSR            0xFE00
+#define MCR             0xFFFE
+#define KBSR_IE         0x4000
+#define MCR_CE          0x8000
+
+/*
+ * Stores a byte to RAM, then counts. The microcode fetches the instruction
+ * after an STB in state 19, not 18.
+ */
+static const uint16_t stb_ram[] = {
+    0xE204,     /* LOOP   LEA R1, BUF           */
+    0x3040,     /*        STB R0, R1, #0        */
+    0x1021,     /*        ADD R0, R0, #1        */
+    0x14A1,     /*        ADD R2, R2, #1        */
+    0x0FFB,     /*        BRnzp LOOP            */
+    0x0000      /* BUF    .FILL x0000           */
+};
+
+/*
+ * Stores a byte to the I/O page (the low byte of MCR, which leaves the clock
+ * running), then counts. Every engine leaves the STB to the microcode.
+ */
+static const uint16_t stb_io[] = {
+    0xE205,     /*        LEA R1, MCR           */
+    0x6240,     /*        LDW R1, R1, #0        */
+    0x3040,     /* LOOP   STB R0, R1, #0        */
+    0x1021,     /*        ADD R0, R0, #1        */
+    0x14A1,     /*        ADD R2, R2, #1        */
+    0x0FFC,     /*        BRnzp LOOP            */
+    0xFFFE      /* MCR    .FILL xFFFE           */
+};
+
+static const char *names[] = { "micro", "fast", "jit", "aot", "simd" };
+
+static int test_run_until(const char *name, const uint16_t *program,
+                          size_t size, uint16_t pc);
+static int test_io_page(void);
+static struct lc3emu * start(enum lc3emu_engine engine,
+                             const uint16_t *program, size_t size);
+
+int main(void)
+{
+    int failed;
+
+    failed = 0;
+    failed |= test_run_until("STB to RAM", stb_ram,
+                             sizeof(stb_ram) / sizeof(uint16_t), 0x3004);
+    failed |= test_run_until("STB to I/O", stb_io,
+                             sizeof(stb_io) / sizeof(uint16_t), 0x3006);
+    failed |= test_io_page();
+
+    return failed;
+}
+
+/*
+ * Check that lc3emu_run_until() stops on each visit to the instruction after
+ * an STB, at the same cycle on every engine.
+ *
+ * @param name      the case name
+ * @param program   the program, loaded at ORIGIN
+ * @param size      the size of the program in words
+ * @param pc        the address to stop at
+ * @return          0 on success
+ *                  1 on failure
+ */
+static int test_run_until(const char *name, const uint16_t *program,
+                          size_t size, uint16_t pc)
+{
+    enum lc3emu_engine engine;
+    enum lc3emu_status status;
+    struct lc3emu *e;
+    uint64_t want[VISITS];
+    int failed;
+    int i;
+
+    failed = 0;
+    for (engine = LC3EMU_MICRO; engine <= LC3EMU_SIMD; engine++) {
+        e = start(engine, program, size);
+        if (e == NULL) {
+            continue;
+        }
+        for (i = 0; i < VISITS; i++) {
+            status = lc3emu_run_until(e, pc, RUN_CYCLES);
+            if (status != LC3EMU_BREAK
+                || lc3emu_get_reg(e, LC3EMU_PC) != pc) {
+                fprintf(stderr, "%s: %s: run_until(x%04X) returned %d "
+                                "at PC x%04X\n", names[engine], name, pc,
+                        (int) status, lc3emu_get_reg(e, LC3EMU_PC));
+                failed = 1;
+                break;
+            }
+            if (engine == LC3EMU_MICRO) {
+                want[i] = lc3emu_cycles(e);
+            }
+            else if (lc3emu_cycles(e) != want[i]) {
+                fprintf(stderr, "%s: %s: visit %d at %llu cycles, "
+                                "expected %llu\n", names[engine], name, i + 1,
+                        (unsigned long long) lc3emu_cycles(e),
+                        (unsigned long long) want[i]);
+                failed = 1;
+                break;
+            }
+        }
+        lc3emu_destroy(e);
+        if (engine == LC3EMU_MICRO && failed) {
+            break;
+        }
+    }
+
+    return failed;
+}
+
+/*
+ * Check that lc3emu_read_mem() and lc3emu_write_mem() reach the device
+ * registers in the I/O page.
+ *
+ * @return          0 on success
+ *                  1 on failure
+ */
+static int test_io_page(void)
+{
+    struct lc3emu *e;
+    uint16_t kbsr, mcr;
+    int failed;
+
+    e = start(LC3EMU_MICRO, stb_ram, sizeof(stb_ram) / sizeof(uint16_t));
+    if (e == NULL) {
+        fprintf(stderr, "micro: failed to create the machine\n");
+        return 1;
+    }
+
+    failed = 0;
+    lc3emu_read_mem(e, KBSR, &kbsr, 1);
+    lc3emu_read_mem(e, MCR, &mcr, 1);
+    if (kbsr != KBSR_IE || mcr != MCR_CE) {
+        fprintf(stderr, "read_mem: KBSR = x%04X, MCR = x%04X, "
+                        "expected x%04X, x%04X\n",
+                kbsr, mcr, KBSR_IE, MCR_CE);
+        failed = 1;
+    }
+
+    /* Clearing MCR[15] stops the clock */
+    mcr = 0;
+    lc3emu_write_mem(e, MCR, &mcr, 1);
+    lc3emu_read_mem(e, MCR, &mcr, 1);
+    if (mcr != 0 || lc3emu_run_for(e, RUN_CYCLES) != LC3EMU_HALTED) {
+        fprintf(stderr, "write_mem: MCR = x%04X, clock not stopped\n", mcr);
+        failed = 1;
+    }
+
+    lc3emu_destroy(e);
+    return failed;
+}
+
+/*
+ * Create a machine running a program on an engine.
+ *
+ * @param program   the program, loaded at ORIGIN
+ * @param size      the size of the program in words
+ * @return          the machine
+ *                  NULL if the engine is not available
+ */
+static struct lc3emu * start(enum lc3emu_engine engine,
+                             const uint16_t *program, size_t size)
+{
+    struct lc3emu *e;
+
+    e = lc3emu_create();
+    if (e == NULL || engine == LC3EMU_AOT
+        || lc3emu_set_engine(e, engine) != 0) {
+        lc3emu_destroy(e);
+        return NULL;
+    }
+
+    lc3emu_write_mem(e, ORIGIN, program, size);
+    lc3emu_set_reg(e, LC3EMU_PC, ORIGIN);
+    return e;
+}
@@ -0,0 +1,216 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * lc3tools - An implementation of the LC-3 ISA and assorted tools.           *
+ * Copyright (C) 2018-2019 Wes Hampson.                                       *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 2 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details                                *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+/*==============================================================================
+ *   File: test/emu/irq_timing.c
+ * Author: Wes Hampson
+ *   Desc: Interrupt timing regression test.
+ *         A program counts in a tight loop until a keyboard interrupt stops
+ *         the clock. The key is typed at a different point in the loop on
+ *         each trial, and every engine must take the interrupt on the same
+ *         instruction boundary, and so halt with the same count and cycles,
+ *         as the microcoded engine.
+ *
+ *         Usage: irq_timing [lc3aot]
+ *         Given the path to lc3aot, the program is also translated and run
+ *         on the aot engine.
+ *============================================================================*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <lc3emu.h>
+
+#define ORIGIN          0x3000
+#define LOOP            0x3002
+#define ISR             0x3012
+#define KBD_VECTOR      0x0308      /* IVT entry for IRQ 4 */
+#define TRIALS          64
+#define RUN_CYCLES      1000000
+#define OBJ_FILE        "irq_timing.obj"
+#define AOT_FILE        "irq_timing.so"
+
+/*
+ * The program.
+ */
+static const uint16_t program[] = {
+    0x5020,     /*        AND R0, R0, #0        */
+    0x1021,     /* LOOP   ADD R0, R0, #1        */
+    0x1223,     /*        ADD R1, R0, #3        */
+    0x9440,     /*        XOR R2, R1, R0        */
+    0x1681,     /*        ADD R3, R2, R1        */
+    0x58E7,     /*        AND R4, R3, #7        */
+    0x1B03,     /*        ADD R5, R4, R3        */
+    0x6DC0,     /*        LDW R6, R7, #0        */
+    0x0FF8,     /*        BRnzp LOOP            */
+    0xE203,     /* ISR    LEA R1, MCR           */
+    0x6240,     /*        LDW R1, R1, #0        */
+    0x54A0,     /*        AND R2, R2, #0        */
+    0x7440,     /*        STW R2, R1, #0        */
+    0xFFFE      /* MCR    .FILL xFFFE           */
+};
+
+static const char *names[] = { "micro", "fast", "jit", "aot", "simd" };
+
+static int have_aot;
+
+static int build_module(const char *lc3aot);
+static int trial(enum lc3emu_engine engine, uint64_t delay,
+                 uint16_t *count, uint64_t *cycles);
+
+int main(int argc, char *argv[])
+{
+    enum lc3emu_engine engine;
+    uint64_t delay;
+    uint64_t want_cycles, got_cycles;
+    uint16_t want_count, got_count;
+    int failed;
+    int rc;
+    int i;
+
+    if (argc > 1 && build_module(argv[1]) != 0) {
+        fprintf(stderr, "aot: failed to translate the program\n");
+        return 1;
+    }
+
+    failed = 0;
+    for (i = 1; i <= TRIALS; i++) {
+        delay = (uint64_t) i * 10007;
+        if (trial(LC3EMU_MICRO, delay, &want_count, &want_cycles) != 0) {
+            fprintf(stderr, "micro: program did not halt\n");
+            return 1;
+        }
+        for (engine = LC3EMU_FAST; engine <= LC3EMU_SIMD; engine++) {
+            if (engine == LC3EMU_AOT && !have_aot) {
+                continue;
+            }
+            rc = trial(engine, delay, &got_count, &got_cycles);
+            if (rc < 0 && engine != LC3EMU_AOT) {
+                continue;
+            }
+            if (rc < 0) {
+                fprintf(stderr, "aot: failed to load the module\n");
+                failed = 1;
+            }
+            else if (rc > 0) {
+                fprintf(stderr, "%s: program did not halt\n", names[engine]);
+                failed = 1;
+            }
+            else if (got_count != want_count || got_cycles != want_cycles) {
+                fprintf(stderr, "%s: key after %llu cycles: "
+                                "R0 = x%04X at %llu, expected x%04X at %llu\n",
+                        names[engine], (unsigned long long) delay,
+                        got_count, (unsigned long long) got_cycles,
+                        want_count, (unsigned long long) want_cycles);
+                failed = 1;
+            }
+        }
+    }
+
+    return failed;
+}
+
+/*
+ * Write the program as an object image and translate it with lc3aot.
+ *
+ * @param lc3aot    the translator
+ * @return          0 on success
+ *                  -1 on failure
+ */
+static int build_module(const char *lc3aot)
+{
+    char cmd[4096];
+    FILE *f;
+    size_t i;
+    int ok;
+
+    f = fopen(OBJ_FILE, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+
+    /* Origin and size in bytes, both 64-bit little-endian, then the words */
+    ok = fputc(ORIGIN & 0xFF, f) != EOF && fputc(ORIGIN >> 8, f) != EOF;
+    for (i = 2; i < 8; i++) {
+        ok = ok && fputc(0, f) != EOF;
+    }
+    ok = ok && fputc((int) sizeof(program), f) != EOF;
+    for (i = 1; i < 8; i++) {
+        ok = ok && fputc(0, f) != EOF;
+    }
+    for (i = 0; i < sizeof(program) / sizeof(uint16_t); i++) {
+        ok = ok && fputc(program[i] & 0xFF, f) != EOF
+                && fputc(program[i] >> 8, f) != EOF;
+    }
+    if (fclose(f) != 0 || !ok) {
+        return -1;
+    }
+
+    snprintf(cmd, sizeof(cmd), "\"%s\" -o %s %s", lc3aot, AOT_FILE, OBJ_FILE);
+    if (system(cmd) != 0) {
+        return -1;
+    }
+
+    have_aot = 1;
+    return 0;
+}
+
+/*
+ * Run the program on an engine, typing a key once it has run for a while.
+ *
+ * @param delay     cycles to run before typing the key
+ * @param count     a pointer to store the count (R0) it halted with
+ * @param cycles    a pointer to store the cycles it halted at
+ * @return          0 on success
+ *                  1 if the program did not halt
+ *                  -1 if the engine is not available
+ */
+static int trial(enum lc3emu_engine engine, uint64_t delay,
+                 uint16_t *count, uint64_t *cycles)
+{
+    struct lc3emu *e;
+    uint16_t vector;
+    int rc;
+
+    e = lc3emu_create();
+    if (e == NULL
+        || (engine == LC3EMU_AOT ? lc3emu_load_aot(e, AOT_FILE)
+                                 : lc3emu_set_engine(e, engine)) != 0) {
+        lc3emu_destroy(e);
+        return -1;
+    }
+
+    vector = ISR;
+    lc3emu_write_mem(e, ORIGIN, program, sizeof(program) / sizeof(uint16_t));
+    lc3emu_write_mem(e, KBD_VECTOR, &vector, 1);
+    lc3emu_set_reg(e, LC3EMU_PC, ORIGIN);
+
+    /* Engines stop a run on different boundaries, so meet at the loop head
+       before typing; the key then arrives on the same cycle for each. */
+    rc = 1;
+    if (lc3emu_run_for(e, delay) == LC3EMU_BUDGET
+        && lc3emu_run_until(e, LOOP, RUN_CYCLES) == LC3EMU_BREAK
+        && lc3emu_input(e, "a", 1) == 0
+        && lc3emu_run_for(e, RUN_CYCLES) == LC3EMU_HALTED) {
+        *count = lc3emu_get_reg(e, LC3EMU_R0);
+        *cycles = lc3emu_cycles(e);
+        rc = 0;
+    }
+
+    lc3emu_destroy(e);
+    return rc;
+}